@@ -0,0 +1,150 @@
+// lexer 微基准
+// 比较手写 lexer (lexer.cpp) 与 flex 生成的 lexer 的吞吐量, 并检查两者输出的 token 序列完全一致
+// 用法: lexer_bench [输入文件] [重复次数]
+// 不指定输入文件时生成约 8 MiB 的 SysY 代码, 包含注释, 关键字, 标识符和各种进制的整数
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "AST_SysY.h"
+#include "lexer.h"
+
+using namespace std;
+
+struct yy_buffer_state;
+extern int yylex_init(yyscan_t *scanner);
+extern yy_buffer_state *yy_scan_buffer(char *base, size_t size, yyscan_t scanner);
+extern int yylex_destroy(yyscan_t scanner);
+extern int yylex(YYSTYPE *yylval, yyscan_t scanner);
+
+// token 及其值, 用于比较两个 lexer 的输出
+struct Token {
+    int kind;
+    int value;
+    bool operator!=(const Token &other) const {
+        return kind != other.kind || value != other.value;
+    }
+};
+
+static string generate_input() {
+    const char *body =
+        "    // line comment with some words in it\n"
+        "    int counter_value = 0x1F + 017 * 42;\n"
+        "    const int limit = 1000000;\n"
+        "    /* block comment\n"
+        "       spanning * several / lines */\n"
+        "    while (counter_value < limit) {\n"
+        "        if (counter_value % 3 == 0 && limit != 7) counter_value = counter_value + 1;\n"
+        "        else { counter_value = counter_value * 2 - 1; continue; }\n"
+        "        break;\n"
+        "    }\n";
+    string input;
+    input.reserve(8 << 20);
+    for (int i = 0; input.size() < (8u << 20); i++) {
+        input += "int function_" + to_string(i) + "() {\n";
+        for (int j = 0; j < 8; j++) {
+            input += body;
+        }
+        input += "    return counter_value;\n}\n";
+    }
+    return input;
+}
+
+static Token value_of(int kind, const YYSTYPE &yylval) {
+    if (kind == IDENTIFIER) {
+        return {kind, static_cast<int>(yylval.sym_val)};
+    }
+    if (kind == INT_CONST) {
+        return {kind, yylval.int_val};
+    }
+    return {kind, 0};
+}
+
+static void lex_flex(string &buffer, vector<Token> *tokens) {
+    yyscan_t scanner;
+    yylex_init(&scanner);
+    yy_scan_buffer(&buffer[0], buffer.size(), scanner);
+    YYSTYPE yylval;
+    int kind;
+    while ((kind = yylex(&yylval, scanner)) != 0) {
+        if (tokens) {
+            tokens->push_back(value_of(kind, yylval));
+        }
+    }
+    yylex_destroy(scanner);
+}
+
+static void lex_hand(const string &input, vector<Token> *tokens) {
+    Lexer lexer;
+    lexer.reset(input.data(), input.data() + input.size());
+    YYSTYPE yylval;
+    int kind;
+    while ((kind = lexer.next(&yylval)) != 0) {
+        if (tokens) {
+            tokens->push_back(value_of(kind, yylval));
+        }
+    }
+}
+
+template <typename F>
+static double measure(int repeat, F f) {
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < repeat; i++) {
+        f();
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count() / repeat;
+}
+
+int main(int argc, const char *argv[]) {
+    string input;
+    if (argc > 1) {
+        ifstream ifs(argv[1], ios::binary);
+        if (!ifs) {
+            cerr << "cannot open " << argv[1] << endl;
+            return 1;
+        }
+        stringstream ss;
+        ss << ifs.rdbuf();
+        input = ss.str();
+    } else {
+        input = generate_input();
+    }
+    int repeat = argc > 2 ? atoi(argv[2]) : 10;
+
+    // 标识符编号来自同一个上下文, 两个 lexer 的结果可以直接比较
+    CompilerContext ctx;
+    ContextGuard guard(ctx);
+
+    // flex 要求缓冲区以两个 NUL 结尾, 并会在扫描时临时改写缓冲区
+    string buffer = input;
+    buffer.append(2, '\0');
+
+    vector<Token> expected, actual;
+    lex_flex(buffer, &expected);
+    lex_hand(input, &actual);
+    if (expected.size() != actual.size()) {
+        cerr << "token count differs: flex " << expected.size() << ", hand " << actual.size() << endl;
+        return 1;
+    }
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (expected[i] != actual[i]) {
+            cerr << "token " << i << " differs: flex " << expected[i].kind << "/" << expected[i].value
+                 << ", hand " << actual[i].kind << "/" << actual[i].value << endl;
+            return 1;
+        }
+    }
+
+    double flex_time = measure(repeat, [&] { lex_flex(buffer, nullptr); });
+    double hand_time = measure(repeat, [&] { lex_hand(input, nullptr); });
+    double megabytes = input.size() / 1048576.0;
+    printf("input: %.2f MiB, %zu tokens, %d runs\n", megabytes, expected.size(), repeat);
+    printf("flex: %8.3f ms  %8.1f MiB/s\n", flex_time * 1e3, megabytes / flex_time);
+    printf("hand: %8.3f ms  %8.1f MiB/s  (%.2fx)\n", hand_time * 1e3, megabytes / hand_time,
+           flex_time / hand_time);
+    return 0;
+}
@@ -12,15 +12,6 @@ const std::string BinaryAST::type_str[] = {
     // 比较运算
     "EQ", "NE", "LT", "GT", "LTE", "GTE",
 };
-const std::string BinaryAST::inst_str[] = {
-    "_undef_",
-    // 算术运算
-    "add", "sub", "mul", "div", "mod",
-    // 逻辑运算
-    "and", "or", "xor",
-    // 比较运算
-    "eq", "ne", "lt", "gt", "le", "ge",
-};
 const std::string BinaryAST::op_str[] = {
     "_undef_",
     // 算术运算
@@ -30,28 +21,176 @@ const std::string BinaryAST::op_str[] = {
     // 比较运算
     "==", "!=", "<", ">", "<=", ">=",
 };
+const koopa_raw_binary_op_t BinaryAST::raw_op[] = {
+    // 未定义的运算不会被使用
+    KOOPA_RBO_ADD,
+    // 算术运算
+    KOOPA_RBO_ADD, KOOPA_RBO_SUB, KOOPA_RBO_MUL, KOOPA_RBO_DIV, KOOPA_RBO_MOD,
+    // 逻辑运算
+    KOOPA_RBO_AND, KOOPA_RBO_OR, KOOPA_RBO_XOR,
+    // 比较运算
+    KOOPA_RBO_EQ, KOOPA_RBO_NOT_EQ, KOOPA_RBO_LT, KOOPA_RBO_GT, KOOPA_RBO_LE, KOOPA_RBO_GE,
+};
+
+const std::vector<FuncSignature> library_functions = {
+    {"getint", {}, true}, {"getch", {}, true}, {"getarray", {{0}}, true},
+    {"putint", {{}}, false}, {"putch", {{}}, false}, {"putarray", {{}, {0}}, false},
+    {"starttime", {}, false}, {"stoptime", {}, false},
+};
 
 // 函数
-ptr<ExpAST> SharedTable::get_or_create(ExpAST* key) {
-    auto it = _table.find(key);
-    ptr<ExpAST> result;
-    if (it != _table.end()) {
-        result = it->second;
-    } else {
-        result = _table[key] = ptr<ExpAST>(key);
+NodePool::~NodePool() {
+    // 节点内存随 arena 释放, 这里只调用析构函数
+    for (size_t i = 1; i < _nodes.size(); i++) {
+        _nodes[i]->~ExpAST();
+    }
+}
+
+ValueAST* NodePool::constant(int number) {
+    auto &result = _constants[number];
+    if (!result) {
+        result = new ValueAST(number);
     }
     return result;
 }
 
-ValueAST* SymbolTable::get_var(const std::string& name, bool recursive) {
-    auto it = _table.find(name);
-    if (it == _table.end()) {
-        if (recursive && _parent) {
-            return _parent->get_var(name);
-        } else {
-            return nullptr;
+koopa_raw_type_t raw_type(KoopaBuilder &b, const VarDims &dims, size_t from) {
+    if (from == dims.size()) {
+        return b.i32_type();
+    }
+    auto base = raw_type(b, dims, from + 1);
+    return dims[from] == 0 ? b.pointer_type(base) : b.array_type(base, dims[from]);
+}
+
+namespace {
+    // 将初始化列表填入从 begin 开始的第 level 维及之后组成的子数组, sizes[k] 为第 k 维及之后的元素个数
+    // 列表中的表达式依次填入, 嵌套的列表对应当前位置对齐的最大子数组 (不包括第 level 维本身)
+    // 初始值多于元素个数时报告错误
+    void fill_init(const InitValAST* list, const VarDims &dims, const std::vector<size_t> &sizes,
+                   size_t level, size_t begin, std::vector<ExpAST*> &out) {
+        size_t pos = begin, end = begin + sizes[level];
+        for (auto &item : list->items) {
+            if (pos >= end) {
+                semantic_error("too many initializers");
+                return;
+            }
+            if (item->expr) {
+                out[pos++] = item->expr;
+                continue;
+            }
+            size_t sub = level + 1;
+            while (sub < dims.size() && (pos - begin) % sizes[sub] != 0) {
+                sub++;
+            }
+            if (sub == dims.size()) {
+                // 单个元素外的大括号
+                if (item->items.size() > 1 || (!item->items.empty() && !item->items[0]->expr)) {
+                    semantic_error("too many braces around scalar initializer");
+                    return;
+                }
+                if (!item->items.empty()) {
+                    out[pos] = item->items[0]->expr;
+                }
+                pos++;
+                continue;
+            }
+            fill_init(item.get(), dims, sizes, sub, pos, out);
+            pos += sizes[sub];
+        }
+    }
+}
+
+std::vector<ExpAST*> flatten_init(const InitValAST* init, const VarDims &dims) {
+    if (init->expr) {
+        semantic_error("array initialized with a single value");
+        return {};
+    }
+    std::vector<size_t> sizes(dims.size() + 1, 1);
+    for (size_t i = dims.size(); i-- > 0;) {
+        sizes[i] = sizes[i + 1] * dims[i];
+    }
+    std::vector<ExpAST*> out(sizes[0], nullptr);
+    fill_init(init, dims, sizes, 0, 0, out);
+    return out;
+}
+
+const FuncSignature* find_function(uint32_t symbol) {
+    auto it = context->functions.find(symbol);
+    if (it != context->functions.end()) {
+        return &it->second;
+    }
+    auto &name = context->interner.name(symbol);
+    for (auto &func : library_functions) {
+        if (func.name == name) {
+            return &func;
+        }
+    }
+    return nullptr;
+}
+
+namespace {
+    // 程序中未重新定义的运行时库函数, 需要在开头声明
+    template <typename F>
+    void for_each_library_function(const std::vector<std::unique_ptr<BaseAST>> &func_defs, F &&f) {
+        for (auto &func : library_functions) {
+            bool defined = false;
+            for (auto &def : func_defs) {
+                defined |= static_cast<const FuncDefAST*>(def.get())->identifier == func.name;
+            }
+            if (!defined) {
+                f(func);
+            }
+        }
+    }
+}
+
+void CompUnitAST::lower(KoopaBuilder &b) const {
+    for_each_library_function(func_defs, [&](const FuncSignature &func) {
+        std::vector<koopa_raw_type_t> params;
+        for (auto &dims : func.params) {
+            params.push_back(raw_type(b, dims));
         }
-    } else {
-        return it->second;
+        b.declare(func.name, params, func.has_return);
+    });
+    for (auto &def : func_defs) {
+        def->lower(b);
+    }
+}
+
+void FuncDefAST::set_params(BaseAST *params) {
+    this->params.reset(params);
+    param_count = 0;
+    param_dims.clear();
+    for (auto param = static_cast<StmtAST*>(params); param; param = param->next.get()) {
+        auto fparam = static_cast<FuncFParamAST*>(param);
+        fparam->index = param_count++;
+        param_dims.push_back(fparam->dims);
+    }
+}
+
+void FuncDefAST::declare() const {
+    if (context->functions.count(symbol)) {
+        semantic_error("redefinition of function " + identifier);
+        return;
+    }
+    auto type = static_cast<const FuncTypeAST*>(func_type.get());
+    context->functions[symbol] = {identifier, param_dims, !type->identifier.empty()};
+    context->returns_value = !type->identifier.empty();
+}
+
+void FuncDefAST::lower(KoopaBuilder &b) const {
+    auto type = static_cast<const FuncTypeAST*>(func_type.get());
+    std::vector<koopa_raw_type_t> types;
+    for (auto &dims : param_dims) {
+        types.push_back(raw_type(b, dims));
+    }
+    b.begin_function(identifier, types, !type->identifier.empty());
+    b.enter(b.block("%entry"));
+    if (params) {
+        params->lower(b);
     }
+    block->lower(b);
+    // 基本块必须有结尾指令, 自动添加不可触及的 ret 指令
+    b.ret();
+    b.end_function();
 }
@@ -2,31 +2,38 @@
 #define __SYSY_AST_H__
 
 // 不写IDE报错很多，太难看了，还是写上吧
-#include <iostream>
 #include <unordered_map>
 #include <memory>
 #include <cassert>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "arena.h"
+#include "emitter.h"
+#include "koopa_builder.h"
+#include "symbol.h"
 
 #define record_frame(T) 
 
-#define prepare_expr(expr) \
+// 表达式不是单值时先构建其指令, 之后才能取得结果
+#define prepare_lower(expr) \
     do { \
         if (!(expr)->is_value()) { \
-            o << *(expr); \
+            (expr)->lower(b); \
         } \
     } while (0)
 
-// 方法设置表达式的值, 并同步共享指针表
+// 方法设置表达式的值, 表达式节点由节点池管理, 只记录其编号
 // final 的表达式不再具有父表达式, 解析到此结束, 会被设置为临时值并立刻计算
 #define set_method(expr, method_name, final, type) \
-    /* 用于设置表达式的值, 并同步共享指针表 */ \
+    /* 用于设置表达式的值 */ \
     void method_name(type* expr, bool _final = final) { \
         if (_final) expr->set_value_as_temp(); \
-        this->expr = share_table->get_or_create<type>(expr); \
+        this->expr = NodeRef<type>(expr); \
     }
 
 #define define_with_set_method(expr, method_name, final, type) \
-    ptr<type> expr; \
+    NodeRef<type> expr; \
     set_method(expr, method_name, final, type)
 
 #define define_expr_with_set_method(expr, method_name, final) \
@@ -38,120 +45,178 @@ class BaseAST;
 class ExpAST;
 class ValueAST;
 
-class SharedTable;
-class SymbolTable;
-class DomainGuard;
-namespace {
-    template <typename T>
-    using ptr = std::shared_ptr<T>;
-    using Table = std::unordered_map<std::string, ValueAST*>;
-};
-
-// 标签和基本块计数, 用于防止重复标签和基本块名
-inline int label_count = 0;
-// 函数作用域中的变量数量, 拆分只是证明正确性, 实际上不需要
-inline int var_count = 0;
-// 临时变量数量, 用于生成临时变量名
-inline int tmp_count = 0;
-// 最近循环记录, 用于break和continue生成标签名, 负数是非法标签名
-inline int nearest_loop = -1;
-// 共享指针表
-inline std::unique_ptr<SharedTable> share_table = std::make_unique<SharedTable>();
-// 符号表用于解析时记录符号, 帮助建立 AST 的连接, 编译时不使用
-// 不记录全局变量时, 可将符号表设置为空以验证正确性
-inline std::unique_ptr<SymbolTable> symbol_table = std::make_unique<SymbolTable>();
+// 变量的类型, 以各维长度表示: 空为 i32, 否则为数组
+// 数组形参省略的第一维记为 0, 实际类型是指向其余各维组成的数组的指针
+using VarDims = std::vector<int>;
+
+class NodePool;
 
 // 管理类型的类
-// 表达式共享指针表，用于将 AST 中的指针替换为共享指针
-class SharedTable {
+// 表达式节点池, 节点分配在 arena 中并以 32 位编号引用, 编号 0 表示空
+// 表达式节点可能被多个父节点共享, 统一由节点池在析构时销毁, 不使用引用计数
+class NodePool {
 private:
-    std::unordered_map<ExpAST*, ptr<ExpAST>> _table;
+    Arena _arena;
+    std::vector<ExpAST*> _nodes;
+    // 整数常量不可修改, 相同的值共享同一个节点
+    std::unordered_map<int, ValueAST*> _constants;
 public:
-    // 获取当前共享指针或创建
-    ptr<ExpAST> get_or_create(ExpAST* key);
-    // 获取当前共享指针或创建, 为什么不能在 cpp 定义呢?
-    template <typename T>
-    ptr<T> get_or_create(ExpAST* key)  {
-        auto result = get_or_create(key);
-        return std::reinterpret_pointer_cast<T>(result);
-    }
+    NodePool() : _nodes(1, nullptr) {}
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+    ~NodePool();
+    // 为节点分配内存, 由 ExpAST::operator new 调用
+    void* allocate(size_t size) { return _arena.allocate(size); }
+    // 登记节点并返回编号, 由 ExpAST 的构造函数调用
+    uint32_t add(ExpAST* node) {
+        _nodes.push_back(node);
+        return static_cast<uint32_t>(_nodes.size() - 1);
+    }
+    ExpAST* at(uint32_t index) const { return _nodes[index]; }
+    // 已登记的节点数量
+    size_t size() const { return _nodes.size() - 1; }
+    // 获取整数常量节点
+    ValueAST* constant(int number);
+};
+
+// 函数签名, 用于检查调用的实参个数并确定调用是否有结果
+struct FuncSignature {
+    std::string name;
+    // 各形参的类型
+    std::vector<VarDims> params;
+    bool has_return;
+};
+
+// 类型对应的 raw 类型, 如 i32, [[i32, 3], 2] 和 *[i32, 3], 从第 from 维开始
+koopa_raw_type_t raw_type(KoopaBuilder &b, const VarDims &dims, size_t from = 0);
+
+// SysY 运行时库中的函数, 无需定义即可调用
+extern const std::vector<FuncSignature> library_functions;
+
+// 单次编译的全部状态
+// 不同的编译各自使用独立的上下文, 因此可以在多个线程中同时进行
+struct CompilerContext {
+    // 标签和基本块计数, 用于防止重复标签和基本块名
+    int label_count = 0;
+    // 函数作用域中的变量数量, 拆分只是证明正确性, 实际上不需要
+    int var_count = 0;
+    // 临时变量数量, 用于生成临时变量名
+    int tmp_count = 0;
+    // 最近循环记录, 用于break和continue生成标签名, 负数是非法标签名
+    int nearest_loop = -1;
+    // 语法分析时所在循环的层数, 用于检查 break 和 continue
+    int loop_depth = 0;
+    // 语法分析中的函数是否有返回值, 用于检查 return 语句
+    bool returns_value = false;
+    // 表达式节点池, AST 存在期间必须保持有效
+    NodePool node_pool;
+    // 标识符驻留表, 词法分析时将标识符转换为符号编号
+    StringInterner interner;
+    // 符号表用于解析时记录符号, 帮助建立 AST 的连接, 编译时不使用
+    // 不记录全局变量时, 可将符号表设置为空以验证正确性
+    std::unique_ptr<SymbolTable> symbol_table = std::make_unique<SymbolTable>();
+    // 已定义的函数, 以函数名的符号编号索引, 与符号表一样只在解析时使用
+    std::unordered_map<uint32_t, FuncSignature> functions;
+    // 第一个语义错误, 如使用未定义的变量, 非空时中止解析, 本次编译失败
+    std::string error;
 };
 
-// 符号表，用于记录变量的类型并保存上级符号表入口
-class SymbolTable {
+// 当前线程正在进行的编译, AST 的构建和编译都通过它访问编译状态
+inline thread_local CompilerContext *context = nullptr;
+
+// 记录语义错误, 只保留第一个, 由语法分析的动作检查后中止解析
+inline void semantic_error(const std::string &message) {
+    if (context->error.empty()) {
+        context->error = message;
+    }
+}
+
+// 查找函数签名, 先查找已定义的函数, 再查找运行时库, 不存在则返回空指针
+const FuncSignature* find_function(uint32_t symbol);
+
+// 在作用域内切换当前线程的编译上下文
+class ContextGuard {
 private:
-    Table _table;
-    std::unique_ptr<SymbolTable> _parent;
-public:
-    // 创建新的符号表
-    SymbolTable() = default;
-    // 根据上级符号表的唯一指针创建新的符号表
-    SymbolTable(std::unique_ptr<SymbolTable>&& parent): _parent(std::move(parent)) {}
-    // 获取上级符号表的唯一指针右值引用, 用于恢复原来的符号表
-    std::unique_ptr<SymbolTable>&& get_parent() { return std::move(_parent); }
-    // 获取符号表中的变量, 若不存在则返回空指针, 默认递归查询上级符号表
-    ValueAST* get_var(const std::string& name, bool recursive = true);
-    // 设置符号表中的变量
-    void set_var(const std::string& name, ValueAST* value) { _table[name] = value; }
-};
-
-// 作用域管理器
-// 用于记录作用域，构造时创建新的符号表，析构时恢复原来的符号表
-class DomainGuard {
+    CompilerContext *_last;
 public:
-    DomainGuard() {
-        symbol_table = std::make_unique<SymbolTable>(std::move(symbol_table));
-    }
-    ~DomainGuard() {
-        symbol_table = symbol_table->get_parent();
-    }
+    ContextGuard(CompilerContext &ctx) : _last(context) { context = &ctx; }
+    ~ContextGuard() { context = _last; }
+    ContextGuard(const ContextGuard&) = delete;
+    ContextGuard& operator=(const ContextGuard&) = delete;
 };
 
+// 表达式节点的引用, 只保存节点编号
+template <typename T>
+class NodeRef {
+private:
+    uint32_t _index = 0;
+public:
+    NodeRef() = default;
+    NodeRef(T* node) : _index(node ? node->node_id : 0) {}
+    T* get() const { return _index ? static_cast<T*>(context->node_pool.at(_index)) : nullptr; }
+    T& operator*() const { return *get(); }
+    T* operator->() const { return get(); }
+    explicit operator bool() const { return _index != 0; }
+    bool operator==(std::nullptr_t) const { return _index == 0; }
+    bool operator!=(std::nullptr_t) const { return _index != 0; }
+};
 
 // 所有 AST 的基类
 class BaseAST {
 public:
     virtual ~BaseAST() = default;
     // 打印 AST 的结构
-    virtual std::ostream& dump(std::ostream& o = std::cout) const = 0;
-    // 编译 AST 并输出 Koopa IR
-    virtual std::ostream& compile(std::ostream& o = std::cout) const = 0;
-    friend std::ostream& operator<<(std::ostream& o, const BaseAST& a) {
-        return a.compile(o);
+    virtual Emitter& dump(Emitter& o) const = 0;
+    // 编译 AST 并构建 Koopa raw program, -koopa 的文本也由构建结果输出
+    virtual void lower(KoopaBuilder &b) const = 0;
+    friend Emitter& operator<<(Emitter& o, const BaseAST& a) {
+        return a.dump(o);
     }
 };
 
 class CompUnitAST : public BaseAST {
 public:
-    std::unique_ptr<BaseAST> func_def;
+    std::vector<std::unique_ptr<BaseAST>> func_defs;
     record_frame(CompUnitAST)
 
-    std::ostream& dump(std::ostream& o = std::cout) const override {
-        return o << "CU {" << *func_def << "}";
-    }
-    std::ostream& compile(std::ostream& o = std::cout) const override {
-        return o << *func_def;
+    Emitter& dump(Emitter& o) const override {
+        o << "CU {";
+        for (size_t i = 0; i < func_defs.size(); i++) {
+            o << (i ? ", " : "") << *func_defs[i];
+        }
+        return o << "}";
     }
+    // 运行时库的声明放在所有函数之前, 需要读取函数名, 定义在 cpp 中
+    void lower(KoopaBuilder &b) const override;
 };
 
 class FuncDefAST : public BaseAST {
 public:
     std::unique_ptr<BaseAST> func_type;
     std::string identifier;
+    uint32_t symbol = 0;
+    // 形参声明组成的语句链表, 在入口基本块中复制到局部变量
+    std::unique_ptr<BaseAST> params;
+    int param_count = 0;
+    // 各形参的类型
+    std::vector<VarDims> param_dims;
     std::unique_ptr<BaseAST> block;
 
     record_frame(FuncDefAST)
 
-    std::ostream& dump(std::ostream& o = std::cout) const override {
-        return o << "FD {" << *func_type << ", " << identifier << ", " << *block
-                 << "}";
-    }
-    std::ostream& compile(std::ostream& o = std::cout) const override {
-        o << "fun @" << identifier << *func_type << " {" << std::endl;
-        o << "%entry:" << std::endl;
-        // 基本块必须有结尾指令, 自动添加不可触及的 ret 指令
-        return o << *block << "ret" << std::endl << "}" << std::endl;
-    }
+    Emitter& dump(Emitter& o) const override {
+        o << "FD {" << *func_type << ", " << identifier << ", ";
+        if (params) {
+            o << *params << ", ";
+        }
+        return o << *block << "}";
+    }
+    // 需要用到函数类型, 定义在 cpp 中
+    void lower(KoopaBuilder &b) const override;
+    // 设置形参并为其编号, 记录其类型, 形参声明定义在后面, 以下均定义在 cpp 中
+    void set_params(BaseAST *params);
+    // 将函数签名加入函数表, 在解析函数体之前调用, 使函数体可以递归调用自身
+    void declare() const;
 };
 
 class FuncTypeAST : public BaseAST {
@@ -160,15 +225,11 @@ public:
 
     record_frame(FuncTypeAST)
 
-    std::ostream& dump(std::ostream& o = std::cout) const override {
+    Emitter& dump(Emitter& o) const override {
         return o << "FT {" << identifier << "}";
     }
-    std::ostream& compile(std::ostream& o = std::cout) const override {
-        o << "()";
-        if (!identifier.empty())
-            o << ": i32";
-        return o;
-    }
+    // 函数类型由 FuncDefAST 读取, 不产生指令
+    void lower(KoopaBuilder &b) const override {}
 };
 
 class BlockAST : public BaseAST {
@@ -177,22 +238,28 @@ public:
 
     record_frame(BlockAST)
 
-    std::ostream& dump(std::ostream& o = std::cout) const override {
+    Emitter& dump(Emitter& o) const override {
         if (statement)
             return o << "B {" << *statement << "}";
         else
             return o << "B {}";
     }
-    std::ostream& compile(std::ostream& o = std::cout) const override {
-        if (!statement)
-            return o;
-        return o << *statement;
+    void lower(KoopaBuilder &b) const override {
+        if (statement)
+            statement->lower(b);
     }
 };
 
 // 表达式的基类
+// 表达式节点分配在节点池中, 不能单独释放
 class ExpAST: public BaseAST {
 public:
+    // 节点在节点池中的编号
+    const uint32_t node_id;
+
+    ExpAST() : node_id(context->node_pool.add(this)) {}
+    static void* operator new(size_t size) { return context->node_pool.allocate(size); }
+    static void operator delete(void*) {}
     record_frame(ExpAST)
     // 该类为单个值还是表达式
     virtual bool is_value() const {return false;}
@@ -200,6 +267,13 @@ public:
     virtual void set_value_as_temp() = 0;
     // 获取表达式结果值
     virtual const ValueAST* value_ptr() const = 0;
+    // 在条件上下文中生成表达式, 结果非零时跳转到 t, 否则跳转到 f
+    // 默认先计算结果再分支, 短路运算符直接生成跳转而不计算结果
+    virtual void lower_cond(KoopaBuilder &b, koopa_raw_basic_block_t t, koopa_raw_basic_block_t f) const;
+    // 求值没有副作用, 且不超过 depth 层运算, 可以不经分支直接计算
+    virtual bool is_cheap(int depth) const { return false; }
+    // 子表达式中含有调用, 结果已知时也不能省略求值
+    virtual bool has_call() const { return false; }
 };
 
 // 单值或符号
@@ -211,6 +285,8 @@ public:
         Num,
         Temp,
         Var,
+        // 数组变量, 对象为 ArrayVarAST
+        Array,
     } type;
     int number;
     // 变量名, 没有使用意义
@@ -222,13 +298,13 @@ public:
     ValueAST(int number) : type(Type::Num), number(number) {}
 #if USE_VAR_NAME
     ValueAST(const std::string& identifier) :
-        type(Type::Var), number(var_count++), identifier(identifier) {}
+        type(Type::Var), number(context->var_count++), identifier(identifier) {}
 #else
-    ValueAST(const std::string& identifier) : type(Type::Var), number(var_count++) {}
+    ValueAST(const std::string& identifier) : type(Type::Var), number(context->var_count++) {}
 #endif
     record_frame(ValueAST)
 
-    std::ostream& dump(std::ostream& o = std::cout) const override {
+    Emitter& dump(Emitter& o) const override {
         switch (type) {
             case Type::Num:
                 return o << number;
@@ -240,36 +316,49 @@ public:
             #else
                 return o << "V {" << number << "}";
             #endif
-            default:
-                assert(false);
-        }
-    }
-    std::ostream& compile(std::ostream& o = std::cout) const override {
-        switch (type) {
-            case Type::Num:
-                return o << number;
-            case Type::Temp:
-                return o << "%" << number;
-            case Type::Var:
+            case Type::Array:
             #if USE_VAR_NAME
-                // 添加后缀 _num 保证不重名
-                return o << "@" << identifier << "_" << number;
+                return o << "A {" << identifier << number << "}";
             #else
-                return o << "@v" << number;
+                return o << "A {" << number << "}";
             #endif
             default:
                 assert(false);
         }
     }
+    // 单值不产生指令
+    void lower(KoopaBuilder &b) const override {}
+
+    // 获取单值对应的 raw 值, 常量直接生成整数, 其余查找已绑定的值
+    koopa_raw_value_t raw(KoopaBuilder &b) const {
+        if (type == Type::Num) {
+            return b.integer(number);
+        }
+        return b.lookup(this);
+    }
+
+    // 变量在 Koopa IR 中的名称, 添加后缀 _num 保证不重名
+    std::string var_name() const {
+        assert(type == Type::Var || type == Type::Array);
+    #if USE_VAR_NAME
+        return "@" + identifier + "_" + std::to_string(number);
+    #else
+        return "@v" + std::to_string(number);
+    #endif
+    }
 
     bool is_value() const override {
         return true;
     }
 
+    bool is_cheap(int depth) const override {
+        return true;
+    }
+
     void set_value_as_temp() override {
         if (type == Type::Undef) {
             type = Type::Temp;
-            number = tmp_count++;
+            number = context->tmp_count++;
         }
     }
 
@@ -278,6 +367,25 @@ public:
     }
 };
 
+// 数组变量, 包括数组形参
+// 常量数组同时记录展开后的值, 下标都是常量的读取直接替换为值
+class ArrayVarAST : public ValueAST {
+public:
+    VarDims dims;
+    // 常量数组按行展开的值, 其他数组为空
+    std::vector<int> values;
+
+    ArrayVarAST(const std::string& identifier, VarDims dims) : ValueAST(identifier), dims(std::move(dims)) {
+        type = Type::Array;
+    }
+    record_frame(ArrayVarAST)
+
+    // 数组形参保存的是指针, 使用前需要先读取
+    bool is_param() const {
+        return dims[0] == 0;
+    }
+};
+
 // 读取具名变量值
 // 由于 Koopa IR 不允许多赋值, 实际上是一个表达式而不是单值
 class GetVarAST : public ExpAST {
@@ -290,12 +398,12 @@ public:
     }
     record_frame(GetVarAST)
 
-    std::ostream& dump(std::ostream& o = std::cout) const override {
+    Emitter& dump(Emitter& o) const override {
         return o << "V.GET {" << *var << "->" << *temp << "}";
     }
 
-    std::ostream& compile(std::ostream& o = std::cout) const override {
-        return o << *temp << " = load " << *var << std::endl;
+    void lower(KoopaBuilder &b) const override {
+        b.bind(temp.get(), b.load(var->raw(b)));
     }
 
     void set_value_as_temp() override {
@@ -306,6 +414,140 @@ public:
     const ValueAST* value_ptr() const override {
         return temp.get();
     }
+
+    bool is_cheap(int depth) const override {
+        return true;
+    }
+};
+
+inline void ExpAST::lower_cond(KoopaBuilder &b, koopa_raw_basic_block_t t, koopa_raw_basic_block_t f) const {
+    prepare_lower(this);
+    b.branch(value_ptr()->raw(b), t, f);
+}
+
+// 数组元素
+// 下标个数与维数相同时读取元素, 否则结果为子数组首元素的地址, 用于向函数传递数组
+// 数组形参先读取指针, 第一个下标使用 getptr, 其余下标使用 getelemptr
+class ArrayElemAST : public ExpAST {
+public:
+    define_with_set_method(var, set_var, 0, ArrayVarAST)
+    std::vector<NodeRef<ExpAST>> indices;
+    define_with_set_method(result, set_result, 1, ValueAST)
+    // 作为实参传递, 此时下标可以少于维数, 结果是子数组首元素的地址
+    bool as_argument = false;
+
+    ArrayElemAST(ArrayVarAST* var) {
+        set_var(var);
+    }
+    record_frame(ArrayElemAST)
+
+    // 下标是完整的表达式, 加入时即生成临时符号, 常量下标必须在该维的范围内
+    void add_index(ExpAST* index) {
+        if (indices.size() >= var->dims.size()) {
+            semantic_error("too many subscripts");
+            return;
+        }
+        index->set_value_as_temp();
+        auto value = index->value_ptr();
+        int length = var->dims[indices.size()];
+        if (value->type == ValueAST::Type::Num && !index->has_call() &&
+            (value->number < 0 || (length > 0 && value->number >= length))) {
+            semantic_error("array index out of range");
+        }
+        indices.emplace_back(index);
+    }
+
+    bool is_element() const {
+        return indices.size() == var->dims.size();
+    }
+
+    // 不是元素时剩余各维的长度, 与形参的类型比较
+    VarDims remaining_dims() const {
+        return VarDims(var->dims.begin() + indices.size(), var->dims.end());
+    }
+
+    bool has_call() const override {
+        for (auto &index : indices) {
+            if (index->has_call()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Emitter& dump(Emitter& o) const override {
+        o << "A.GET {" << *var;
+        for (auto &index : indices) {
+            o << ", " << *index;
+        }
+        return o << "}";
+    }
+
+    // 计算地址, 至少有一个下标
+    koopa_raw_value_t lower_address(KoopaBuilder &b) const {
+        assert(!indices.empty());
+        for (auto &index : indices) {
+            prepare_lower(index);
+        }
+        auto ptr = var->raw(b);
+        size_t i = 0;
+        if (var->is_param()) {
+            ptr = b.get_ptr(b.load(ptr), indices[0]->value_ptr()->raw(b));
+            i = 1;
+        }
+        for (; i < indices.size(); i++) {
+            ptr = b.get_elem_ptr(ptr, indices[i]->value_ptr()->raw(b));
+        }
+        return ptr;
+    }
+
+    void lower(KoopaBuilder &b) const override {
+        if (result->type == ValueAST::Type::Num) {
+            return;
+        }
+        // 数组形参本身就是指针
+        if (indices.empty() && var->is_param()) {
+            b.bind(result.get(), b.load(var->raw(b)));
+            return;
+        }
+        auto ptr = indices.empty() ? var->raw(b) : lower_address(b);
+        if (is_element()) {
+            b.bind(result.get(), b.load(ptr));
+        } else {
+            b.bind(result.get(), b.get_elem_ptr(ptr, b.integer(0)));
+        }
+    }
+
+    // 常量数组的下标都是常量时直接得到值
+    // 数组只能作为实参传递, 其余情况下必须取到元素
+    void set_value_as_temp() override {
+        assert(!result);
+        if (!is_element() && !as_argument) {
+            semantic_error("array used as a value");
+        }
+        if (is_element() && !var->values.empty()) {
+            size_t offset = 0;
+            bool constant = true;
+            for (size_t i = 0; i < indices.size() && constant; i++) {
+                auto index = indices[i]->value_ptr();
+                constant = index->type == ValueAST::Type::Num && !indices[i]->has_call();
+                offset = offset * var->dims[i] + (constant ? index->number : 0);
+            }
+            if (constant) {
+                if (offset >= var->values.size()) {
+                    semantic_error("array index out of range");
+                    offset = 0;
+                }
+                set_result(context->node_pool.constant(var->values[offset]));
+                return;
+            }
+        }
+        set_result(new ValueAST());
+    }
+
+    const ValueAST* value_ptr() const override {
+        return result.get();
+    }
 };
 
 // 二元运算
@@ -334,12 +576,14 @@ public:
         Gte,
     } type;
     const static std::string type_str[];
-    const static std::string inst_str[];
     const static std::string op_str[];
+    const static koopa_raw_binary_op_t raw_op[];
 
     define_expr_with_set_method(l_val, set_left, 0)
     define_expr_with_set_method(r_val, set_right, 0)
     define_with_set_method(result, set_result, 1, ValueAST)
+    // 操作数不参与计算结果 (值已知或被短路), 但求值时含有调用, 仍然按求值顺序生成
+    bool keep_left = false, keep_right = false;
 
     // 在编译前, 由语义分析器设置包含结果在内的所有信息
     BinaryAST() : type(Type::Undef) {}
@@ -349,11 +593,7 @@ public:
         return type_str[(int)type];
     }
 
-    const std::string& get_inst_str() const {
-        return inst_str[(int)type];
-    }
-
-    std::ostream& dump(std::ostream& o = std::cout) const override {
+    Emitter& dump(Emitter& o) const override {
         assert(type != Type::Undef);
         assert(result);
         if (result->type == ValueAST::Type::Num) {
@@ -362,34 +602,95 @@ public:
         return o << get_type_str() << " {" << *l_val << ", " << *r_val << "}";
     }
 
-    std::ostream& compile(std::ostream& o = std::cout) const override {
+    void lower(KoopaBuilder &b) const override {
         assert(type != Type::Undef);
         assert(result);
+        // 先计算结果已知但含有调用的操作数
+        if (keep_left) {
+            prepare_lower(l_val);
+        }
         // 如果已经是常量, 则不需要生成指令
         if (result->type == ValueAST::Type::Num) {
-            return o;
+            if (keep_right) {
+                prepare_lower(r_val);
+            }
+            return;
         }
         // 如果可预处理, 则只生成部分子表达式
         auto pre_type = preprocess_type();
         if (pre_type == "left") {
-            prepare_expr(l_val);
-            return o;
+            prepare_lower(l_val);
+            return;
         }
         if (pre_type == "right") {
-            prepare_expr(r_val);
-            return o;
+            prepare_lower(r_val);
+            return;
         }
         // 短路运算符生成短路代码
         if (is_short_circuit()) {
-            return compile_short_circuit(o);
-        }
-        // 先生成子表达式
-        prepare_expr(l_val);
-        prepare_expr(r_val);
-        // 生成运算指令
-        o << *result << " = " << get_inst_str() << " " << *l_val->value_ptr()
-          << ", " << *r_val->value_ptr() << std::endl;
-        return o;
+            lower_short_circuit(b);
+            return;
+        }
+        // 先生成子表达式, 再生成运算指令
+        prepare_lower(l_val);
+        prepare_lower(r_val);
+        auto value = b.binary(raw_op[(int)type], l_val->value_ptr()->raw(b),
+                              r_val->value_ptr()->raw(b));
+        b.bind(result.get(), value);
+    }
+
+    // 短路运算符在条件上下文中只生成跳转: 左侧决定结果时直接跳转到目标, 否则继续判断右侧
+    // 与零比较时直接判断另一个操作数, eq 交换两个目标
+    void lower_cond(KoopaBuilder &b, koopa_raw_basic_block_t t, koopa_raw_basic_block_t f) const override {
+        if (result->type == ValueAST::Type::Num) {
+            ExpAST::lower_cond(b, t, f);
+            return;
+        }
+        if (auto operand = compared_with_zero()) {
+            if (type == Type::Ne) {
+                operand->lower_cond(b, t, f);
+            } else {
+                operand->lower_cond(b, f, t);
+            }
+            return;
+        }
+        if (!is_short_circuit()) {
+            ExpAST::lower_cond(b, t, f);
+            return;
+        }
+        auto pre_type = preprocess_type();
+        if (pre_type == "left") {
+            l_val->lower_cond(b, t, f);
+            return;
+        }
+        if (pre_type == "right") {
+            if (keep_left) {
+                prepare_lower(l_val);
+            }
+            r_val->lower_cond(b, t, f);
+            return;
+        }
+        auto suffix = std::to_string(context->label_count++);
+        koopa_raw_basic_block_t next;
+        if (type == Type::And) {
+            next = b.block("%and_" + suffix);
+            l_val->lower_cond(b, next, f);
+        } else {
+            next = b.block("%or_" + suffix);
+            l_val->lower_cond(b, t, next);
+        }
+        b.enter(next);
+        r_val->lower_cond(b, t, f);
+    }
+
+    // 除法可能除以零, 不作为无副作用的运算
+    bool is_cheap(int depth) const override {
+        return depth > 0 && !is_short_circuit() && type != Type::Div && type != Type::Mod &&
+               l_val->is_cheap(depth - 1) && r_val->is_cheap(depth - 1);
+    }
+
+    bool has_call() const override {
+        return l_val->has_call() || r_val->has_call();
     }
 
     void set_value_as_temp() override {
@@ -402,24 +703,54 @@ public:
         l_val->set_value_as_temp();
         auto pre_type = preprocess_type(1);
         if (pre_type == "left") {
+            // 右侧被短路, 左侧的调用仍然需要执行
             preprocess(pre_type);
+            keep_left = l_val->has_call();
             return;
         }
         // 等待子节点计算常量
         r_val->set_value_as_temp();
-        if (preprocess(preprocess_type())) {
+        pre_type = preprocess_type();
+        if (preprocess(pre_type)) {
+            // 结果取自一侧, 另一侧或者结果本身是常量时, 其中的调用不能丢弃
+            bool constant = result->type == ValueAST::Type::Num;
+            keep_left = (constant || pre_type != "left") && l_val->has_call();
+            keep_right = (constant || pre_type != "right") && r_val->has_call();
             return;
         }
         normal_get_result();
+        if (result->type == ValueAST::Type::Num) {
+            keep_left = l_val->has_call();
+            keep_right = r_val->has_call();
+        }
     }
 
 private:
+    // ne 和 eq 中与常量 0 比较的另一个操作数, 不是这种形式时返回空
+    const ExpAST* compared_with_zero() const {
+        if (type != Type::Ne && type != Type::Eq) {
+            return nullptr;
+        }
+        auto is_zero = [](const ExpAST *expr) {
+            return expr->value_ptr()->type == ValueAST::Type::Num && expr->value_ptr()->number == 0 &&
+                   !expr->has_call();
+        };
+        if (is_zero(l_val.get())) {
+            return r_val.get();
+        }
+        if (is_zero(r_val.get())) {
+            return l_val.get();
+        }
+        return nullptr;
+    }
+
     // 是否是短路运算符
     bool is_short_circuit() const {
         return type == Type::And || type == Type::Or;
     }
 
     // 如果是短路运算符, 是否可以直接短路（左子节点已经计算出常量）
+    // 左侧总是先求值, 其中的调用由 keep_left 保留; 右侧含有调用时不作为常量
     std::string preprocess_type(bool left_only = false) const {
         if (!is_short_circuit()) {
             return "";
@@ -435,7 +766,7 @@ private:
         if (left_only) {
             return "";
         }
-        if (r_val->value_ptr()->type == ValueAST::Type::Num) {
+        if (r_val->value_ptr()->type == ValueAST::Type::Num && !r_val->has_call()) {
             int r = r_val->value_ptr()->number;
             if ((type == Type::And && !r) || (type == Type::Or && r)) {
                 return "right";
@@ -469,11 +800,19 @@ private:
             r_val->value_ptr()->type == ValueAST::Type::Num) {
             int l = l_val->value_ptr()->number;
             int r = r_val->value_ptr()->number;
+            // 除以零和 INT32_MIN / -1 在运行时出错, 作为语义错误报告
+            if ((type == Type::Div || type == Type::Mod) && (r == 0 || (l == INT32_MIN && r == -1))) {
+                semantic_error(r == 0 ? "division by zero" : "integer overflow in division");
+                set_result(context->node_pool.constant(0));
+                return;
+            }
+            // 加减乘按 32 位回绕, 与运行时一致
+            auto ul = static_cast<uint32_t>(l), ur = static_cast<uint32_t>(r);
             int res;
             switch (type) {
-                case Type::Add: res = l + r;        break;
-                case Type::Sub: res = l - r;        break;
-                case Type::Mul: res = l * r;        break;
+                case Type::Add: res = static_cast<int>(ul + ur);    break;
+                case Type::Sub: res = static_cast<int>(ul - ur);    break;
+                case Type::Mul: res = static_cast<int>(ul * ur);    break;
                 case Type::Div: res = l / r;        break;
                 case Type::Mod: res = l % r;        break;
                 case Type::And: res = !!l && !!r;   break;
@@ -488,40 +827,39 @@ private:
                 default:
                     assert(false);
             }
-            set_result(new ValueAST(res));
+            set_result(context->node_pool.constant(res));
         } else {
             // 当前逻辑下分析器不再逐步生成临时变量, 不应提前确定结果
             set_result(new ValueAST());
         }
     }
 
-    std::ostream& compile_short_circuit(std::ostream& o) const {
+    // 值上下文中的短路运算符, 不使用内存中的临时变量
+    // 语法分析时两侧已经转换为 ne 0, x, 只有 0 和 1 两种值
+    // 右侧开销很小且没有副作用时直接计算两侧再按位合并, 否则按条件跳转, 结果作为 %end_N 的参数传入
+    void lower_short_circuit(KoopaBuilder &b) const {
         assert(is_short_circuit());
-        int label = label_count++;
-        // 使用@_t(x)和%_t(x)作为临时变量, 以避免与用户变量冲突
-        // 常规全局变量名为@..._(x), 临时变量名为%(x)
-        o << "@_t" << label << " = alloc i32" << std::endl;
-        prepare_expr(l_val);
-        o << "br " << *l_val->value_ptr();
-        if (type == Type::And) {
-            o << ", %normal_" << label << ", %short_" << label << std::endl;
-        } else {
-            o << ", %short_" << label << ", %normal_" << label << std::endl;
+        int label = context->label_count++;
+        if (r_val->is_cheap(2)) {
+            prepare_lower(l_val);
+            prepare_lower(r_val);
+            auto value = b.binary(raw_op[(int)type], l_val->value_ptr()->raw(b),
+                                  r_val->value_ptr()->raw(b));
+            b.bind(result.get(), value);
+            return;
         }
-        o << "%short_" << label << ":" << std::endl;
-        if (type == Type::And) {
-            o << "store 0, @_t" << label << std::endl;
-        } else {
-            o << "store 1, @_t" << label << std::endl;
-        }
-        o << "jump %end_" << label << std::endl;
-        o << "%normal_" << label << ":" << std::endl;
-        prepare_expr(r_val);
-        o << "store " << *r_val->value_ptr() << ", @_t" << label << std::endl;
-        o << "jump %end_" << label << std::endl;
-        o << "%end_" << label << ":" << std::endl;
-        o << *result << " = load @_t" << label << std::endl;
-        return o;
+        auto suffix = std::to_string(label);
+        auto true_bb = b.block("%true_" + suffix);
+        auto false_bb = b.block("%false_" + suffix);
+        auto end_bb = b.block("%end_" + suffix);
+        auto value = b.param(end_bb);
+        lower_cond(b, true_bb, false_bb);
+        b.enter(true_bb);
+        b.jump(end_bb, {b.integer(1)});
+        b.enter(false_bb);
+        b.jump(end_bb, {b.integer(0)});
+        b.enter(end_bb);
+        b.bind(result.get(), value);
     }
 
 public:
@@ -530,6 +868,96 @@ public:
     }
 };
 
+// 函数调用
+// 实参按从左到右的顺序求值, 没有返回值的调用不产生结果
+class CallAST : public ExpAST {
+public:
+    std::string callee;
+    bool has_return = false;
+    // 作为表达式语句, 结果不被使用, 此时允许调用没有返回值的函数
+    bool discarded = false;
+    std::vector<NodeRef<ExpAST>> args;
+    define_with_set_method(result, set_result, 0, ValueAST)
+
+    CallAST() = default;
+    record_frame(CallAST)
+
+    // 设置被调用的函数, 函数必须已经定义或者属于运行时库, 且实参的个数和类型一致, 否则报告错误
+    // 数组实参与形参除第一维以外的各维长度相同
+    void set_callee(uint32_t symbol) {
+        auto func = find_function(symbol);
+        if (!func) {
+            semantic_error("undefined function " + context->interner.name(symbol));
+            return;
+        }
+        if (func->params.size() != args.size()) {
+            semantic_error("argument count mismatch in call to " + func->name);
+            return;
+        }
+        for (size_t i = 0; i < args.size(); i++) {
+            auto elem = dynamic_cast<const ArrayElemAST*>(args[i].get());
+            auto dims = elem && !elem->is_element() ? elem->remaining_dims() : VarDims();
+            auto &param = func->params[i];
+            bool match = dims.size() == param.size();
+            for (size_t k = 1; match && k < dims.size(); k++) {
+                match = dims[k] == param[k];
+            }
+            if (!match) {
+                semantic_error("argument " + std::to_string(i + 1) + " of " + func->name + " has wrong type");
+                return;
+            }
+        }
+        callee = func->name;
+        has_return = func->has_return;
+    }
+
+    // 实参是完整的表达式, 加入时即生成临时符号
+    void add_arg(ExpAST* arg) {
+        if (auto elem = dynamic_cast<ArrayElemAST*>(arg)) {
+            elem->as_argument = true;
+        }
+        arg->set_value_as_temp();
+        args.emplace_back(arg);
+    }
+
+    Emitter& dump(Emitter& o) const override {
+        o << "CALL {" << callee;
+        for (auto &arg : args) {
+            o << ", " << *arg;
+        }
+        return o << "}";
+    }
+
+    void lower(KoopaBuilder &b) const override {
+        std::vector<koopa_raw_value_t> values;
+        for (auto &arg : args) {
+            prepare_lower(arg);
+            values.push_back(arg->value_ptr()->raw(b));
+        }
+        auto value = b.call(b.function(callee), values);
+        if (has_return) {
+            b.bind(result.get(), value);
+        }
+    }
+
+    bool has_call() const override {
+        return true;
+    }
+
+    // 没有返回值的调用不分配临时符号, 其结果不能被使用
+    void set_value_as_temp() override {
+        assert(!result);
+        if (!has_return && !discarded && !callee.empty()) {
+            semantic_error("void function " + callee + " used as a value");
+        }
+        set_result(new ValueAST(), has_return);
+    }
+
+    const ValueAST* value_ptr() const override {
+        return result.get();
+    }
+};
+
 // 语句的基类
 class StmtAST : public BaseAST {
 public:
@@ -547,22 +975,21 @@ public:
     }
 
     // 打印本语句的结构
-    virtual std::ostream& dump_this(std::ostream& o = std::cout) const = 0;
-    // 编译本语句并输出 Koopa IR
-    virtual std::ostream& compile_this(std::ostream& o = std::cout) const = 0;
-    std::ostream& dump(std::ostream& o = std::cout) const override final {
+    virtual Emitter& dump_this(Emitter& o) const = 0;
+    // 直接构建本语句的 raw 指令
+    virtual void lower_this(KoopaBuilder &b) const = 0;
+    Emitter& dump(Emitter& o) const override final {
         dump_this(o);
         if (next) {
             next->dump(o);
         }
         return o;
     }
-    std::ostream& compile(std::ostream& o = std::cout) const override final {
-        compile_this(o);
+    void lower(KoopaBuilder &b) const override final {
+        lower_this(b);
         if (next) {
-            next->compile(o);
+            next->lower(b);
         }
-        return o;
     }
 };
 
@@ -572,25 +999,22 @@ public:
     define_expr_with_set_method(expr, set_expr, 1)
     record_frame(ReturnAST)
 
-    std::ostream& dump_this(std::ostream& o = std::cout) const override {
-        if (expr) {
-            prepare_expr(expr);
-            o << "return " << *expr->value_ptr() << ";";
-        } else {
-            o << "return;";
+    Emitter& dump_this(Emitter& o) const override {
+        if (!expr) {
+            return o << "return;";
         }
         return o << "return " << *expr << ";";
     }
-    std::ostream& compile_this(std::ostream& o = std::cout) const override {
+    // 每个基本块必须恰有一个结束语句, 但是在语法分析阶段无法确定是否存在
+    // ret语句后的指令不应该被执行, 因此在编译阶段插入一个不可达的基本块
+    void lower_this(KoopaBuilder &b) const override {
         if (expr) {
-            prepare_expr(expr);
-            o << "ret " << *expr->value_ptr() << std::endl;
+            prepare_lower(expr);
+            b.ret(expr->value_ptr()->raw(b));
         } else {
-            o << "ret" << std::endl;
+            b.ret();
         }
-        // 每个基本块必须恰有一个结束语句, 但是在语法分析阶段无法确定是否存在
-        // ret语句后的指令不应该被执行, 因此在编译阶段插入一个不可达的基本块
-        return o << "%unreachable_" << label_count++ << ":" << std::endl;
+        b.enter(b.block("%unreachable_" + std::to_string(context->label_count++)));
     }
 };
 
@@ -600,18 +1024,16 @@ public:
     define_expr_with_set_method(expr, set_expr, 1)
     record_frame(ExpStmtAST)
 
-    std::ostream& dump_this(std::ostream& o = std::cout) const override {
+    Emitter& dump_this(Emitter& o) const override {
         if (!expr) {
             return o << ";";
         }
-        prepare_expr(expr);
-        return o << *expr->value_ptr() << ";";
+        return o << *expr << ";";
     }
-    std::ostream& compile_this(std::ostream& o = std::cout) const override {
+    void lower_this(KoopaBuilder &b) const override {
         if (expr) {
-            prepare_expr(expr);
+            prepare_lower(expr);
         }
-        return o;
     }
 };
 
@@ -621,11 +1043,11 @@ public:
     std::unique_ptr<BaseAST> block;
     BlockStmtAST(BaseAST* block) : block(block) {}
     record_frame(BlockStmtAST)
-    std::ostream& dump_this(std::ostream& o = std::cout) const override {
+    Emitter& dump_this(Emitter& o) const override {
         return o << *block;
     }
-    std::ostream& compile_this(std::ostream& o = std::cout) const override {
-        return o << *block;
+    void lower_this(KoopaBuilder &b) const override {
+        block->lower(b);
     }
 };
 
@@ -636,11 +1058,13 @@ public:
 
     record_frame(DeclAST)
 
-    // 设置属性值并同步到符号表和共享指针表, 符号表此前必须不存在该变量
-    void set_var_and_sync(const std::string& name, ValueAST* value) {
-        assert(!symbol_table->get_var(name, false));
+    // 设置属性值并同步到符号表, 当前作用域此前存在该变量时报告重复定义
+    void set_var_and_sync(uint32_t symbol, ValueAST* value) {
+        if (context->symbol_table->get_var(symbol, false)) {
+            semantic_error("redefinition of " + context->interner.name(symbol));
+        }
         set_var(value);
-        symbol_table->set_var(name, value);
+        context->symbol_table->set_var(symbol, value);
     }
 };
 
@@ -649,37 +1073,165 @@ class ConstDeclAST : public DeclAST {
 public:
     std::string name;
 
-    ConstDeclAST(const std::string& name, ValueAST* value) : name(name) {
+    ConstDeclAST(uint32_t symbol, ValueAST* value) : name(context->interner.name(symbol)) {
         assert(value->type == ValueAST::Type::Num);
 #if USE_VAR_NAME
         // 记录名称时, 生成新的 ValueAST, 并在其中记录名称
         value = new ValueAST(value->number);
         value->identifier = name;
 #endif
-        set_var_and_sync(name, value);
+        set_var_and_sync(symbol, value);
     }
     record_frame(ConstDeclAST)
-    std::ostream& dump_this(std::ostream& o = std::cout) const override {
+    Emitter& dump_this(Emitter& o) const override {
         return o << "const decl " << name << " = " << *var << ";";
     }
     // 常量被自动替换为值, 无需产生中间代码
-    std::ostream& compile_this(std::ostream& o = std::cout) const override {
-        return o;
-    }
+    void lower_this(KoopaBuilder &b) const override {}
 };
 
 // 变量声明语句
 class VarDeclAST : public DeclAST {
 public:
-    VarDeclAST(const std::string& name) {
-        set_var_and_sync(name, new ValueAST(name));
+    VarDeclAST(uint32_t symbol) {
+        set_var_and_sync(symbol, new ValueAST(context->interner.name(symbol)));
     }
     record_frame(VarDeclAST)
-    std::ostream& dump_this(std::ostream& o = std::cout) const override {
+    Emitter& dump_this(Emitter& o) const override {
         return o << "decl " << *var << ";";
     }
-    std::ostream& compile_this(std::ostream& o = std::cout) const override {
-        return o << *var << " = alloc i32" << std::endl;
+    void lower_this(KoopaBuilder &b) const override {
+        b.bind(var.get(), b.alloc(var->var_name()));
+    }
+};
+
+// 初始化值, 单个表达式或者以大括号嵌套的初始化列表, 只在语法分析时使用
+struct InitValAST {
+    // 单个表达式, 为空时是初始化列表
+    ExpAST* expr = nullptr;
+    std::vector<std::unique_ptr<InitValAST>> items;
+};
+
+// 按数组的各维长度展开初始化列表, 没有给出的元素为空指针, 表示 0
+// 列表与数组的形状不符时报告语义错误
+std::vector<ExpAST*> flatten_init(const InitValAST* init, const VarDims &dims);
+
+// 数组声明语句
+// 有初始化时, 先将数组看作一维数组, 再逐个写入元素; 0 较多时先用循环清零, 只写入非零的元素
+class ArrayDeclAST : public DeclAST {
+public:
+    // 展开后的初始值, 没有初始化时为空
+    std::vector<NodeRef<ExpAST>> init;
+    // 超过这个数量的 0 用循环写入
+    static constexpr size_t zero_loop_threshold = 16;
+
+    // 常量数组的初始值必须都是常量, 同时记录在变量中
+    ArrayDeclAST(uint32_t symbol, const VarDims &dims, const InitValAST* init_val, bool is_const) {
+        auto array = new ArrayVarAST(context->interner.name(symbol), dims);
+        if (init_val) {
+            for (auto expr : flatten_init(init_val, dims)) {
+                if (expr) {
+                    expr->set_value_as_temp();
+                }
+                init.emplace_back(expr);
+                if (is_const) {
+                    if (expr && expr->value_ptr()->type != ValueAST::Type::Num) {
+                        semantic_error("non-constant initializer of " + context->interner.name(symbol));
+                        expr = nullptr;
+                    }
+                    array->values.push_back(expr ? expr->value_ptr()->number : 0);
+                }
+            }
+        }
+        set_var_and_sync(symbol, array);
+    }
+    record_frame(ArrayDeclAST)
+
+    const ArrayVarAST* array() const {
+        return static_cast<const ArrayVarAST*>(var.get());
+    }
+
+    Emitter& dump_this(Emitter& o) const override {
+        o << "decl " << *var;
+        for (auto n : array()->dims) {
+            o << "[" << n << "]";
+        }
+        return o << ";";
+    }
+    void lower_this(KoopaBuilder &b) const override {
+        b.bind(var.get(), b.alloc(var->var_name(), raw_type(b, array()->dims)));
+        if (init.empty()) {
+            return;
+        }
+        // 首元素的地址
+        auto base = var->raw(b);
+        for (size_t i = 0; i < array()->dims.size(); i++) {
+            base = b.get_elem_ptr(base, b.integer(0));
+        }
+        bool zero_loop = zero_count() > zero_loop_threshold;
+        if (zero_loop) {
+            auto suffix = std::to_string(context->label_count++);
+            auto cond_bb = b.block("%init_cond_" + suffix);
+            auto body_bb = b.block("%init_body_" + suffix);
+            auto end_bb = b.block("%init_end_" + suffix);
+            auto i = b.param(cond_bb);
+            b.jump(cond_bb, {b.integer(0)});
+            b.enter(cond_bb);
+            auto size = b.integer(static_cast<int32_t>(init.size()));
+            b.branch(b.binary(KOOPA_RBO_LT, i, size), body_bb, end_bb);
+            b.enter(body_bb);
+            b.store(b.integer(0), b.get_ptr(base, i));
+            b.jump(cond_bb, {b.binary(KOOPA_RBO_ADD, i, b.integer(1))});
+            b.enter(end_bb);
+        }
+        for (size_t i = 0; i < init.size(); i++) {
+            if (zero_loop && is_zero(i)) {
+                continue;
+            }
+            auto value = b.integer(0);
+            if (init[i]) {
+                prepare_lower(init[i]);
+                value = init[i]->value_ptr()->raw(b);
+            }
+            b.store(value, b.get_ptr(base, b.integer(static_cast<int32_t>(i))));
+        }
+    }
+
+private:
+    bool is_zero(size_t i) const {
+        return !init[i] || (init[i]->value_ptr()->type == ValueAST::Type::Num && init[i]->value_ptr()->number == 0 &&
+                            !init[i]->has_call());
+    }
+
+    size_t zero_count() const {
+        size_t count = 0;
+        for (size_t i = 0; i < init.size(); i++) {
+            count += is_zero(i);
+        }
+        return count;
+    }
+};
+
+// 函数形参
+// 形参复制到局部变量中, 函数体像其他局部变量一样读写, 优化时由 mem2reg 提升
+// 数组形参同样复制到指针类型的局部变量中
+class FuncFParamAST : public DeclAST {
+public:
+    // 在参数列表中的位置
+    int index = 0;
+    VarDims dims;
+
+    FuncFParamAST(uint32_t symbol, VarDims dims = {}) : dims(std::move(dims)) {
+        auto &name = context->interner.name(symbol);
+        set_var_and_sync(symbol, this->dims.empty() ? new ValueAST(name) : new ArrayVarAST(name, this->dims));
+    }
+    record_frame(FuncFParamAST)
+    Emitter& dump_this(Emitter& o) const override {
+        return o << "param " << *var << ";";
+    }
+    void lower_this(KoopaBuilder &b) const override {
+        b.bind(var.get(), b.alloc(var->var_name(), raw_type(b, dims)));
+        b.store(b.arg(index), var->raw(b));
     }
 };
 
@@ -691,23 +1243,46 @@ public:
     define_expr_with_set_method(expr, set_expr, 1)
 
     AssignAST() = default;
-    AssignAST(const std::string& name) {
+    AssignAST(uint32_t symbol) {
         // 从符号表中获取变量, 不存在则报错
-        auto assign_var = symbol_table->get_var(name);
+        auto assign_var = context->symbol_table->get_var(symbol);
         assert(assign_var);
         set_var(assign_var);
     }
     record_frame(AssignAST)
-    std::ostream& dump_this(std::ostream& o = std::cout) const override {
+    Emitter& dump_this(Emitter& o) const override {
         return o << *var << " = " << *expr << ";";
     }
-    std::ostream& compile_this(std::ostream& o = std::cout) const override {
+    void lower_this(KoopaBuilder &b) const override {
         assert(var->type == ValueAST::Type::Var);
         // 没有初始化值, 声明即结束, 不应有赋值语句
         assert(expr);
-        prepare_expr(expr);
-        o << "store " << *expr->value_ptr() << ", " << *var << std::endl;
-        return o;
+        prepare_lower(expr);
+        b.store(expr->value_ptr()->raw(b), var->raw(b));
+    }
+};
+
+// 数组元素的赋值语句, 先计算地址再计算右侧的值
+class ArrayAssignAST : public StmtAST {
+public:
+    define_with_set_method(target, set_target, 0, ArrayElemAST)
+    define_expr_with_set_method(expr, set_expr, 1)
+
+    ArrayAssignAST(ArrayElemAST* target, ExpAST* expr) {
+        if (!target->is_element()) {
+            semantic_error("cannot assign to array");
+        }
+        set_target(target);
+        set_expr(expr);
+    }
+    record_frame(ArrayAssignAST)
+    Emitter& dump_this(Emitter& o) const override {
+        return o << *target << " = " << *expr << ";";
+    }
+    void lower_this(KoopaBuilder &b) const override {
+        auto ptr = target->lower_address(b);
+        prepare_lower(expr);
+        b.store(expr->value_ptr()->raw(b), ptr);
     }
 };
 
@@ -724,36 +1299,29 @@ public:
     }
     record_frame(BranchAST)
 
-    std::ostream& dump_this(std::ostream& o = std::cout) const override {
-        o << "if (" << *cond << ") {" << std::endl;
-        o << "then " << *then_stmt << std::endl;
+    Emitter& dump_this(Emitter& o) const override {
+        o << "if (" << *cond << ") {" << '\n';
+        o << "then " << *then_stmt << '\n';
         if (else_stmt) {
-            o << "else " << *else_stmt << std::endl;
+            o << "else " << *else_stmt << '\n';
         }
         return o << "}";
     }
-    std::ostream& compile_this(std::ostream& o = std::cout) const override {
-        prepare_expr(cond);
-        int label = label_count++;
-        if (!else_stmt) {
-            o << "br " << *cond->value_ptr() << ", %then_" << label
-              << ", %end_" << label << std::endl;
-            o << "%then_" << label << ":" << std::endl;
-            o << *then_stmt;
-            o << "jump %end_" << label << std::endl;
-            o << "%end_" << label << ":" << std::endl;
-        } else {
-            o << "br " << *cond->value_ptr() << ", %then_" << label
-              << ", %else_" << label << std::endl;
-            o << "%then_" << label << ":" << std::endl;
-            o << *then_stmt;
-            o << "jump %end_" << label << std::endl;
-            o << "%else_" << label << ":" << std::endl;
-            o << *else_stmt;
-            o << "jump %end_" << label << std::endl;
-            o << "%end_" << label << ":" << std::endl;
+    void lower_this(KoopaBuilder &b) const override {
+        auto suffix = std::to_string(context->label_count++);
+        auto then_bb = b.block("%then_" + suffix);
+        auto else_bb = else_stmt ? b.block("%else_" + suffix) : nullptr;
+        auto end_bb = b.block("%end_" + suffix);
+        cond->lower_cond(b, then_bb, else_stmt ? else_bb : end_bb);
+        b.enter(then_bb);
+        then_stmt->lower(b);
+        b.jump(end_bb);
+        if (else_stmt) {
+            b.enter(else_bb);
+            else_stmt->lower(b);
+            b.jump(end_bb);
         }
-        return o;
+        b.enter(end_bb);
     }
 };
 
@@ -780,32 +1348,33 @@ public:
     }
     record_frame(LoopAST)
 
-    std::ostream& dump_this(std::ostream& o = std::cout) const override {
-        o << "while (" << *cond << ") {" << std::endl;
-        o  << *body << std::endl;
+    Emitter& dump_this(Emitter& o) const override {
+        o << "while (" << *cond << ") {" << '\n';
+        o  << *body << '\n';
         return o << "}";
     }
-    std::ostream& compile_this(std::ostream& o = std::cout) const override {
-        int label = label_count++;
+    void lower_this(KoopaBuilder &b) const override {
+        int label = context->label_count++;
+        auto suffix = std::to_string(label);
         if (init) {
-            o << *init;
-        }
-        int last_nearest = nearest_loop;
-        nearest_loop = label;
-        o << "jump %cond_" << label << std::endl;
-        o << "%cond_" << label << ":" << std::endl;
-        prepare_expr(cond);
-        o << "br " << *cond->value_ptr() << ", %body_" << label
-          << ", %end_" << label << std::endl;
-        o << "%body_" << label << ":" << std::endl;
-        o << *body;
+            init->lower(b);
+        }
+        int last_nearest = context->nearest_loop;
+        context->nearest_loop = label;
+        auto cond_bb = b.block("%cond_" + suffix);
+        auto body_bb = b.block("%body_" + suffix);
+        auto end_bb = b.block("%end_" + suffix);
+        b.jump(cond_bb);
+        b.enter(cond_bb);
+        cond->lower_cond(b, body_bb, end_bb);
+        b.enter(body_bb);
+        body->lower(b);
         if (step) {
-            o << *step;
+            step->lower(b);
         }
-        o << "jump %cond_" << label << std::endl;
-        o << "%end_" << label << ":" << std::endl;
-        nearest_loop = last_nearest;
-        return o;
+        b.jump(cond_bb);
+        b.enter(end_bb);
+        context->nearest_loop = last_nearest;
     }
 };
 
@@ -814,12 +1383,12 @@ class BreakAST : public StmtAST {
 public:
     BreakAST() = default;
     record_frame(BreakAST)
-    std::ostream& dump_this(std::ostream& o = std::cout) const override {
+    Emitter& dump_this(Emitter& o) const override {
         return o << "break;";
     }
-    std::ostream& compile_this(std::ostream& o = std::cout) const override {
-        o << "jump %end_" << nearest_loop << std::endl;
-        return o << "%unreachable_" << label_count++ << ":" << std::endl;
+    void lower_this(KoopaBuilder &b) const override {
+        b.jump(b.block("%end_" + std::to_string(context->nearest_loop)));
+        b.enter(b.block("%unreachable_" + std::to_string(context->label_count++)));
     }
 };
 
@@ -828,12 +1397,12 @@ class ContinueAST : public StmtAST {
 public:
     ContinueAST() = default;
     record_frame(ContinueAST)
-    std::ostream& dump_this(std::ostream& o = std::cout) const override {
+    Emitter& dump_this(Emitter& o) const override {
         return o << "continue;";
     }
-    std::ostream& compile_this(std::ostream& o = std::cout) const override {
-        o << "jump %cond_" << nearest_loop << std::endl;
-        return o << "%unreachable_" << label_count++ << ":" << std::endl;
+    void lower_this(KoopaBuilder &b) const override {
+        b.jump(b.block("%cond_" + std::to_string(context->nearest_loop)));
+        b.enter(b.block("%unreachable_" + std::to_string(context->label_count++)));
     }
 };
 #endif
@@ -6,6 +6,12 @@
 // YYSTYPE和yyparse等用到的必要头文件
 #include <string>
 #include "AST_SysY.h"
+
+// 可重入 lexer 的句柄, 与 flex 生成的定义一致
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void* yyscan_t;
+#endif
 }
 
 %{
@@ -23,45 +29,68 @@
         res = exp; \
     } while (0)
 
-// 声明 lexer 函数和错误处理函数
-int yylex();
-void yyerror(std::unique_ptr<BaseAST> &ast, const char *s);
+// 语义动作中出现语义错误时中止解析, 错误信息记录在编译上下文中
+#define abort_on_error() \
+    do { \
+        if (!context->error.empty()) { \
+            YYABORT; \
+        } \
+    } while (0)
 
 using namespace std;
 
 %}
 
+%code {
+// 声明 lexer 函数和错误处理函数, 需要用到 YYSTYPE, 因此放在其定义之后
+// lexer 和 parser 均为可重入版本, 状态保存在 scanner 和编译上下文中
+int yylex(YYSTYPE *yylval, yyscan_t scanner);
+void yyerror(yyscan_t scanner, std::unique_ptr<BaseAST> &ast, const char *s);
+}
+
+// 生成可重入的 parser, yylval 不再是全局变量
+%define api.pure full
+
 // 定义 parser 函数和错误处理函数的附加参数
+// scanner 为可重入 lexer 的句柄, 同时传递给 lexer
 // 我们需要返回一个字符串作为 AST, 所以我们把附加参数定义成字符串的智能指针
 // 解析完成后, 我们要手动修改这个参数, 把它设置成解析得到的字符串
-%parse-param { std::unique_ptr<BaseAST> &ast }
+%lex-param { yyscan_t scanner }
+%parse-param { yyscan_t scanner } { std::unique_ptr<BaseAST> &ast }
 
 // yylval 的定义, 我们把它定义成了一个联合体 (union)
 // 在 union 里不应包含带析构函数的类，除非自行编写析构函数并处理
 %union {
-    std::string *str_val;
+    uint32_t sym_val;
     int int_val;
     BaseAST *ast_val;
     StmtAST *stmt_val;
     ExpAST *exp_val;
-    DomainGuard* guard_val;
+    FuncDefAST *func_val;
+    CallAST *call_val;
+    InitValAST *init_val;
+    VarDims *dims_val;
 }
 
 // lexer 返回的所有 token 种类的声明
 // <xxx> 表示该符号的返回值，对应于YYSTYPE的哪个属性，降低编写代价
 // 增加这个符号后，所有对该符号的访问自动修改为.xxx
-%token INT CONST IF ELSE WHILE BREAK CONTINUE RETURN
-%token <str_val> IDENTIFIER
+%token INT VOID CONST IF ELSE WHILE BREAK CONTINUE RETURN
+%token <sym_val> IDENTIFIER
 %token <int_val> INT_CONST
 
 // 非终结符的类型定义
 // 具有返回类型的似乎必须声明type，意义同token部分
-%type <ast_val> FuncDef FuncType Block
+%type <ast_val> FuncType Block
+%type <func_val> FuncDef FuncHead
 %type <stmt_val> Decl ConstDecl VarDecl ConstDef VarDef BlockItem Stmt MatchedStmt OpenStmt
+%type <stmt_val> FuncFParams FuncFParam
+%type <call_val> FuncRParams
 %type <exp_val> Exp PrimaryExp UnaryExp MulExp AddExp RelExp EqExp LAndExp LOrExp Number
-%type <exp_val> ConstInitVal InitVal ConstExp LVal
+%type <exp_val> ConstExp LVal
+%type <init_val> ConstInitVal InitVal ConstInitVals InitVals
+%type <dims_val> ArrayDims
 %type <int_val> UnaryOp MulOp AddOp RelOp EqOp
-%type <guard_val> DomainBegin
 
 %%
 
@@ -69,18 +98,20 @@ using namespace std;
 // |    规则段    |
 // ---------------
 
-// 开始符, CompUnit ::= FuncDef
+// 开始符, CompUnit ::= FuncDef {FuncDef}
 // 大括号后声明了解析完成后 parser 要做的事情
 // 使用 $n 访问第n个符号的值，这里 $1
-// 之前我们定义了 FuncDef 会返回一个 str_val, 也就是字符串指针
+// 第一个函数创建 CompUnitAST, 之后的函数依次加入其中
 // 而 parser 一旦解析完开始符, 就说明所有的 token 都被解析了, 即解析结束了
-// $1 指代 FuncDef 的返回值, 也就是 $1.str_val 的字符串指针
 CompUnit
     : FuncDef {
         auto comp_unit = make_unique<CompUnitAST>();
-        comp_unit->func_def = unique_ptr<BaseAST>($1);
+        comp_unit->func_defs.emplace_back($1);
         ast = move(comp_unit);
     }
+    | CompUnit FuncDef {
+        static_cast<CompUnitAST*>(ast.get())->func_defs.emplace_back($2);
+    }
     ;
 
 Decl
@@ -99,7 +130,19 @@ BType
 
 ConstDef
     : IDENTIFIER '=' ConstInitVal {
-        $$ = new ConstDeclAST(*$1, const_cast<ValueAST*>($3->value_ptr()));
+        if (!$3->expr) {
+            semantic_error("scalar initialized with a list");
+        }
+        abort_on_error();
+        $$ = new ConstDeclAST($1, const_cast<ValueAST*>($3->expr->value_ptr()));
+        delete $3;
+        abort_on_error();
+    }
+    | IDENTIFIER ArrayDims '=' ConstInitVal {
+        $$ = new ArrayDeclAST($1, *$2, $4, true);
+        delete $2;
+        delete $4;
+        abort_on_error();
     }
     | ConstDef ',' ConstDef {
         $1->next = unique_ptr<StmtAST>($3);
@@ -107,8 +150,44 @@ ConstDef
     }
     ;
 
+// 初始化列表在声明时展开, 之后即可释放
 ConstInitVal
-    : ConstExp      { $$ = const_cast<ValueAST*>($1->value_ptr()); }
+    : ConstExp {
+        $$ = new InitValAST();
+        $$->expr = $1;
+    }
+    | '{' '}'       { $$ = new InitValAST(); }
+    | '{' ConstInitVals '}' { $$ = $2; }
+    ;
+
+ConstInitVals
+    : ConstInitVal {
+        $$ = new InitValAST();
+        $$->items.emplace_back($1);
+    }
+    | ConstInitVals ',' ConstInitVal {
+        $1->items.emplace_back($3);
+        $$ = $1;
+    }
+    ;
+
+// 数组各维的长度, 必须是常量表达式
+ArrayDims
+    : '[' ConstExp ']' {
+        if ($2->value_ptr()->number <= 0) {
+            semantic_error("array dimension must be positive");
+        }
+        abort_on_error();
+        $$ = new VarDims{$2->value_ptr()->number};
+    }
+    | ArrayDims '[' ConstExp ']' {
+        if ($3->value_ptr()->number <= 0) {
+            semantic_error("array dimension must be positive");
+        }
+        abort_on_error();
+        $1->push_back($3->value_ptr()->number);
+        $$ = $1;
+    }
     ;
 
 VarDecl
@@ -116,14 +195,34 @@ VarDecl
     ;
 
 VarDef
-    : IDENTIFIER    { $$ = new VarDeclAST(*$1); }
+    : IDENTIFIER    {
+        $$ = new VarDeclAST($1);
+        abort_on_error();
+    }
     | IDENTIFIER '=' InitVal {
-        auto decl = new VarDeclAST(*$1);
-        auto assign = new AssignAST(*$1);
-        assign->set_expr($3);
+        if (!$3->expr) {
+            semantic_error("scalar initialized with a list");
+        }
+        abort_on_error();
+        auto decl = new VarDeclAST($1);
+        abort_on_error();
+        auto assign = new AssignAST($1);
+        assign->set_expr($3->expr);
         decl->next = unique_ptr<StmtAST>(assign);
+        delete $3;
         $$ = decl;
     }
+    | IDENTIFIER ArrayDims {
+        $$ = new ArrayDeclAST($1, *$2, nullptr, false);
+        delete $2;
+        abort_on_error();
+    }
+    | IDENTIFIER ArrayDims '=' InitVal {
+        $$ = new ArrayDeclAST($1, *$2, $4, false);
+        delete $2;
+        delete $4;
+        abort_on_error();
+    }
     | VarDef ',' VarDef {
         // 变量定义可能解释为多个语句, 如声明和赋值
         // 使用push_back保证顺序正确
@@ -133,34 +232,103 @@ VarDef
     ;
 
 InitVal
-    : Exp           { $$ = $1; }
+    : Exp {
+        $$ = new InitValAST();
+        $$->expr = $1;
+    }
+    | '{' '}'       { $$ = new InitValAST(); }
+    | '{' InitVals '}' { $$ = $2; }
+    ;
+
+InitVals
+    : InitVal {
+        $$ = new InitValAST();
+        $$->items.emplace_back($1);
+    }
+    | InitVals ',' InitVal {
+        $1->items.emplace_back($3);
+        $$ = $1;
+    }
     ;
 
 // 我们这里可以直接写 '(' 和 ')', 因为之前在 lexer 里已经处理了单个字符的情况
 // $$ 表示非终结符的值, 我们可以通过给这个符号赋值的方法来返回结果, 但不会生成return语句
 // unique_ptr 可以用来避免内存泄漏, 减少内存管理的负担
+// 函数体之前先将函数加入函数表, 函数体中可以递归调用自身
 FuncDef
-    : FuncType IDENTIFIER '(' ')' Block {
+    : FuncHead '(' ')' {
+        $1->declare();
+        abort_on_error();
+    } Block {
+        context->symbol_table->pop_scope();
+        $1->block = unique_ptr<BaseAST>($5);
+        $$ = $1;
+    }
+    | FuncHead '(' FuncFParams ')' {
+        $1->set_params($3);
+        $1->declare();
+        abort_on_error();
+    } Block {
+        context->symbol_table->pop_scope();
+        $1->block = unique_ptr<BaseAST>($6);
+        $$ = $1;
+    }
+    ;
+
+// 形参位于函数的作用域中, 函数体的语句块是它的内层作用域
+FuncHead
+    : FuncType IDENTIFIER {
         auto ast = new FuncDefAST();
         ast->func_type = unique_ptr<BaseAST>($1);
-        ast->identifier = *unique_ptr<string>($2);
-        ast->block = unique_ptr<BaseAST>($5);
+        ast->identifier = context->interner.name($2);
+        ast->symbol = $2;
+        context->symbol_table->push_scope();
         $$ = ast;
     }
     ;
 
+// 没有返回值的函数类型不记录名称
 FuncType
     : INT {
         auto ast = new FuncTypeAST();
         ast->identifier = "int";
         $$ = ast;
     }
+    | VOID {
+        $$ = new FuncTypeAST();
+    }
+    ;
+
+FuncFParams
+    : FuncFParam    { $$ = $1; }
+    | FuncFParams ',' FuncFParam {
+        $1->push_back($3);
+        $$ = $1;
+    }
+    ;
+
+FuncFParam
+    : BType IDENTIFIER {
+        $$ = new FuncFParamAST($2);
+        abort_on_error();
+    }
+    // 数组形参的第一维长度省略, 记为 0
+    | BType IDENTIFIER '[' ']' {
+        $$ = new FuncFParamAST($2, {0});
+        abort_on_error();
+    }
+    | BType IDENTIFIER '[' ']' ArrayDims {
+        $5->insert($5->begin(), 0);
+        $$ = new FuncFParamAST($2, *$5);
+        delete $5;
+        abort_on_error();
+    }
     ;
 
 Block
     : '{' DomainBegin BlockItem '}' {
-        // 块的作用域结束后, 自动销毁作用域
-        auto guard = unique_ptr<DomainGuard>($2);
+        // 块的作用域结束, 弹出其中的所有符号
+        context->symbol_table->pop_scope();
         auto ast = new BlockAST();
         ast->statement = unique_ptr<BaseAST>($3);
         $$ = ast;
@@ -171,7 +339,7 @@ Block
     ;
 
 DomainBegin : {
-        $$ = new DomainGuard();
+        context->symbol_table->push_scope();
     };
 
 BlockItem
@@ -190,33 +358,64 @@ Stmt
 
 MatchedStmt
     : RETURN Exp ';' {
+        if (!context->returns_value) {
+            semantic_error("return with a value in void function");
+        }
         auto ast = new ReturnAST();
         ast->set_expr($2);
         $$ = ast;
+        abort_on_error();
     }
     | RETURN ';'     { $$ = new ReturnAST(); }
     | IF '(' Exp ')' MatchedStmt ELSE MatchedStmt {
         $$ = new BranchAST($3, $5, $7);
     }
-    | WHILE '(' Exp ')' Stmt {
-        $$ = new LoopAST($3, $5);
+    | WHILE '(' Exp ')' { context->loop_depth++; } Stmt {
+        context->loop_depth--;
+        $$ = new LoopAST($3, $6);
+    }
+    | BREAK ';'      {
+        if (!context->loop_depth) {
+            semantic_error("break outside a loop");
+        }
+        abort_on_error();
+        $$ = new BreakAST();
+    }
+    | CONTINUE ';'   {
+        if (!context->loop_depth) {
+            semantic_error("continue outside a loop");
+        }
+        abort_on_error();
+        $$ = new ContinueAST();
     }
-    | BREAK ';'      { $$ = new BreakAST(); }
-    | CONTINUE ';'   { $$ = new ContinueAST(); }
     | Block     { $$ = new BlockStmtAST($1); }
     | Exp ';' {
+        if (auto call = dynamic_cast<CallAST*>($1)) {
+            call->discarded = true;
+        }
         auto ast = new ExpStmtAST();
         ast->set_expr($1);
         $$ = ast;
+        abort_on_error();
     }
     | ';'       { $$ = new ExpStmtAST(); }
     | LVal '=' Exp ';' {
-        auto ast = new AssignAST();
-        auto lval = reinterpret_cast<GetVarAST*>($1);
-        ast->set_var(const_cast<ValueAST*>(lval->var.get()));
-        ast->set_expr($3);
-        delete lval;
-        $$ = ast;
+        // lval 节点由节点池管理, 不再使用即可, 无需释放
+        if (auto elem = dynamic_cast<ArrayElemAST*>($1)) {
+            $$ = new ArrayAssignAST(elem, $3);
+        } else {
+            // 常量在 LVal 中直接替换为值, 不能赋值
+            auto lval = dynamic_cast<GetVarAST*>($1);
+            if (!lval) {
+                semantic_error("cannot assign to constant");
+            }
+            abort_on_error();
+            auto ast = new AssignAST();
+            ast->set_var(const_cast<ValueAST*>(lval->var.get()));
+            ast->set_expr($3);
+            $$ = ast;
+        }
+        abort_on_error();
     }
     ;
 
@@ -236,7 +435,10 @@ Exp
 ConstExp
     : Exp {
         $1->set_value_as_temp();
-        assert($1->value_ptr()->type == ValueAST::Type::Num);
+        if ($1->value_ptr()->type != ValueAST::Type::Num || $1->has_call()) {
+            semantic_error("expression is not constant");
+        }
+        abort_on_error();
         $$ = const_cast<ValueAST*>($1->value_ptr());
     }
     ;
@@ -249,7 +451,31 @@ PrimaryExp
 
 UnaryExp
     : PrimaryExp    { $$ = $1; }
-    | UnaryOp UnaryExp { return_binary($1, new ValueAST(0), $2, $$); }
+    | UnaryOp UnaryExp { return_binary($1, context->node_pool.constant(0), $2, $$); }
+    | IDENTIFIER '(' ')' {
+        auto call = new CallAST();
+        call->set_callee($1);
+        $$ = call;
+        abort_on_error();
+    }
+    | IDENTIFIER '(' FuncRParams ')' {
+        $3->set_callee($1);
+        $$ = $3;
+        abort_on_error();
+    }
+    ;
+
+// 实参在解析时依次加入调用, 函数名在最后设置
+FuncRParams
+    : Exp {
+        auto call = new CallAST();
+        call->add_arg($1);
+        $$ = call;
+    }
+    | FuncRParams ',' Exp {
+        $1->add_arg($3);
+        $$ = $1;
+    }
     ;
 
 UnaryOp
@@ -305,8 +531,8 @@ LAndExp
     : EqExp         { $$ = $1; }
     | LAndExp '&' '&' EqExp {
         ExpAST *l, *r;
-        return_binary(BinaryAST::Type::Ne, new ValueAST(0), $1, l);
-        return_binary(BinaryAST::Type::Ne, new ValueAST(0), $4, r);
+        return_binary(BinaryAST::Type::Ne, context->node_pool.constant(0), $1, l);
+        return_binary(BinaryAST::Type::Ne, context->node_pool.constant(0), $4, r);
         return_binary(BinaryAST::Type::And, l, r, $$);
     }
     ;
@@ -315,27 +541,42 @@ LOrExp
     : LAndExp       { $$ = $1; }
     | LOrExp '|' '|' LAndExp {
         ExpAST *l, *r;
-        return_binary(BinaryAST::Type::Ne, new ValueAST(0), $1, l);
-        return_binary(BinaryAST::Type::Ne, new ValueAST(0), $4, r);
+        return_binary(BinaryAST::Type::Ne, context->node_pool.constant(0), $1, l);
+        return_binary(BinaryAST::Type::Ne, context->node_pool.constant(0), $4, r);
         return_binary(BinaryAST::Type::Or, l, r, $$);
     }
     ;
 
 LVal
     : IDENTIFIER    {
-        auto var = symbol_table->get_var(*$1);
-        assert(var != nullptr);
+        auto var = context->symbol_table->get_var($1);
+        if (!var) {
+            semantic_error("undefined variable " + context->interner.name($1));
+        }
+        abort_on_error();
         if (var->type == ValueAST::Type::Var) {
             $$ = new GetVarAST(var);
+        } else if (var->type == ValueAST::Type::Array) {
+            $$ = new ArrayElemAST(static_cast<ArrayVarAST*>(var));
         } else {
             $$ = var;
         }
     }
+    | LVal '[' Exp ']' {
+        auto elem = dynamic_cast<ArrayElemAST*>($1);
+        if (!elem) {
+            semantic_error("subscript of non-array");
+        }
+        abort_on_error();
+        elem->add_index($3);
+        $$ = elem;
+        abort_on_error();
+    }
     ;
 
 Number
     : INT_CONST {
-        $$ = new ValueAST($1);
+        $$ = context->node_pool.constant($1);
     }
     ;
 
@@ -347,6 +588,6 @@ Number
 
 // 定义错误处理函数, 其中第二个参数是错误信息
 // parser 如果发生错误 (例如输入的程序出现了语法错误), 就会调用这个函数
-void yyerror(unique_ptr<BaseAST> &ast, const char *s) {
+void yyerror(yyscan_t scanner, unique_ptr<BaseAST> &ast, const char *s) {
     cerr << "error: " << s << endl;
 }
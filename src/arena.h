@@ -0,0 +1,69 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 简单的 bump 分配器
+// 只分配不回收, 所有内存在 Arena 析构时一并释放, 不会调用对象的析构函数
+// 因此只应在其中放置平凡类型, 或生命周期与 Arena 相同且无需析构的对象
+class Arena {
+private:
+    static constexpr size_t block_size = 64 * 1024;
+    std::vector<std::unique_ptr<char[]>> _blocks;
+    char *_cur = nullptr;
+    size_t _left = 0;
+
+    // 申请新的内存块, 过大的请求单独分配一块
+    void grow(size_t size) {
+        size_t length = size > block_size ? size : block_size;
+        _blocks.emplace_back(new char[length]);
+        _cur = _blocks.back().get();
+        _left = length;
+    }
+
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // 分配 size 字节, 按 align 对齐
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        size_t pad = -reinterpret_cast<uintptr_t>(_cur) & (align - 1);
+        if (pad + size > _left) {
+            grow(size + align);
+            pad = -reinterpret_cast<uintptr_t>(_cur) & (align - 1);
+        }
+        void *result = _cur + pad;
+        _cur += pad + size;
+        _left -= pad + size;
+        return result;
+    }
+
+    // 在 arena 中构造对象
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // 分配未初始化的数组
+    template <typename T>
+    T* make_array(size_t n) {
+        return static_cast<T*>(allocate(sizeof(T) * (n ? n : 1), alignof(T)));
+    }
+
+    // 复制以 '\0' 结尾的字符串
+    const char* copy(const std::string &s) {
+        auto result = make_array<char>(s.size() + 1);
+        std::memcpy(result, s.c_str(), s.size() + 1);
+        return result;
+    }
+};
+
+#endif
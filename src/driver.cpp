@@ -0,0 +1,327 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include "koopa.h"
+#include "emitter.h"
+#include "koopa_parser.h"
+#include "koopa_builder.h"
+#include "koopa_interpreter.h"
+#include "koopa_optimizer.h"
+#include "koopa_printer.h"
+#include "koopa_util.h"
+#include "trace.h"
+#include "AST_SysY.h"
+#include "driver.h"
+
+using namespace std;
+
+// 声明可重入 lexer 的接口, 以及 parser 函数
+// flex 生成的头文件并不总是存在，所以不使用include方式
+// 看起来会很烦人, 于是干脆采用这种看起来 dirty 但实际很有效的手段
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void* yyscan_t;
+#endif
+struct yy_buffer_state;
+extern int yylex_init(yyscan_t *scanner);
+extern void yyset_in(FILE *in, yyscan_t scanner);
+extern yy_buffer_state *yy_scan_buffer(char *base, size_t size, yyscan_t scanner);
+extern int yylex_destroy(yyscan_t scanner);
+extern int yyparse(yyscan_t scanner, unique_ptr<BaseAST> &ast);
+
+// 映射到内存的输入文件
+// flex 要求缓冲区以两个 NUL 结尾, 并会在扫描时临时改写缓冲区, 因此使用可写的私有映射
+// 文件之后先保留一段匿名映射, 再将文件覆盖映射到其开头, 保证末尾的 NUL 总是可访问
+// 只处理非空的普通文件, 其余情况 (标准输入, 管道等) 仍由 stdio 读取
+class MappedInput {
+private:
+    char *_base = nullptr;
+    size_t _length = 0;
+    size_t _mapped = 0;
+public:
+    explicit MappedInput(const string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            size_t page = sysconf(_SC_PAGESIZE);
+            size_t length = st.st_size;
+            size_t mapped = (length + 2 + page - 1) / page * page;
+            void *area = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (area != MAP_FAILED) {
+                if (mmap(area, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) !=
+                    MAP_FAILED) {
+                    madvise(area, length, MADV_SEQUENTIAL);
+                    _base = static_cast<char*>(area);
+                    _length = length;
+                    _mapped = mapped;
+                } else {
+                    munmap(area, mapped);
+                }
+            }
+        }
+        close(fd);
+    }
+    MappedInput(const MappedInput&) = delete;
+    MappedInput& operator=(const MappedInput&) = delete;
+    ~MappedInput() {
+        if (_base) {
+            munmap(_base, _mapped);
+        }
+    }
+    explicit operator bool() const { return _base != nullptr; }
+    // 交给 yy_scan_buffer 的缓冲区, 长度包含末尾的两个 NUL
+    char *buffer() const { return _base; }
+    size_t size() const { return _length + 2; }
+};
+
+bool parse_request(const string &line, CompileOptions &options, string &error) {
+    istringstream iss(line);
+    string flag;
+    if (!(iss >> options.mode >> options.input >> flag >> options.output) || flag != "-o") {
+        error = "usage: mode input -o output";
+        return false;
+    }
+    return true;
+}
+
+// 写出结果, 需要时同时打印到标准输出
+static bool emit(Emitter &out, const CompileOptions &options, const char *header, string &error) {
+    if (!out.write_file(options.output)) {
+        error = "cannot write " + options.output;
+        return false;
+    }
+    if (options.echo) {
+        cout << header << flush;
+        out.write_to(STDOUT_FILENO);
+    }
+    return true;
+}
+
+// 统计 raw program 中的指令数
+static int64_t count_insts(const koopa_raw_program_t &program) {
+    int64_t count = 0;
+    for (uint32_t i = 0; i < program.funcs.len; i++) {
+        auto func = slice_at<koopa_raw_function_t>(program.funcs, i);
+        for (uint32_t j = 0; j < func->bbs.len; j++) {
+            count += slice_at<koopa_raw_basic_block_t>(func->bbs, j)->insts.len;
+        }
+    }
+    return count;
+}
+
+// 输出计时结果
+static bool finish_trace(const Tracer &tracer, const CompileOptions &options, string &error) {
+    if (options.time_phases) {
+        tracer.report(cerr);
+    }
+    if (!options.trace.empty() && !tracer.write_trace(options.trace)) {
+        error = "cannot write " + options.trace;
+        return false;
+    }
+    return true;
+}
+
+bool compile(const CompileOptions &options, string &error) {
+    auto &mode = options.mode;
+    if (mode.size() < 2 || (mode[1] != 'k' && mode[1] != 'r' && mode[1] != 'p' &&
+                            mode[1] != 'v' && mode[1] != 'd')) {
+        error = "unknown mode " + mode;
+        return false;
+    }
+    auto k2r = (mode[1] != 'k' && mode[1] != 'd');
+    // -run 与 -riscv 的首字母相同, 单独判断
+    auto run = mode == "-run";
+
+    // 打开输入文件, 普通文件直接映射到内存中扫描, "-" 表示标准输入
+    auto from_stdin = options.input == "-";
+    unique_ptr<MappedInput> mapped;
+    FILE *in = nullptr;
+    if (!from_stdin) {
+        mapped = make_unique<MappedInput>(options.input);
+    }
+    if (!mapped || !*mapped) {
+        in = from_stdin ? stdin : fopen(options.input.c_str(), "r");
+        if (!in) {
+            error = "cannot open " + options.input;
+            return false;
+        }
+    }
+
+    // 本次编译的全部状态, 在此之后声明的对象先于上下文销毁
+    CompilerContext ctx;
+    ContextGuard guard(ctx);
+    Tracer tracer(options.time_phases || !options.trace.empty());
+
+    // 调用 parser 函数, parser 函数会进一步调用 lexer 解析输入文件的
+    // lexer 由 parser 按需调用, 两者计为同一阶段
+    unique_ptr<BaseAST> ast;
+    int ret;
+    {
+        Tracer::Scope scope(tracer, "parse");
+        yyscan_t scanner;
+        yylex_init(&scanner);
+        if (in) {
+            yyset_in(in, scanner);
+        } else {
+            yy_scan_buffer(mapped->buffer(), mapped->size(), scanner);
+        }
+        ret = yyparse(scanner, ast);
+        yylex_destroy(scanner);
+        if (in && !from_stdin) {
+            fclose(in);
+        }
+        scope.count("nodes", ctx.node_pool.size());
+    }
+    // 语义错误在解析中途中止或解析完成后报告, 否则是语法错误
+    if (ret || !ctx.error.empty()) {
+        error = (ctx.error.empty() ? "syntax error" : ctx.error) + " in " + options.input;
+        return false;
+    }
+    // 符号表只在语法分析时使用
+    ctx.symbol_table.reset();
+
+    // -dump: 输出 AST 的结构后结束
+    // 先完整生成到缓冲区再一次写出, 防止输出不一致
+    if (mode[1] == 'd') {
+        Emitter out;
+        {
+            Tracer::Scope scope(tracer, "dump");
+            ast->dump(out);
+            out << '\n';
+            scope.count("bytes", out.size());
+        }
+        {
+            Tracer::Scope scope(tracer, "write");
+            if (!emit(out, options, "Koopa:\n------\n", error)) {
+                return false;
+            }
+        }
+        return finish_trace(tracer, options, error);
+    }
+
+    // 第一阶段: 将 SysY 代码转换为 Koopa IR
+    // 由 AST 直接构建内存形式 raw program, 这是 Koopa IR 唯一的生成途径
+    // raw program 的内存归 builder 所有
+    KoopaBuilder builder;
+    {
+        Tracer::Scope scope(tracer, "lower");
+        ast->lower(builder);
+    }
+    if (!ctx.error.empty()) {
+        error = ctx.error + " in " + options.input;
+        return false;
+    }
+    koopa_raw_program_t raw;
+    {
+        Tracer::Scope scope(tracer, "build");
+        raw = builder.build();
+        if (tracer.enabled()) {
+            scope.count("instructions", count_insts(raw));
+        }
+    }
+
+    // -koopa: 输出未经优化的 raw program 的文本后结束
+    if (!k2r) {
+        Emitter out;
+        {
+            Tracer::Scope scope(tracer, "print");
+            KoopaPrinter(out).Print(raw);
+            scope.count("bytes", out.size());
+        }
+        {
+            Tracer::Scope scope(tracer, "write");
+            if (!emit(out, options, "Koopa:\n------\n", error)) {
+                return false;
+            }
+        }
+        return finish_trace(tracer, options, error);
+    }
+
+    // 第二阶段: 将 Koopa IR 转换为 RISC-V 汇编代码
+    // IR 优化, 直接修改 builder 中的 raw program
+    // 向量化提取出的函数交给后端生成 RVV 代码
+    std::unordered_set<koopa_raw_function_t> kernels;
+    if (options.opt_level > 0) {
+        Tracer::Scope scope(tracer, "optimize");
+        KoopaOptimizer optimizer(builder, options.unroll, options.vectorize);
+        optimizer.run(raw);
+        kernels.insert(optimizer.kernels().begin(), optimizer.kernels().end());
+        for (auto &stat : optimizer.stats()) {
+            scope.count(stat.first, stat.second);
+        }
+        if (tracer.enabled()) {
+            scope.count("instructions", count_insts(raw));
+        }
+    }
+
+    // -run: 在进程内解释执行 raw program, 输出返回值和各基本块的动态指令数
+    // 程序本身的输入输出使用标准输入输出
+    if (run) {
+        KoopaInterpreter interpreter;
+        {
+            Tracer::Scope scope(tracer, "decode");
+            if (!interpreter.Decode(raw, error)) {
+                return false;
+            }
+        }
+        {
+            Tracer::Scope scope(tracer, "run");
+            if (!interpreter.Run(error)) {
+                return false;
+            }
+        }
+        Emitter out;
+        interpreter.Report(out);
+        {
+            Tracer::Scope scope(tracer, "write");
+            if (!emit(out, options, "Run:\n----\n", error)) {
+                return false;
+            }
+        }
+        return finish_trace(tracer, options, error);
+    }
+
+    // 处理 raw program
+    Emitter out;
+    auto parser = KoopaParser(out, options.jobs, options.opt_level > 0, &kernels);
+    // 访问 raw program, 生成 raw program 的文本表示
+    if (mode[1] == 'v' && options.echo) {
+        Emitter visit;
+        KoopaParser(visit).Visit(raw);
+        cout << "Raw:\n----\n" << flush;
+        visit.write_to(STDOUT_FILENO);
+    }
+
+    // 将 raw program 转换为 RISC-V 汇编代码
+    // 生成 RISCV 汇编代码
+    {
+        Tracer::Scope scope(tracer, "emit");
+        parser.Compile(raw);
+        if (options.opt_level > 0) {
+            scope.count("peephole removed", parser.peephole_removed);
+        }
+        scope.count("bytes", out.size());
+    }
+
+    // 输出
+    // 注意, raw program 中所有的指针指向的内存均为 builder 的内存
+    // builder 在本函数结束时释放, 不要提前销毁
+    {
+        Tracer::Scope scope(tracer, "write");
+        if (!emit(out, options, "RISCV:\n----\n", error)) {
+            return false;
+        }
+    }
+    return finish_trace(tracer, options, error);
+}
@@ -0,0 +1,41 @@
+#ifndef __DRIVER_H__
+#define __DRIVER_H__
+
+#include <string>
+
+// 单次编译的参数
+struct CompileOptions {
+    // 模式: -koopa, -riscv, -perf, -visit, -dump, -run
+    std::string mode;
+    std::string input;
+    std::string output;
+    // 后端并行编译函数的线程数
+    int jobs = 1;
+    // 优化级别, 0 时不运行 IR 优化
+    int opt_level = 1;
+    // 循环展开的倍数, 小于 2 时不展开
+    int unroll = 4;
+    // 是否将逐元素的循环向量化为 RVV 代码
+    bool vectorize = false;
+    // 是否同时将结果打印到标准输出, 默认只写输出文件
+    bool echo = false;
+    // 是否在标准错误输出各阶段耗时
+    bool time_phases = false;
+    // 非空时将各阶段计时以 Chrome trace event 格式写入该文件
+    std::string trace;
+};
+
+// 完成一次编译, 所有状态保存在独立的编译上下文中, 可以在多个线程中同时调用
+// 成功返回 true, 否则返回 false 并在 error 中记录原因
+bool compile(const CompileOptions &options, std::string &error);
+
+// 解析 "模式 输入文件 -o 输出文件" 形式的参数, 用于命令行和批处理请求
+bool parse_request(const std::string &line, CompileOptions &options, std::string &error);
+
+// 批处理模式: manifest 每行一个请求, 使用 jobs 个线程并发编译
+int run_batch(const std::string &manifest, int jobs);
+
+// 服务模式: 监听本地 Unix socket, 每行一个请求, 逐行回复 ok 或 error
+int run_server(const std::string &socket_path, int jobs);
+
+#endif
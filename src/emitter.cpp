@@ -0,0 +1,129 @@
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#include "emitter.h"
+
+namespace {
+    // 两位十进制数字表, 每次处理两位
+    const char digit_pairs[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+}
+
+void Emitter::grow(size_t n) {
+    sync();
+    size_t capacity = n > chunk_size ? n : chunk_size;
+    _chunks.push_back({std::unique_ptr<char[]>(new char[capacity]), 0, capacity});
+    _cur = _chunks.back().data.get();
+    _end = _cur + capacity;
+}
+
+Emitter& Emitter::write_unsigned(unsigned long long value, bool negative) {
+    char buffer[24];
+    char *p = buffer + sizeof(buffer);
+    while (value >= 100) {
+        auto pair = value % 100 * 2;
+        value /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (value >= 10) {
+        *--p = digit_pairs[value * 2 + 1];
+        *--p = digit_pairs[value * 2];
+    } else {
+        *--p = static_cast<char>('0' + value);
+    }
+    if (negative) {
+        *--p = '-';
+    }
+    return write(p, buffer + sizeof(buffer) - p);
+}
+
+void Emitter::splice(Emitter &&other) {
+    other.sync();
+    sync();
+    for (auto &chunk : other._chunks) {
+        if (chunk.used) {
+            _chunks.push_back(std::move(chunk));
+        }
+    }
+    other._chunks.clear();
+    other._cur = other._end = nullptr;
+    // 继续写入接入的最后一块的剩余空间
+    if (!_chunks.empty()) {
+        auto &last = _chunks.back();
+        _cur = last.data.get() + last.used;
+        _end = last.data.get() + last.capacity;
+    }
+}
+
+size_t Emitter::size() const {
+    size_t total = 0;
+    for (size_t i = 0; i + 1 < _chunks.size(); i++) {
+        total += _chunks[i].used;
+    }
+    if (!_chunks.empty()) {
+        total += _cur - _chunks.back().data.get();
+    }
+    return total;
+}
+
+std::string Emitter::str() const {
+    std::string result;
+    result.reserve(size());
+    for (size_t i = 0; i < _chunks.size(); i++) {
+        auto used = i + 1 < _chunks.size() ? _chunks[i].used : _cur - _chunks[i].data.get();
+        result.append(_chunks[i].data.get(), used);
+    }
+    return result;
+}
+
+bool Emitter::write_to(int fd) {
+    sync();
+    std::vector<iovec> iov;
+    for (auto &chunk : _chunks) {
+        if (chunk.used) {
+            iov.push_back({chunk.data.get(), chunk.used});
+        }
+    }
+    // 单次 writev 的向量数有上限, 且可能只写出一部分
+    size_t index = 0;
+    while (index < iov.size()) {
+        int count = static_cast<int>(std::min<size_t>(iov.size() - index, IOV_MAX));
+        ssize_t written = writev(fd, iov.data() + index, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        while (index < iov.size() && static_cast<size_t>(written) >= iov[index].iov_len) {
+            written -= iov[index].iov_len;
+            index++;
+        }
+        if (written > 0) {
+            iov[index].iov_base = static_cast<char*>(iov[index].iov_base) + written;
+            iov[index].iov_len -= written;
+        }
+    }
+    return true;
+}
+
+bool Emitter::write_file(const std::string &path) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write_to(fd);
+    return close(fd) == 0 && ok;
+}
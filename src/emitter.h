@@ -0,0 +1,96 @@
+#ifndef __EMITTER_H__
+#define __EMITTER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 只追加的分块输出缓冲区
+// 内容按块保存, 追加时不会移动已有数据, 最终通过一次 writev 直接写出, 不做整体拷贝
+// 整数自行格式化, 不经过 iostream 的 locale 和格式状态
+class Emitter {
+private:
+    static constexpr size_t chunk_size = 64 * 1024;
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t used;
+        size_t capacity;
+    };
+    std::vector<Chunk> _chunks;
+    // 当前块的写入位置和末尾
+    char *_cur = nullptr;
+    char *_end = nullptr;
+
+    // 将当前写入位置同步到最后一块的 used
+    void sync() {
+        if (!_chunks.empty()) {
+            _chunks.back().used = _cur - _chunks.back().data.get();
+        }
+    }
+    // 追加至少能容纳 n 字节的新块
+    void grow(size_t n);
+    Emitter& write_unsigned(unsigned long long value, bool negative);
+
+public:
+    Emitter() = default;
+    Emitter(const Emitter&) = delete;
+    Emitter& operator=(const Emitter&) = delete;
+    Emitter(Emitter&&) = default;
+    Emitter& operator=(Emitter&&) = default;
+
+    Emitter& write(const char *str, size_t len) {
+        if (static_cast<size_t>(_end - _cur) < len) {
+            grow(len);
+        }
+        std::memcpy(_cur, str, len);
+        _cur += len;
+        return *this;
+    }
+
+    Emitter& operator<<(char c) {
+        if (_cur == _end) {
+            grow(1);
+        }
+        *_cur++ = c;
+        return *this;
+    }
+    // 写入 n 个字符 c, 用于缩进
+    Emitter& fill(char c, size_t n) {
+        if (static_cast<size_t>(_end - _cur) < n) {
+            grow(n);
+        }
+        std::memset(_cur, c, n);
+        _cur += n;
+        return *this;
+    }
+    Emitter& operator<<(const char *str) { return write(str, std::strlen(str)); }
+    Emitter& operator<<(const std::string &str) { return write(str.data(), str.size()); }
+    Emitter& operator<<(std::string_view str) { return write(str.data(), str.size()); }
+    Emitter& operator<<(int value) { return *this << static_cast<long long>(value); }
+    Emitter& operator<<(long value) { return *this << static_cast<long long>(value); }
+    Emitter& operator<<(long long value) {
+        return value < 0 ? write_unsigned(0ull - value, true) : write_unsigned(value, false);
+    }
+    Emitter& operator<<(unsigned value) { return write_unsigned(value, false); }
+    Emitter& operator<<(unsigned long value) { return write_unsigned(value, false); }
+    Emitter& operator<<(unsigned long long value) { return write_unsigned(value, false); }
+
+    // 将另一个缓冲区的内容接到末尾, 只移动块, 不复制数据
+    void splice(Emitter &&other);
+
+    // 已写入的总字节数
+    size_t size() const;
+    // 复制为字符串, 仅用于调试和测试
+    std::string str() const;
+
+    // 将全部内容写入文件描述符, 成功返回 true
+    bool write_to(int fd);
+    // 创建或覆盖文件并写入全部内容, 成功返回 true
+    bool write_file(const std::string &path);
+};
+
+#endif
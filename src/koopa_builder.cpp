@@ -0,0 +1,281 @@
+#include <cassert>
+#include "koopa_builder.h"
+#include "AST_SysY.h"
+
+KoopaBuilder::KoopaBuilder() {
+    _i32.tag = KOOPA_RTT_INT32;
+    _unit.tag = KOOPA_RTT_UNIT;
+    _i32_ptr.tag = KOOPA_RTT_POINTER;
+    _i32_ptr.data.pointer.base = &_i32;
+}
+
+koopa_raw_value_data_t* KoopaBuilder::new_value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag) {
+    auto value = _arena.make<koopa_raw_value_data_t>();
+    value->ty = ty;
+    value->name = nullptr;
+    value->used_by = empty_slice(KOOPA_RSIK_VALUE);
+    value->kind.tag = tag;
+    return value;
+}
+
+koopa_raw_value_t KoopaBuilder::append(koopa_raw_value_data_t *value) {
+    assert(_func && "instruction outside function");
+    _blocks[_current].insts.push_back(value);
+    return value;
+}
+
+// 函数
+
+koopa_raw_function_data_t* KoopaBuilder::new_function(const std::string &name,
+                                                       const std::vector<koopa_raw_type_t> &params, bool has_return) {
+    if (_functions.count(name)) {
+        semantic_error("redefinition of function " + name);
+    }
+    auto ty = _arena.make<koopa_raw_type_kind_t>();
+    ty->tag = KOOPA_RTT_FUNCTION;
+    ty->data.function.params = make_slice(params, KOOPA_RSIK_TYPE);
+    ty->data.function.ret = has_return ? &_i32 : &_unit;
+    auto func = _arena.make<koopa_raw_function_data_t>();
+    func->ty = ty;
+    func->name = _arena.copy("@" + name);
+    func->params = empty_slice(KOOPA_RSIK_VALUE);
+    func->bbs = empty_slice(KOOPA_RSIK_BASIC_BLOCK);
+    _functions[name] = func;
+    return func;
+}
+
+void KoopaBuilder::declare(const std::string &name, const std::vector<koopa_raw_type_t> &params, bool has_return) {
+    _funcs.push_back(new_function(name, params, has_return));
+}
+
+void KoopaBuilder::begin_function(const std::string &name, const std::vector<koopa_raw_type_t> &params,
+                                  bool has_return) {
+    assert(!_func && "nested function");
+    _func = create_function(name, params, has_return);
+}
+
+koopa_raw_function_data_t* KoopaBuilder::create_function(const std::string &name,
+                                                         const std::vector<koopa_raw_type_t> &params,
+                                                         bool has_return) {
+    auto func = new_function(name, params, has_return);
+    std::vector<koopa_raw_value_t> values;
+    for (size_t i = 0; i < params.size(); i++) {
+        auto value = new_value(params[i], KOOPA_RVT_FUNC_ARG_REF);
+        value->kind.data.func_arg_ref.index = i;
+        values.push_back(value);
+    }
+    func->params = make_slice(values, KOOPA_RSIK_VALUE);
+    return func;
+}
+
+void KoopaBuilder::end_function() {
+    assert(_func && !_layout.empty());
+    // 分配指令放在入口基本块开头
+    auto &entry = _blocks[_layout.front()].insts;
+    entry.insert(entry.begin(), _allocs.begin(), _allocs.end());
+    std::vector<koopa_raw_basic_block_t> bbs;
+    for (auto index : _layout) {
+        auto &block = _blocks[index];
+        block.bb->insts = make_slice(block.insts, KOOPA_RSIK_VALUE);
+        bbs.push_back(block.bb);
+    }
+    _func->bbs = make_slice(bbs, KOOPA_RSIK_BASIC_BLOCK);
+    _funcs.push_back(_func);
+    _func = nullptr;
+    _blocks.clear();
+    _block_index.clear();
+    _layout.clear();
+    _allocs.clear();
+    _symbols.clear();
+}
+
+// 基本块
+
+koopa_raw_basic_block_data_t* KoopaBuilder::new_block(const std::string &name) {
+    auto bb = _arena.make<koopa_raw_basic_block_data_t>();
+    bb->name = _arena.copy(name);
+    bb->params = empty_slice(KOOPA_RSIK_VALUE);
+    bb->used_by = empty_slice(KOOPA_RSIK_VALUE);
+    bb->insts = empty_slice(KOOPA_RSIK_VALUE);
+    return bb;
+}
+
+koopa_raw_basic_block_t KoopaBuilder::block(const std::string &name) {
+    auto it = _block_index.find(name);
+    if (it != _block_index.end()) {
+        return _blocks[it->second].bb;
+    }
+    auto bb = new_block(name);
+    _block_index[name] = _blocks.size();
+    _blocks.push_back({bb, {}});
+    return bb;
+}
+
+void KoopaBuilder::enter(koopa_raw_basic_block_t bb) {
+    auto it = _block_index.find(bb->name);
+    assert(it != _block_index.end() && _blocks[it->second].bb == bb);
+    _current = it->second;
+    _layout.push_back(_current);
+}
+
+koopa_raw_value_t KoopaBuilder::param(koopa_raw_basic_block_t bb) {
+    auto it = _block_index.find(bb->name);
+    assert(it != _block_index.end() && _blocks[it->second].bb == bb);
+    auto block = _blocks[it->second].bb;
+    std::vector<koopa_raw_value_t> params;
+    for (uint32_t i = 0; i < block->params.len; i++) {
+        params.push_back(reinterpret_cast<koopa_raw_value_t>(block->params.buffer[i]));
+    }
+    auto value = new_value(&_i32, KOOPA_RVT_BLOCK_ARG_REF);
+    value->kind.data.block_arg_ref.index = params.size();
+    params.push_back(value);
+    block->params = make_slice(params, KOOPA_RSIK_VALUE);
+    return value;
+}
+
+koopa_raw_function_t KoopaBuilder::function(const std::string &name) const {
+    auto it = _functions.find(name);
+    if (it == _functions.end()) {
+        semantic_error("undefined function " + name);
+        return nullptr;
+    }
+    return it->second;
+}
+
+koopa_raw_value_t KoopaBuilder::arg(int index) const {
+    assert(_func && static_cast<uint32_t>(index) < _func->params.len);
+    return reinterpret_cast<koopa_raw_value_t>(_func->params.buffer[index]);
+}
+
+koopa_raw_value_t KoopaBuilder::lookup(const ValueAST *key) const {
+    auto it = _symbols.find(key);
+    assert(it != _symbols.end() && "value not lowered");
+    return it->second;
+}
+
+// 类型
+
+koopa_raw_type_t KoopaBuilder::array_type(koopa_raw_type_t base, size_t len) {
+    auto ty = _arena.make<koopa_raw_type_kind_t>();
+    ty->tag = KOOPA_RTT_ARRAY;
+    ty->data.array.base = base;
+    ty->data.array.len = len;
+    return ty;
+}
+
+koopa_raw_type_t KoopaBuilder::pointer_type(koopa_raw_type_t base) {
+    if (base == &_i32) {
+        return &_i32_ptr;
+    }
+    auto ty = _arena.make<koopa_raw_type_kind_t>();
+    ty->tag = KOOPA_RTT_POINTER;
+    ty->data.pointer.base = base;
+    return ty;
+}
+
+// 值和指令
+
+koopa_raw_value_t KoopaBuilder::integer(int32_t number) {
+    auto &result = _integers[number];
+    if (!result) {
+        auto value = new_value(&_i32, KOOPA_RVT_INTEGER);
+        value->kind.data.integer.value = number;
+        result = value;
+    }
+    return result;
+}
+
+koopa_raw_value_t KoopaBuilder::alloc(const std::string &name, koopa_raw_type_t ty) {
+    auto value = new_value(pointer_type(ty ? ty : &_i32), KOOPA_RVT_ALLOC);
+    value->name = _arena.copy(name);
+    _allocs.push_back(value);
+    return value;
+}
+
+koopa_raw_value_t KoopaBuilder::load(koopa_raw_value_t src) {
+    auto value = new_value(src->ty->data.pointer.base, KOOPA_RVT_LOAD);
+    value->kind.data.load.src = src;
+    return append(value);
+}
+
+void KoopaBuilder::store(koopa_raw_value_t value, koopa_raw_value_t dest) {
+    auto inst = new_value(&_unit, KOOPA_RVT_STORE);
+    inst->kind.data.store.value = value;
+    inst->kind.data.store.dest = dest;
+    append(inst);
+}
+
+koopa_raw_value_t KoopaBuilder::get_elem_ptr(koopa_raw_value_t src, koopa_raw_value_t index) {
+    assert(src->ty->tag == KOOPA_RTT_POINTER && src->ty->data.pointer.base->tag == KOOPA_RTT_ARRAY);
+    auto value = new_value(pointer_type(src->ty->data.pointer.base->data.array.base), KOOPA_RVT_GET_ELEM_PTR);
+    value->kind.data.get_elem_ptr.src = src;
+    value->kind.data.get_elem_ptr.index = index;
+    return append(value);
+}
+
+koopa_raw_value_t KoopaBuilder::get_ptr(koopa_raw_value_t src, koopa_raw_value_t index) {
+    assert(src->ty->tag == KOOPA_RTT_POINTER);
+    auto value = new_value(src->ty, KOOPA_RVT_GET_PTR);
+    value->kind.data.get_ptr.src = src;
+    value->kind.data.get_ptr.index = index;
+    return append(value);
+}
+
+koopa_raw_value_t KoopaBuilder::binary(koopa_raw_binary_op_t op,
+                                       koopa_raw_value_t lhs, koopa_raw_value_t rhs) {
+    auto value = new_value(&_i32, KOOPA_RVT_BINARY);
+    value->kind.data.binary.op = op;
+    value->kind.data.binary.lhs = lhs;
+    value->kind.data.binary.rhs = rhs;
+    return append(value);
+}
+
+void KoopaBuilder::branch(koopa_raw_value_t cond,
+                          koopa_raw_basic_block_t true_bb, koopa_raw_basic_block_t false_bb) {
+    auto inst = new_value(&_unit, KOOPA_RVT_BRANCH);
+    auto &branch = inst->kind.data.branch;
+    branch.cond = cond;
+    branch.true_bb = true_bb;
+    branch.false_bb = false_bb;
+    branch.true_args = empty_slice(KOOPA_RSIK_VALUE);
+    branch.false_args = empty_slice(KOOPA_RSIK_VALUE);
+    append(inst);
+}
+
+koopa_raw_value_data_t* KoopaBuilder::new_jump(koopa_raw_basic_block_t target,
+                                               const std::vector<koopa_raw_value_t> &args) {
+    auto inst = new_value(&_unit, KOOPA_RVT_JUMP);
+    inst->kind.data.jump.target = target;
+    inst->kind.data.jump.args = make_slice(args, KOOPA_RSIK_VALUE);
+    return inst;
+}
+
+void KoopaBuilder::jump(koopa_raw_basic_block_t target, const std::vector<koopa_raw_value_t> &args) {
+    append(new_jump(target, args));
+}
+
+void KoopaBuilder::ret(koopa_raw_value_t value) {
+    auto inst = new_value(&_unit, KOOPA_RVT_RETURN);
+    inst->kind.data.ret.value = value;
+    append(inst);
+}
+
+koopa_raw_value_t KoopaBuilder::call(koopa_raw_function_t callee, const std::vector<koopa_raw_value_t> &args) {
+    if (!callee || args.size() != callee->ty->data.function.params.len) {
+        // 出错时以 0 代替调用的结果, 编译在生成结束后失败
+        semantic_error("argument count mismatch in call");
+        return integer(0);
+    }
+    auto value = new_value(callee->ty->data.function.ret, KOOPA_RVT_CALL);
+    value->kind.data.call.callee = callee;
+    value->kind.data.call.args = make_slice(args, KOOPA_RSIK_VALUE);
+    return append(value);
+}
+
+koopa_raw_program_t KoopaBuilder::build() {
+    assert(!_func && "unfinished function");
+    koopa_raw_program_t program;
+    program.values = empty_slice(KOOPA_RSIK_VALUE);
+    program.funcs = make_slice(_funcs, KOOPA_RSIK_FUNCTION);
+    return program;
+}
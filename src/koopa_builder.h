@@ -0,0 +1,131 @@
+#ifndef __KOOPA_BUILDER_H__
+#define __KOOPA_BUILDER_H__
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+#include "arena.h"
+
+class ValueAST;
+
+// 直接由 AST 构建 Koopa raw program, 不再经过 "生成文本 -> 重新解析" 的过程
+// raw program 的所有数据均分配在 builder 的 arena 中
+// 因此在 raw program 处理完毕之前不要销毁 builder
+// 注意: 各个值的 used_by 不做维护, 始终为空
+class KoopaBuilder {
+private:
+    // 构建中的基本块, 指令在函数结束时才写入 raw 结构
+    struct PendingBlock {
+        koopa_raw_basic_block_data_t *bb;
+        std::vector<koopa_raw_value_t> insts;
+    };
+
+    Arena _arena;
+    // 常用类型
+    koopa_raw_type_kind_t _i32, _unit, _i32_ptr;
+    std::vector<koopa_raw_function_t> _funcs;
+    // 已声明或定义的函数, 调用时按名称查找
+    std::unordered_map<std::string, koopa_raw_function_t> _functions;
+
+    // 当前函数的状态
+    koopa_raw_function_data_t *_func = nullptr;
+    // 所有基本块, 按第一次引用的顺序排列
+    std::vector<PendingBlock> _blocks;
+    std::unordered_map<std::string, size_t> _block_index;
+    // 基本块在函数中的布局顺序, 即进入基本块的顺序
+    std::vector<size_t> _layout;
+    size_t _current = 0;
+    // 局部变量的分配指令, 统一放在入口基本块开头
+    std::vector<koopa_raw_value_t> _allocs;
+
+    // AST 中的值到 raw 值的映射
+    std::unordered_map<const ValueAST*, koopa_raw_value_t> _symbols;
+    // 整数常量不依赖位置, 可以复用
+    std::unordered_map<int32_t, koopa_raw_value_t> _integers;
+
+    // 将指令添加到当前基本块末尾
+    koopa_raw_value_t append(koopa_raw_value_data_t *value);
+    // 创建参数类型为 params 的函数, 尚未加入程序
+    koopa_raw_function_data_t* new_function(const std::string &name, const std::vector<koopa_raw_type_t> &params,
+                                             bool has_return);
+
+public:
+    KoopaBuilder();
+    KoopaBuilder(const KoopaBuilder&) = delete;
+    KoopaBuilder& operator=(const KoopaBuilder&) = delete;
+
+    // 函数
+    // 声明没有函数体的函数, 如运行时库中的函数
+    void declare(const std::string &name, const std::vector<koopa_raw_type_t> &params, bool has_return);
+    void begin_function(const std::string &name, const std::vector<koopa_raw_type_t> &params, bool has_return);
+    void end_function();
+    // 按名称获取已声明的函数, 包括正在构建的函数, 不存在时报告语义错误并返回空指针
+    koopa_raw_function_t function(const std::string &name) const;
+    // 当前函数的第 index 个参数
+    koopa_raw_value_t arg(int index) const;
+
+    // 基本块, 按名称获取或创建, 进入后才加入函数布局
+    koopa_raw_basic_block_t block(const std::string &name);
+    void enter(koopa_raw_basic_block_t bb);
+    // 为基本块添加一个 i32 参数
+    koopa_raw_value_t param(koopa_raw_basic_block_t bb);
+
+    // AST 值与 raw 值的绑定
+    void bind(const ValueAST *key, koopa_raw_value_t value) { _symbols[key] = value; }
+    koopa_raw_value_t lookup(const ValueAST *key) const;
+
+    // 类型, 数组和指针类型每次新建, 不做复用
+    koopa_raw_type_t array_type(koopa_raw_type_t base, size_t len);
+    koopa_raw_type_t pointer_type(koopa_raw_type_t base);
+
+    // 值和指令
+    koopa_raw_value_t integer(int32_t number);
+    // 分配类型为 ty 的局部变量, 默认为 i32
+    koopa_raw_value_t alloc(const std::string &name, koopa_raw_type_t ty = nullptr);
+    koopa_raw_value_t load(koopa_raw_value_t src);
+    void store(koopa_raw_value_t value, koopa_raw_value_t dest);
+    // src 指向数组时取第 index 个元素的地址
+    koopa_raw_value_t get_elem_ptr(koopa_raw_value_t src, koopa_raw_value_t index);
+    // src 之后第 index 个同类型元素的地址
+    koopa_raw_value_t get_ptr(koopa_raw_value_t src, koopa_raw_value_t index);
+    koopa_raw_value_t binary(koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs);
+    void branch(koopa_raw_value_t cond, koopa_raw_basic_block_t true_bb, koopa_raw_basic_block_t false_bb);
+    void jump(koopa_raw_basic_block_t target, const std::vector<koopa_raw_value_t> &args = {});
+    void ret(koopa_raw_value_t value = nullptr);
+    // 调用函数, 没有返回值时结果的类型为 unit
+    // 函数不存在或实参个数不符时报告语义错误, 不生成调用
+    koopa_raw_value_t call(koopa_raw_function_t callee, const std::vector<koopa_raw_value_t> &args);
+
+    // 生成最终的 raw program
+    koopa_raw_program_t build();
+
+    // 以下接口供优化 pass 在 build 之后修改 raw program, 新的数据同样分配在 arena 中
+    koopa_raw_type_t i32_type() const { return &_i32; }
+    koopa_raw_type_t unit_type() const { return &_unit; }
+    koopa_raw_slice_t empty_slice(koopa_raw_slice_item_kind_t kind) const {
+        return {nullptr, 0, kind};
+    }
+    // 将 vector 复制为 arena 中的 slice
+    template <typename T>
+    koopa_raw_slice_t make_slice(const std::vector<T> &items, koopa_raw_slice_item_kind_t kind) {
+        if (items.empty()) {
+            return empty_slice(kind);
+        }
+        auto buffer = _arena.make_array<const void*>(items.size());
+        for (size_t i = 0; i < items.size(); i++) {
+            buffer[i] = items[i];
+        }
+        return {buffer, static_cast<uint32_t>(items.size()), kind};
+    }
+    koopa_raw_value_data_t* new_value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag);
+    // 带有形参的空函数, 不加入 build 得到的程序, 由调用者放入程序并填入基本块
+    koopa_raw_function_data_t* create_function(const std::string &name, const std::vector<koopa_raw_type_t> &params,
+                                               bool has_return);
+    // 不属于任何函数的空基本块, 由调用者放入函数的布局中
+    koopa_raw_basic_block_data_t* new_block(const std::string &name);
+    // 不属于任何基本块的跳转指令
+    koopa_raw_value_data_t* new_jump(koopa_raw_basic_block_t target, const std::vector<koopa_raw_value_t> &args);
+};
+
+#endif
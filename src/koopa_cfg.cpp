@@ -0,0 +1,173 @@
+#include <algorithm>
+#include "koopa_cfg.h"
+#include "koopa_util.h"
+
+ControlFlowGraph::ControlFlowGraph(koopa_raw_function_t func) {
+    if (!func->bbs.len) {
+        return;
+    }
+    // 非递归的深度优先遍历, 得到后序
+    std::unordered_map<koopa_raw_basic_block_t, bool> visited;
+    std::vector<std::pair<koopa_raw_basic_block_t, std::vector<koopa_raw_basic_block_t>>> stack;
+    std::vector<koopa_raw_basic_block_t> postorder;
+    auto push = [&](koopa_raw_basic_block_t bb) {
+        visited[bb] = true;
+        std::vector<koopa_raw_basic_block_t> next;
+        for_each_successor(terminator(bb), [&](koopa_raw_basic_block_t succ) {
+            next.push_back(succ);
+        });
+        // 逆序压入, 使先出现的后继先被访问
+        std::reverse(next.begin(), next.end());
+        stack.push_back({bb, std::move(next)});
+    };
+    push(slice_at<koopa_raw_basic_block_t>(func->bbs, 0));
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        if (top.second.empty()) {
+            postorder.push_back(top.first);
+            stack.pop_back();
+            continue;
+        }
+        auto succ = top.second.back();
+        top.second.pop_back();
+        if (!visited[succ]) {
+            push(succ);
+        }
+    }
+
+    blocks.assign(postorder.rbegin(), postorder.rend());
+    for (uint32_t i = 0; i < blocks.size(); i++) {
+        index[blocks[i]] = i;
+    }
+    preds.resize(blocks.size());
+    succs.resize(blocks.size());
+    for (uint32_t i = 0; i < blocks.size(); i++) {
+        for_each_successor(terminator(blocks[i]), [&](koopa_raw_basic_block_t succ) {
+            auto j = index.at(succ);
+            if (std::find(succs[i].begin(), succs[i].end(), j) == succs[i].end()) {
+                succs[i].push_back(j);
+                preds[j].push_back(i);
+            }
+        });
+    }
+    compute_dominators();
+}
+
+// Cooper, Harvey, Kennedy: A Simple, Fast Dominance Algorithm
+// 按逆后序迭代, 用编号比较代替后序编号
+void ControlFlowGraph::compute_dominators() {
+    const uint32_t none = UINT32_MAX;
+    idom.assign(blocks.size(), none);
+    idom[0] = 0;
+    auto intersect = [&](uint32_t a, uint32_t b) {
+        while (a != b) {
+            while (a > b) {
+                a = idom[a];
+            }
+            while (b > a) {
+                b = idom[b];
+            }
+        }
+        return a;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (uint32_t i = 1; i < blocks.size(); i++) {
+            uint32_t dom = none;
+            for (auto pred : preds[i]) {
+                if (idom[pred] == none) {
+                    continue;
+                }
+                dom = dom == none ? pred : intersect(pred, dom);
+            }
+            if (dom != idom[i]) {
+                idom[i] = dom;
+                changed = true;
+            }
+        }
+    }
+    dom_children.assign(blocks.size(), {});
+    for (uint32_t i = 1; i < blocks.size(); i++) {
+        dom_children[idom[i]].push_back(i);
+    }
+}
+
+bool ControlFlowGraph::dominates(uint32_t a, uint32_t b) const {
+    // 支配者的编号不大于被支配者, 沿支配树向上查找
+    while (b > a) {
+        b = idom[b];
+    }
+    return a == b;
+}
+
+std::vector<std::vector<uint32_t>> ControlFlowGraph::dominance_frontiers() const {
+    std::vector<std::vector<uint32_t>> frontiers(blocks.size());
+    for (uint32_t i = 0; i < blocks.size(); i++) {
+        if (preds[i].size() < 2) {
+            continue;
+        }
+        for (auto pred : preds[i]) {
+            for (auto runner = pred; runner != idom[i]; runner = idom[runner]) {
+                // 同一个基本块只会连续地加入
+                if (frontiers[runner].empty() || frontiers[runner].back() != i) {
+                    frontiers[runner].push_back(i);
+                }
+            }
+        }
+    }
+    return frontiers;
+}
+
+bool Loop::contains(uint32_t bb) const {
+    return std::binary_search(blocks.begin(), blocks.end(), bb);
+}
+
+std::vector<Loop> ControlFlowGraph::natural_loops() const {
+    std::vector<Loop> loops;
+    for (uint32_t header = 0; header < blocks.size(); header++) {
+        Loop loop;
+        loop.header = header;
+        for (auto pred : preds[header]) {
+            if (dominates(header, pred)) {
+                loop.latches.push_back(pred);
+            }
+        }
+        if (loop.latches.empty()) {
+            continue;
+        }
+        // 从回边的起点沿前驱反向查找, 直到首部
+        std::vector<bool> in_loop(blocks.size());
+        in_loop[header] = true;
+        std::vector<uint32_t> worklist;
+        for (auto latch : loop.latches) {
+            if (!in_loop[latch]) {
+                in_loop[latch] = true;
+                worklist.push_back(latch);
+            }
+        }
+        while (!worklist.empty()) {
+            auto bb = worklist.back();
+            worklist.pop_back();
+            for (auto pred : preds[bb]) {
+                if (!in_loop[pred]) {
+                    in_loop[pred] = true;
+                    worklist.push_back(pred);
+                }
+            }
+        }
+        for (uint32_t i = header; i < blocks.size(); i++) {
+            if (in_loop[i]) {
+                loop.blocks.push_back(i);
+            }
+        }
+        // 包含首部的最后一个循环即直接的外层循环
+        for (auto i = loops.size(); i-- > 0;) {
+            if (loops[i].contains(header)) {
+                loop.parent = i;
+                break;
+            }
+        }
+        loops.push_back(std::move(loop));
+    }
+    return loops;
+}
@@ -0,0 +1,50 @@
+#ifndef __KOOPA_CFG_H__
+#define __KOOPA_CFG_H__
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+
+// 自然循环: 由回边 (首部支配起点的边) 确定, 同一个首部的所有回边合并为一个循环
+struct Loop {
+    uint32_t header;
+    // 回边的起点
+    std::vector<uint32_t> latches;
+    // 循环中的基本块, 包括首部, 按编号排列
+    std::vector<uint32_t> blocks;
+    // 直接包含该循环的外层循环在列表中的下标, 最外层循环为 UINT32_MAX
+    uint32_t parent = UINT32_MAX;
+
+    bool contains(uint32_t bb) const;
+};
+
+// 函数的控制流图, 只包含从入口可达的基本块
+// 基本块按逆后序编号, 入口编号为 0, 支配者的编号总是小于被支配者
+// 图在构造时确定, 之后修改函数需要重新构造
+class ControlFlowGraph {
+public:
+    std::vector<koopa_raw_basic_block_t> blocks;
+    std::unordered_map<koopa_raw_basic_block_t, uint32_t> index;
+    // 前驱和后继, 两个基本块之间的多条边只记录一次
+    std::vector<std::vector<uint32_t>> preds, succs;
+    // 直接支配者, 入口的直接支配者为自身
+    std::vector<uint32_t> idom;
+    // 支配树中的子节点
+    std::vector<std::vector<uint32_t>> dom_children;
+
+    explicit ControlFlowGraph(koopa_raw_function_t func);
+
+    bool reachable(koopa_raw_basic_block_t bb) const { return index.count(bb) != 0; }
+    // a 是否支配 b
+    bool dominates(uint32_t a, uint32_t b) const;
+    // 每个基本块的支配边界
+    std::vector<std::vector<uint32_t>> dominance_frontiers() const;
+    // 所有自然循环, 按首部编号排列, 外层循环总是排在内层循环之前
+    std::vector<Loop> natural_loops() const;
+
+private:
+    void compute_dominators();
+};
+
+#endif
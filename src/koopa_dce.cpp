@@ -0,0 +1,146 @@
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "koopa.h"
+#include "koopa_cfg.h"
+#include "koopa_optimizer.h"
+#include "koopa_util.h"
+
+// 死代码删除
+// 1. 删除从入口不可达的基本块, 例如 return, break, continue 之后新建的基本块
+// 2. 从有副作用的指令出发标记活跃的值, 删除未被标记的指令
+//    跳转的实参只有在对应的参数活跃时才活跃, 因此只在环路中传递的参数也可以删除
+// 3. 从未被 load 的局部变量只有 store, 这些 store 和变量本身一起删除
+
+void KoopaOptimizer::eliminate_dead_code(koopa_raw_function_t func) {
+    ControlFlowGraph cfg(func);
+    auto &bbs = mutable_function(func)->bbs;
+    if (cfg.blocks.size() < bbs.len) {
+        // 保持原有的排列顺序
+        std::vector<koopa_raw_basic_block_t> reachable;
+        for (uint32_t i = 0; i < bbs.len; i++) {
+            auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+            if (cfg.reachable(bb)) {
+                reachable.push_back(bb);
+            }
+        }
+        count("removed blocks", bbs.len - reachable.size());
+        bbs = _builder.make_slice(reachable, KOOPA_RSIK_BASIC_BLOCK);
+    }
+
+    // 被 load 读取或者地址逃逸的局部变量, 对它们的 store 不能删除
+    std::unordered_set<koopa_raw_value_t> allocs, read;
+    // 以每个基本块为目标的跳转, 以及参数所属的基本块
+    std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_value_t>> jumps;
+    std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> param_owner;
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+        for (uint32_t j = 0; j < bb->params.len; j++) {
+            param_owner[slice_at<koopa_raw_value_t>(bb->params, j)] = bb;
+        }
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            auto &kind = inst->kind;
+            if (kind.tag == KOOPA_RVT_ALLOC) {
+                allocs.insert(inst);
+            } else if (kind.tag == KOOPA_RVT_JUMP) {
+                jumps[kind.data.jump.target].push_back(inst);
+            }
+            for_each_operand(inst, [&](koopa_raw_value_t operand) {
+                if (kind.tag != KOOPA_RVT_STORE || kind.data.store.value == operand) {
+                    read.insert(operand);
+                }
+            });
+        }
+    }
+
+    std::unordered_set<koopa_raw_value_t> live;
+    std::vector<koopa_raw_value_t> worklist;
+    auto mark = [&](koopa_raw_value_t value) {
+        if (live.insert(value).second) {
+            worklist.push_back(value);
+        }
+    };
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            auto &kind = inst->kind;
+            switch (kind.tag) {
+                case KOOPA_RVT_ALLOC:
+                case KOOPA_RVT_LOAD:
+                case KOOPA_RVT_GET_PTR:
+                case KOOPA_RVT_GET_ELEM_PTR:
+                case KOOPA_RVT_BINARY:
+                    break;
+                case KOOPA_RVT_STORE: {
+                    auto dest = kind.data.store.dest;
+                    if (!allocs.count(dest) || read.count(dest)) {
+                        mark(inst);
+                    }
+                    break;
+                }
+                default:
+                    mark(inst);
+                    break;
+            }
+        }
+    }
+    while (!worklist.empty()) {
+        auto value = worklist.back();
+        worklist.pop_back();
+        auto &kind = value->kind;
+        if (kind.tag == KOOPA_RVT_JUMP) {
+            // 实参随目标基本块的参数标记
+            continue;
+        }
+        if (kind.tag == KOOPA_RVT_BLOCK_ARG_REF) {
+            auto index = kind.data.block_arg_ref.index;
+            for (auto jump : jumps[param_owner.at(value)]) {
+                auto arg = slice_at<koopa_raw_value_t>(jump->kind.data.jump.args, index);
+                if (arg->kind.tag != KOOPA_RVT_INTEGER) {
+                    mark(arg);
+                }
+            }
+            continue;
+        }
+        for_each_operand(value, [&](koopa_raw_value_t operand) {
+            if (operand->kind.tag != KOOPA_RVT_INTEGER) {
+                mark(operand);
+            }
+        });
+    }
+
+    // 删除未被标记的指令和参数
+    int64_t removed = 0, removed_params = 0;
+    std::unordered_map<koopa_raw_basic_block_t, std::vector<bool>> keep_params;
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+        std::vector<bool> keep(bb->params.len);
+        bool drop = false;
+        for (uint32_t j = 0; j < bb->params.len; j++) {
+            keep[j] = live.count(slice_at<koopa_raw_value_t>(bb->params, j));
+            if (!keep[j]) {
+                drop = true;
+                removed_params++;
+            }
+        }
+        if (drop) {
+            keep_params[bb] = std::move(keep);
+        }
+        std::vector<koopa_raw_value_t> insts;
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            if (live.count(inst)) {
+                insts.push_back(inst);
+            }
+        }
+        if (insts.size() < bb->insts.len) {
+            removed += bb->insts.len - insts.size();
+            mutable_block(bb)->insts = _builder.make_slice(insts, KOOPA_RSIK_VALUE);
+        }
+    }
+    remove_params(func, keep_params);
+    count("removed instructions", removed);
+    count("removed params", removed_params);
+}
@@ -0,0 +1,162 @@
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "koopa.h"
+#include "koopa_cfg.h"
+#include "koopa_optimizer.h"
+#include "koopa_util.h"
+
+// 基于支配树的值编号, 删除公共子表达式
+// 1. 二元运算以 (运算, 操作数) 为键, 交换律的运算按操作数地址排序, gt/ge 交换操作数后改为 lt/le
+//    getptr/getelemptr 同样以 (指令种类, 基址, 下标) 为键
+//    整数常量由 builder 复用, 相同的常量即相同的值
+// 2. 沿支配树先序遍历, 每个基本块可以使用所有支配者中的结果, 离开子树时撤销其中的记录
+// 3. load 只在基本块内复用: store 之后读取相同地址得到存入的值, 写入其他局部变量不影响,
+//    写入未知地址或者调用函数时清空所有记录
+
+namespace {
+    struct Key {
+        int op;
+        koopa_raw_value_t lhs, rhs;
+
+        bool operator==(const Key &other) const {
+            return op == other.op && lhs == other.lhs && rhs == other.rhs;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            auto h = std::hash<const void*>()(key.lhs);
+            h = h * 31 + std::hash<const void*>()(key.rhs);
+            return h * 31 + key.op;
+        }
+    };
+
+    bool is_commutative(koopa_raw_binary_op_t op) {
+        switch (op) {
+            case KOOPA_RBO_ADD:
+            case KOOPA_RBO_MUL:
+            case KOOPA_RBO_AND:
+            case KOOPA_RBO_OR:
+            case KOOPA_RBO_XOR:
+            case KOOPA_RBO_EQ:
+            case KOOPA_RBO_NOT_EQ:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    Key binary_key(const koopa_raw_binary_t &binary) {
+        auto op = binary.op;
+        auto lhs = binary.lhs, rhs = binary.rhs;
+        if (op == KOOPA_RBO_GT || op == KOOPA_RBO_GE) {
+            op = op == KOOPA_RBO_GT ? KOOPA_RBO_LT : KOOPA_RBO_LE;
+            std::swap(lhs, rhs);
+        } else if (is_commutative(op) && std::less<const void*>()(rhs, lhs)) {
+            std::swap(lhs, rhs);
+        }
+        return {op, lhs, rhs};
+    }
+
+    bool is_variable(koopa_raw_value_t value) {
+        return value->kind.tag == KOOPA_RVT_ALLOC || value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC;
+    }
+}
+
+void KoopaOptimizer::number_values(koopa_raw_function_t func) {
+    ControlFlowGraph cfg(func);
+    // 可用的表达式, 以及按进入顺序记录的键, 离开子树时撤销
+    std::unordered_map<Key, koopa_raw_value_t, KeyHash> available;
+    std::vector<Key> undo;
+    // 被删除的指令到替代值的映射
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+    int64_t reused = 0, forwarded = 0;
+
+    auto visit = [&](koopa_raw_basic_block_t bb) {
+        // 基本块内地址到最近一次读取或写入的值
+        std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> memory;
+        std::vector<koopa_raw_value_t> insts;
+        for (uint32_t i = 0; i < bb->insts.len; i++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, i);
+            for_each_operand_ref(inst, [&](koopa_raw_value_t &operand) {
+                auto it = replace.find(operand);
+                if (it != replace.end()) {
+                    operand = it->second;
+                }
+            });
+            auto &kind = inst->kind;
+            if (kind.tag == KOOPA_RVT_BINARY) {
+                auto key = binary_key(kind.data.binary);
+                auto it = available.find(key);
+                if (it != available.end()) {
+                    replace[inst] = it->second;
+                    reused++;
+                    continue;
+                }
+                available[key] = inst;
+                undo.push_back(key);
+            } else if (is_address(inst)) {
+                // 地址计算以负的指令种类为运算, 与二元运算区分
+                Key key = {-static_cast<int>(kind.tag), address_src(inst), address_index(inst)};
+                auto it = available.find(key);
+                if (it != available.end()) {
+                    replace[inst] = it->second;
+                    reused++;
+                    continue;
+                }
+                available[key] = inst;
+                undo.push_back(key);
+            } else if (kind.tag == KOOPA_RVT_LOAD) {
+                auto it = memory.find(kind.data.load.src);
+                if (it != memory.end()) {
+                    replace[inst] = it->second;
+                    forwarded++;
+                    continue;
+                }
+                memory[kind.data.load.src] = inst;
+            } else if (kind.tag == KOOPA_RVT_STORE) {
+                auto dest = kind.data.store.dest;
+                if (!is_variable(dest)) {
+                    memory.clear();
+                }
+                memory[dest] = kind.data.store.value;
+            } else if (kind.tag == KOOPA_RVT_CALL) {
+                memory.clear();
+            }
+            insts.push_back(inst);
+        }
+        if (insts.size() < bb->insts.len) {
+            mutable_block(bb)->insts = _builder.make_slice(insts, KOOPA_RSIK_VALUE);
+        }
+    };
+
+    // 非递归的支配树先序遍历, 栈中记录进入子树时 undo 的长度
+    struct Frame {
+        uint32_t bb;
+        size_t next_child;
+        size_t undo_size;
+    };
+    std::vector<Frame> stack;
+    stack.push_back({0, 0, undo.size()});
+    visit(cfg.blocks[0]);
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        auto &children = cfg.dom_children[top.bb];
+        if (top.next_child < children.size()) {
+            auto child = children[top.next_child++];
+            stack.push_back({child, 0, undo.size()});
+            visit(cfg.blocks[child]);
+            continue;
+        }
+        while (undo.size() > top.undo_size) {
+            available.erase(undo.back());
+            undo.pop_back();
+        }
+        stack.pop_back();
+    }
+    count("reused values", reused);
+    count("forwarded loads", forwarded);
+}
@@ -0,0 +1,530 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "koopa.h"
+#include "koopa_interpreter.h"
+#include "koopa_util.h"
+
+// 解码后各指令的操作数, 均为槽位下标, 基本块为在 _blocks 中的编号:
+//   二元运算   a = b op c
+//   Alloc      a = 栈帧内存的起点 + b
+//   Load       a = mem[b]                      Store    mem[b] = a
+//   GetPtr     a = b + c * d                   d 为常量步长
+//   Jump       跳转到 a, 依次执行 _aux[b..] 中的 c 对复制 (形参 = 实参)
+//   ParallelJump  同上, 实参全部读出后再写入形参, 用于形参同时是其他实参的情况
+//   Branch     a 不为 0 时跳转到 b, 否则跳转到 c
+//   Call       a = 函数 b(_aux[c..]), 没有返回值时 a 为 -1
+//   Library    a = 运行时库函数 b(_aux[c..])
+//   Ret        返回 a, 没有返回值时 a 为 -1
+// 与 RISC-V 相同, 除以 0 的商为 -1, 余数为被除数; INT_MIN / -1 的商为 INT_MIN, 余数为 0
+// 因此与目标机器上的执行结果一致
+
+static_assert(static_cast<int>(KoopaInterpreter::Code::Sar) == KOOPA_RBO_SAR,
+              "binary codes must follow koopa_raw_binary_op_t");
+
+#ifndef __GNUC__
+#error "the interpreter dispatches through computed goto, which requires GCC or Clang"
+#endif
+
+namespace {
+    // 内存和槽位栈的大小, 以 4 字节为单位, 只有用到的部分才会占用物理内存
+    constexpr uint32_t memory_words = 1u << 24;
+    constexpr uint32_t slot_words = 1u << 22;
+    // 内存开头保留, 0 不是有效的地址
+    constexpr uint32_t memory_begin = 16;
+
+    // 运行时库函数, 按名称匹配没有函数体的声明
+    enum Library { GetInt, GetCh, GetArray, PutInt, PutCh, PutArray, StartTime, StopTime };
+    const char *const library_names[] = {
+        "@getint", "@getch", "@getarray", "@putint", "@putch", "@putarray", "@starttime", "@stoptime",
+    };
+
+    bool is_constant(koopa_raw_value_t value) {
+        auto tag = value->kind.tag;
+        return tag == KOOPA_RVT_INTEGER || tag == KOOPA_RVT_ZERO_INIT || tag == KOOPA_RVT_UNDEF;
+    }
+
+    int32_t constant_value(koopa_raw_value_t value) {
+        return value->kind.tag == KOOPA_RVT_INTEGER ? value->kind.data.integer.value : 0;
+    }
+
+    // 调用者的状态
+    struct Frame {
+        // 返回后继续执行的指令
+        const void *ret;
+        int32_t *slots;
+        uint32_t mem_base;
+        int32_t dest;
+        uint32_t func;
+    };
+}
+
+void KoopaInterpreter::emit(Code code, int32_t a, int32_t b, int32_t c, int32_t d) {
+    Op op;
+    op.code = code;
+    op.a = a;
+    op.b = b;
+    op.c = c;
+    op.d = d;
+    _code.push_back(op);
+}
+
+int32_t KoopaInterpreter::new_slot(koopa_raw_value_t value) {
+    auto slot = static_cast<int32_t>(_const_slots.size() + _slots.size());
+    _slots[value] = slot;
+    return slot;
+}
+
+int32_t KoopaInterpreter::slot(koopa_raw_value_t value) {
+    if (is_constant(value)) {
+        return _const_slots.at(constant_value(value));
+    }
+    auto it = _slots.find(value);
+    if (it == _slots.end()) {
+        _error = value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC ? "global values are not supported"
+                                                           : "value used outside its function";
+        return 0;
+    }
+    return it->second;
+}
+
+// 程序
+bool KoopaInterpreter::Decode(const koopa_raw_program_t &program, std::string &error) {
+    _error.clear();
+    if (program.values.len) {
+        error = "global values are not supported";
+        return false;
+    }
+    // 先为所有函数编号, 调用可以引用之后定义的函数
+    for (uint32_t i = 0; i < program.funcs.len; i++) {
+        auto func = slice_at<koopa_raw_function_t>(program.funcs, i);
+        _func_index[func] = i;
+        _funcs.push_back({func->name, UINT32_MAX, 0, 0, 0, 0, 0});
+    }
+    for (uint32_t i = 0; i < program.funcs.len && _error.empty(); i++) {
+        Decode(slice_at<koopa_raw_function_t>(program.funcs, i));
+    }
+    _counts.assign(_blocks.size(), 0);
+    error = _error;
+    return _error.empty();
+}
+
+// 函数
+void KoopaInterpreter::Decode(const koopa_raw_function_t &func) {
+    // 声明没有函数体, 调用时按名称作为运行时库函数
+    if (!func->bbs.len) {
+        return;
+    }
+    _current = _func_index.at(func);
+    auto &info = _funcs[_current];
+    _slots.clear();
+    _const_slots.clear();
+    _edges.clear();
+    // 常量排在栈帧开头, 之后是形参, 基本块参数和指令结果
+    info.const_begin = _consts.size();
+    for (uint32_t i = 0; i < func->bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(func->bbs, i);
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            for_each_operand(slice_at<koopa_raw_value_t>(bb->insts, j), [&](koopa_raw_value_t operand) {
+                if (is_constant(operand) && !_const_slots.count(constant_value(operand))) {
+                    _const_slots[constant_value(operand)] = _consts.size() - info.const_begin;
+                    _consts.push_back(constant_value(operand));
+                }
+            });
+        }
+    }
+    info.consts = _const_slots.size();
+    info.params = func->params.len;
+    for (uint32_t i = 0; i < func->params.len; i++) {
+        new_slot(slice_at<koopa_raw_value_t>(func->params, i));
+    }
+    // 基本块在布局中的顺序与定义的顺序无关, 先为所有的值分配槽位
+    for (uint32_t i = 0; i < func->bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(func->bbs, i);
+        _block_index[bb] = _blocks.size();
+        _blocks.push_back({0, _current, bb->name, bb->insts.len});
+        for (uint32_t j = 0; j < bb->params.len; j++) {
+            new_slot(slice_at<koopa_raw_value_t>(bb->params, j));
+        }
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            if (inst->ty->tag != KOOPA_RTT_UNIT) {
+                new_slot(inst);
+            }
+        }
+    }
+    info.entry = _block_index.at(slice_at<koopa_raw_basic_block_t>(func->bbs, 0));
+    for (uint32_t i = 0; i < func->bbs.len; i++) {
+        Decode(slice_at<koopa_raw_basic_block_t>(func->bbs, i));
+    }
+    // 带有实参的分支边经过只含一条跳转的中转基本块
+    for (auto &edge : _edges) {
+        _blocks[edge.block].pc = _code.size();
+        emit_jump(edge.target, edge.args);
+    }
+    info.slots = info.consts + _slots.size();
+}
+
+// 基本块
+void KoopaInterpreter::Decode(const koopa_raw_basic_block_t &bb) {
+    _blocks[_block_index.at(bb)].pc = _code.size();
+    for (uint32_t i = 0; i < bb->insts.len; i++) {
+        Decode(slice_at<koopa_raw_value_t>(bb->insts, i));
+    }
+}
+
+void KoopaInterpreter::emit_jump(koopa_raw_basic_block_t target, const koopa_raw_slice_t &args) {
+    auto begin = static_cast<int32_t>(_aux.size());
+    int32_t count = 0;
+    for (uint32_t i = 0; i < args.len; i++) {
+        auto dest = slot(slice_at<koopa_raw_value_t>(target->params, i));
+        auto src = slot(slice_at<koopa_raw_value_t>(args, i));
+        if (dest != src) {
+            _aux.push_back(dest);
+            _aux.push_back(src);
+            count++;
+        }
+    }
+    // 某个形参同时是其他复制的实参时, 需要先读出所有实参
+    bool parallel = false;
+    for (int32_t i = 0; i < count; i++) {
+        for (int32_t j = 0; j < count; j++) {
+            parallel |= _aux[begin + 2 * i] == _aux[begin + 2 * j + 1];
+        }
+    }
+    if (parallel) {
+        _max_moves = std::max(_max_moves, static_cast<uint32_t>(count));
+    }
+    emit(parallel ? Code::ParallelJump : Code::Jump, _block_index.at(target), begin, count);
+}
+
+// 指令
+void KoopaInterpreter::Decode(const koopa_raw_value_t &value) {
+    auto &kind = value->kind;
+    auto &info = _funcs[_current];
+    switch (kind.tag) {
+        case KOOPA_RVT_ALLOC:
+            // 局部变量, 在栈帧内存中依次排列
+            emit(Code::Alloc, slot(value), info.frame);
+            info.frame += std::max(type_size(value->ty->data.pointer.base) / 4, 1);
+            break;
+        case KOOPA_RVT_LOAD:
+            emit(Code::Load, slot(value), slot(kind.data.load.src));
+            break;
+        case KOOPA_RVT_STORE:
+            emit(Code::Store, slot(kind.data.store.value), slot(kind.data.store.dest));
+            break;
+        case KOOPA_RVT_GET_PTR:
+        case KOOPA_RVT_GET_ELEM_PTR:
+            emit(Code::GetPtr, slot(value), slot(address_src(value)), slot(address_index(value)),
+                 address_stride(value) / 4);
+            break;
+        case KOOPA_RVT_BINARY:
+            emit(static_cast<Code>(kind.data.binary.op), slot(value), slot(kind.data.binary.lhs),
+                 slot(kind.data.binary.rhs));
+            break;
+        case KOOPA_RVT_BRANCH: {
+            auto &branch = kind.data.branch;
+            auto target = [&](koopa_raw_basic_block_t bb, const koopa_raw_slice_t &args) {
+                if (!args.len) {
+                    return _block_index.at(bb);
+                }
+                uint32_t block = _blocks.size();
+                _blocks.push_back({0, _current, nullptr, 0});
+                _edges.push_back({block, bb, args});
+                return block;
+            };
+            auto true_bb = target(branch.true_bb, branch.true_args);
+            auto false_bb = target(branch.false_bb, branch.false_args);
+            emit(Code::Branch, slot(branch.cond), true_bb, false_bb);
+            break;
+        }
+        case KOOPA_RVT_JUMP:
+            emit_jump(kind.data.jump.target, kind.data.jump.args);
+            break;
+        case KOOPA_RVT_CALL: {
+            auto &call = kind.data.call;
+            auto begin = static_cast<int32_t>(_aux.size());
+            for (uint32_t i = 0; i < call.args.len; i++) {
+                _aux.push_back(slot(slice_at<koopa_raw_value_t>(call.args, i)));
+            }
+            auto dest = value->ty->tag != KOOPA_RTT_UNIT ? slot(value) : -1;
+            if (call.callee->bbs.len) {
+                emit(Code::Call, dest, _func_index.at(call.callee), begin);
+                break;
+            }
+            int32_t library = 0;
+            while (library <= StopTime && std::strcmp(library_names[library], call.callee->name) != 0) {
+                library++;
+            }
+            if (library > StopTime) {
+                _error = std::string("undefined function ") + call.callee->name;
+            }
+            emit(Code::Library, dest, library, begin);
+            break;
+        }
+        case KOOPA_RVT_RETURN:
+            emit(Code::Ret, kind.data.ret.value ? slot(kind.data.ret.value) : -1);
+            break;
+        default:
+            _error = "unsupported instruction";
+            break;
+    }
+}
+
+bool KoopaInterpreter::Run(std::string &error) {
+    static const void *const handlers[] = {
+        &&op_ne, &&op_eq, &&op_gt, &&op_lt, &&op_ge, &&op_le, &&op_add, &&op_sub, &&op_mul, &&op_div,
+        &&op_mod, &&op_and, &&op_or, &&op_xor, &&op_shl, &&op_shr, &&op_sar,
+        &&op_alloc, &&op_load, &&op_store, &&op_get_ptr, &&op_jump, &&op_parallel_jump, &&op_branch,
+        &&op_call, &&op_library, &&op_ret,
+    };
+    static_assert(sizeof(handlers) / sizeof(handlers[0]) == static_cast<size_t>(Code::Ret) + 1,
+                  "handler table out of sync with Code");
+
+    uint32_t main = 0;
+    while (main < _funcs.size() && _funcs[main].name != "@main") {
+        main++;
+    }
+    if (main == _funcs.size() || _funcs[main].entry == UINT32_MAX) {
+        error = "function @main not found";
+        return false;
+    }
+    // 第一次执行前替换为处理代码的地址
+    if (!_threaded) {
+        for (auto &op : _code) {
+            op.handler = handlers[static_cast<size_t>(op.code)];
+        }
+        _threaded = true;
+    }
+    std::unique_ptr<int32_t[]> memory(new int32_t[memory_words]);
+    std::unique_ptr<int32_t[]> slot_stack(new int32_t[slot_words]);
+    std::vector<int32_t> scratch(_max_moves);
+    std::vector<Frame> frames;
+
+    auto mem = memory.get();
+    auto code = _code.data();
+    auto aux = _aux.data();
+    auto counts = _counts.data();
+    auto slot_end = slot_stack.get() + slot_words;
+    const Op *pc;
+    uint32_t func = main, mem_base = 0, mem_top = memory_begin;
+    int32_t *slots = slot_stack.get();
+    int32_t value = 0;
+
+    // 进入函数: 复制常量, 分配栈帧内存, 跳转到入口基本块
+    auto enter = [&](uint32_t callee) {
+        auto &info = _funcs[callee];
+        if (slots + info.slots > slot_end || mem_top + info.frame > memory_words) {
+            return false;
+        }
+        std::memcpy(slots, _consts.data() + info.const_begin, info.consts * sizeof(int32_t));
+        func = callee;
+        mem_base = mem_top;
+        mem_top += info.frame;
+        counts[info.entry]++;
+        pc = code + _blocks[info.entry].pc;
+        return true;
+    };
+    if (!enter(main)) {
+        goto overflow;
+    }
+
+#define NEXT goto *(++pc)->handler
+#define JUMP_TO(block) do { counts[block]++; pc = code + _blocks[block].pc; goto *pc->handler; } while (0)
+#define BINARY(name, expr) \
+    name: { \
+        int32_t l = slots[pc->b], r = slots[pc->c]; \
+        uint32_t ul = l, ur = r; \
+        (void)ul, (void)ur; \
+        slots[pc->a] = (expr); \
+        NEXT; \
+    }
+#define CHECK_ADDRESS(addr, n) \
+    if ((addr) < memory_begin || (addr) > memory_words || memory_words - (addr) < (n)) { \
+        goto bad_address; \
+    }
+
+    goto *pc->handler;
+
+    BINARY(op_ne, l != r)
+    BINARY(op_eq, l == r)
+    BINARY(op_gt, l > r)
+    BINARY(op_lt, l < r)
+    BINARY(op_ge, l >= r)
+    BINARY(op_le, l <= r)
+    BINARY(op_add, static_cast<int32_t>(ul + ur))
+    BINARY(op_sub, static_cast<int32_t>(ul - ur))
+    BINARY(op_mul, static_cast<int32_t>(ul * ur))
+    BINARY(op_div, r == 0 ? -1 : (l == INT32_MIN && r == -1) ? INT32_MIN : l / r)
+    BINARY(op_mod, r == 0 ? l : (l == INT32_MIN && r == -1) ? 0 : l % r)
+    BINARY(op_and, l & r)
+    BINARY(op_or, l | r)
+    BINARY(op_xor, l ^ r)
+    BINARY(op_shl, static_cast<int32_t>(ul << (ur & 31)))
+    BINARY(op_shr, static_cast<int32_t>(ul >> (ur & 31)))
+    BINARY(op_sar, l >> (ur & 31))
+
+op_alloc:
+    slots[pc->a] = static_cast<int32_t>(mem_base + pc->b);
+    NEXT;
+op_load: {
+    uint32_t addr = slots[pc->b];
+    CHECK_ADDRESS(addr, 1);
+    slots[pc->a] = mem[addr];
+    NEXT;
+}
+op_store: {
+    uint32_t addr = slots[pc->b];
+    CHECK_ADDRESS(addr, 1);
+    mem[addr] = slots[pc->a];
+    NEXT;
+}
+op_get_ptr:
+    slots[pc->a] = static_cast<int32_t>(static_cast<uint32_t>(slots[pc->b]) +
+                                        static_cast<uint32_t>(slots[pc->c]) * static_cast<uint32_t>(pc->d));
+    NEXT;
+op_jump: {
+    auto moves = aux + pc->b;
+    for (int32_t i = 0; i < pc->c; i++) {
+        slots[moves[2 * i]] = slots[moves[2 * i + 1]];
+    }
+    JUMP_TO(pc->a);
+}
+op_parallel_jump: {
+    auto moves = aux + pc->b;
+    for (int32_t i = 0; i < pc->c; i++) {
+        scratch[i] = slots[moves[2 * i + 1]];
+    }
+    for (int32_t i = 0; i < pc->c; i++) {
+        slots[moves[2 * i]] = scratch[i];
+    }
+    JUMP_TO(pc->a);
+}
+op_branch:
+    if (slots[pc->a]) {
+        JUMP_TO(pc->b);
+    }
+    JUMP_TO(pc->c);
+op_call: {
+    auto &info = _funcs[pc->b];
+    auto caller = slots;
+    auto args = aux + pc->c;
+    frames.push_back({pc + 1, caller, mem_base, pc->a, func});
+    slots += _funcs[func].slots;
+    if (!enter(pc->b)) {
+        goto overflow;
+    }
+    for (uint32_t i = 0; i < info.params; i++) {
+        slots[info.consts + i] = caller[args[i]];
+    }
+    goto *pc->handler;
+}
+op_library: {
+    auto args = aux + pc->c;
+    int32_t result = 0;
+    switch (pc->b) {
+        case GetInt:
+            if (std::scanf("%d", &result) != 1) {
+                result = 0;
+            }
+            break;
+        case GetCh:
+            result = std::getchar();
+            break;
+        case GetArray: {
+            uint32_t addr = slots[args[0]];
+            if (std::scanf("%d", &result) != 1) {
+                result = 0;
+            }
+            CHECK_ADDRESS(addr, static_cast<uint32_t>(std::max(result, 0)));
+            for (int32_t i = 0; i < result; i++) {
+                if (std::scanf("%d", &mem[addr + i]) != 1) {
+                    mem[addr + i] = 0;
+                }
+            }
+            break;
+        }
+        case PutInt:
+            std::printf("%d", slots[args[0]]);
+            break;
+        case PutCh:
+            std::putchar(slots[args[0]]);
+            break;
+        case PutArray: {
+            int32_t n = slots[args[0]];
+            uint32_t addr = slots[args[1]];
+            CHECK_ADDRESS(addr, static_cast<uint32_t>(std::max(n, 0)));
+            std::printf("%d:", n);
+            for (int32_t i = 0; i < n; i++) {
+                std::printf(" %d", mem[addr + i]);
+            }
+            std::putchar('\n');
+            break;
+        }
+        default:
+            // 计时函数不产生输出
+            break;
+    }
+    if (pc->a >= 0) {
+        slots[pc->a] = result;
+    }
+    NEXT;
+}
+op_ret: {
+    value = pc->a >= 0 ? slots[pc->a] : 0;
+    if (frames.empty()) {
+        goto done;
+    }
+    auto &frame = frames.back();
+    mem_top = mem_base;
+    mem_base = frame.mem_base;
+    slots = frame.slots;
+    func = frame.func;
+    pc = static_cast<const Op*>(frame.ret);
+    if (frame.dest >= 0) {
+        slots[frame.dest] = value;
+    }
+    frames.pop_back();
+    goto *pc->handler;
+}
+
+#undef CHECK_ADDRESS
+#undef BINARY
+#undef JUMP_TO
+#undef NEXT
+
+done:
+    std::fflush(stdout);
+    _result = value;
+    return true;
+overflow:
+    std::fflush(stdout);
+    error = "stack overflow in " + _funcs[func].name;
+    return false;
+bad_address:
+    std::fflush(stdout);
+    error = "memory access out of range in " + _funcs[func].name;
+    return false;
+}
+
+void KoopaInterpreter::Report(Emitter &o) const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < _blocks.size(); i++) {
+        total += _counts[i] * _blocks[i].insts;
+    }
+    o << "return " << _result << '\n';
+    o << "instructions " << static_cast<unsigned long long>(total) << '\n';
+    // 每个执行过的基本块: 函数 基本块 进入次数 动态指令数
+    for (size_t i = 0; i < _blocks.size(); i++) {
+        auto &block = _blocks[i];
+        if (block.name && _counts[i]) {
+            o << _funcs[block.func].name << ' ' << block.name << ' '
+              << static_cast<unsigned long long>(_counts[i]) << ' '
+              << static_cast<unsigned long long>(_counts[i] * block.insts) << '\n';
+        }
+    }
+}
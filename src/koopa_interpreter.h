@@ -0,0 +1,106 @@
+#ifndef __KOOPA_INTERPRETER_H__
+#define __KOOPA_INTERPRETER_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+#include "emitter.h"
+
+// 直接执行 raw program 的解释器, 用于 -run 模式
+// 执行前按 KoopaParser::Visit 的顺序遍历程序, 预解码为线程化的字节码, 执行时不再访问 raw program:
+// - 每个函数的常量, 形参, 基本块参数和指令结果编号为栈帧中连续的槽位, 指令只记录槽位下标
+// - 常量排在栈帧开头, 进入函数时从常量表整体复制
+// - 所有值都是 32 位整数, 指针是内存中以 4 字节为单位的下标
+// - 指令在第一次执行前替换为处理代码的地址, 每条指令结束时直接跳转到下一条指令的处理代码
+// 运行时库函数直接读写标准输入输出, 执行时统计每个基本块的进入次数
+class KoopaInterpreter {
+public:
+    // 二元运算与 koopa_raw_binary_op_t 的顺序相同
+    enum class Code : uint8_t {
+        Ne, Eq, Gt, Lt, Ge, Le, Add, Sub, Mul, Div, Mod, And, Or, Xor, Shl, Shr, Sar,
+        Alloc, Load, Store, GetPtr, Jump, ParallelJump, Branch, Call, Library, Ret,
+    };
+
+private:
+    // 解码后的指令, 各操作数的含义见 koopa_interpreter.cpp 中的 Decode(value)
+    struct Op {
+        // 执行前为 Code, 之后为处理代码的地址
+        union {
+            Code code;
+            const void *handler;
+        };
+        int32_t a, b, c, d;
+    };
+    struct Function {
+        std::string name;
+        // 入口基本块的编号
+        uint32_t entry;
+        // 栈帧中的槽位数, 其中开头的 consts 个为常量, 之后 params 个为形参
+        uint32_t slots, consts, params;
+        // 常量在常量表中的起始位置
+        uint32_t const_begin;
+        // 局部变量占用的内存, 以 4 字节为单位
+        uint32_t frame;
+    };
+    struct Block {
+        // 第一条指令的位置
+        uint32_t pc;
+        // 所在函数, 以及原基本块的名称和指令数, 分支实参的中转基本块名称为空
+        uint32_t func;
+        const char *name;
+        uint32_t insts;
+    };
+
+    std::vector<Op> _code;
+    // 跳转的 (形参, 实参) 槽位对, 以及调用的实参槽位
+    std::vector<int32_t> _aux;
+    std::vector<int32_t> _consts;
+    std::vector<Function> _funcs;
+    std::vector<Block> _blocks;
+    std::vector<uint64_t> _counts;
+    // 并行复制的最大项数, 执行时的临时空间
+    uint32_t _max_moves = 0;
+    bool _threaded = false;
+    int32_t _result = 0;
+
+    // 解码中的函数及其状态
+    std::unordered_map<koopa_raw_function_t, uint32_t> _func_index;
+    std::unordered_map<koopa_raw_basic_block_t, uint32_t> _block_index;
+    std::unordered_map<koopa_raw_value_t, int32_t> _slots;
+    std::unordered_map<int32_t, int32_t> _const_slots;
+    uint32_t _current = 0;
+    // 带有实参的分支边, 在函数末尾生成中转的跳转
+    struct Edge {
+        uint32_t block;
+        koopa_raw_basic_block_t target;
+        koopa_raw_slice_t args;
+    };
+    std::vector<Edge> _edges;
+    std::string _error;
+
+    // 操作数所在的槽位
+    int32_t slot(koopa_raw_value_t value);
+    int32_t new_slot(koopa_raw_value_t value);
+    // 为跳转到 target 的实参生成跳转指令
+    void emit_jump(koopa_raw_basic_block_t target, const koopa_raw_slice_t &args);
+    void emit(Code code, int32_t a = 0, int32_t b = 0, int32_t c = 0, int32_t d = 0);
+
+    void Decode(const koopa_raw_function_t &);
+    void Decode(const koopa_raw_basic_block_t &);
+    void Decode(const koopa_raw_value_t &);
+
+public:
+    // 预解码整个程序, 包含不支持的结构时返回 false, error 中记录原因
+    bool Decode(const koopa_raw_program_t &, std::string &error);
+    // 从 @main 开始执行, 运行时错误返回 false
+    bool Run(std::string &error);
+    // @main 的返回值
+    int32_t result() const { return _result; }
+    // 输出返回值, 动态指令总数, 以及每个执行过的基本块的进入次数和动态指令数
+    void Report(Emitter &o) const;
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "koopa.h"
+#include "koopa_cfg.h"
+#include "koopa_optimizer.h"
+#include "koopa_util.h"
+
+// 循环不变量外提
+// 1. 由回边找出自然循环, 从内层到外层依次处理, 内层外提的指令在处理外层时可以继续外提
+// 2. 操作数都在循环外定义或者已经外提的运算是循环不变量, 可能除以零的除法和取模除外
+//    读取的局部变量在循环中没有被写入时, load 同样是循环不变量
+//    地址计算的操作数都不变时是循环不变量, 但从数组元素的 load 不外提, 循环不执行时地址可能越界
+// 3. 不变量按原有顺序移到前置基本块的末尾: 首部在循环外只有一个以 jump 进入的前驱时直接使用该前驱,
+//    否则新建前置基本块, 循环外进入首部的边都改为进入前置基本块, 再由它携带相同的参数跳转到首部
+// 外提的运算和 load 都不会出错, 因此循环一次也不执行时提前计算同样是安全的
+
+namespace {
+    // 除数为 0 和 -1 以外的常量时, 除法和取模不会出错
+    bool is_safe_binary(const koopa_raw_binary_t &binary) {
+        if (binary.op != KOOPA_RBO_DIV && binary.op != KOOPA_RBO_MOD) {
+            return true;
+        }
+        if (binary.rhs->kind.tag != KOOPA_RVT_INTEGER) {
+            return false;
+        }
+        auto divisor = binary.rhs->kind.data.integer.value;
+        return divisor != 0 && divisor != -1;
+    }
+
+    bool is_variable(koopa_raw_value_t value) {
+        return value->kind.tag == KOOPA_RVT_ALLOC || value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC;
+    }
+}
+
+void KoopaOptimizer::hoist_invariants(koopa_raw_function_t func) {
+    ControlFlowGraph cfg(func);
+    auto loops = cfg.natural_loops();
+    if (loops.empty()) {
+        return;
+    }
+    // 参数和指令所在的基本块, 外提后更新为前置基本块
+    std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> owner;
+    for (auto bb : cfg.blocks) {
+        for (uint32_t i = 0; i < bb->params.len; i++) {
+            owner[slice_at<koopa_raw_value_t>(bb->params, i)] = bb;
+        }
+        for (uint32_t i = 0; i < bb->insts.len; i++) {
+            owner[slice_at<koopa_raw_value_t>(bb->insts, i)] = bb;
+        }
+    }
+    // 每个循环中的基本块, 按支配关系的顺序排列, 新建的前置基本块加入所有外层循环
+    std::vector<std::vector<koopa_raw_basic_block_t>> members(loops.size());
+    std::vector<std::unordered_set<koopa_raw_basic_block_t>> member_set(loops.size());
+    for (size_t i = 0; i < loops.size(); i++) {
+        for (auto bb : loops[i].blocks) {
+            members[i].push_back(cfg.blocks[bb]);
+            member_set[i].insert(cfg.blocks[bb]);
+        }
+    }
+    auto &bbs = mutable_function(func)->bbs;
+    std::vector<koopa_raw_basic_block_t> layout;
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        layout.push_back(slice_at<koopa_raw_basic_block_t>(bbs, i));
+    }
+
+    int64_t hoisted = 0, preheaders = 0;
+    for (auto l = loops.size(); l-- > 0;) {
+        auto &loop = loops[l];
+        // 入口基本块没有可以放置不变量的前驱
+        if (loop.header == 0) {
+            continue;
+        }
+        auto header = cfg.blocks[loop.header];
+        auto &in_loop = member_set[l];
+
+        // 循环中被写入的局部变量, 调用时所有 load 都不能外提
+        // 数组元素的地址不会指向局部变量, 写入数组不影响变量的 load
+        std::unordered_set<koopa_raw_value_t> stored;
+        bool clobbered = false;
+        for (auto bb : members[l]) {
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                auto &kind = slice_at<koopa_raw_value_t>(bb->insts, i)->kind;
+                if (kind.tag == KOOPA_RVT_STORE) {
+                    if (is_variable(kind.data.store.dest)) {
+                        stored.insert(kind.data.store.dest);
+                    } else if (!is_address(kind.data.store.dest)) {
+                        clobbered = true;
+                    }
+                } else if (kind.tag == KOOPA_RVT_CALL) {
+                    clobbered = true;
+                }
+            }
+        }
+
+        std::unordered_set<koopa_raw_value_t> invariant;
+        auto is_invariant = [&](koopa_raw_value_t value) {
+            if (invariant.count(value)) {
+                return true;
+            }
+            auto it = owner.find(value);
+            return it == owner.end() || !in_loop.count(it->second);
+        };
+        std::vector<koopa_raw_value_t> hoist;
+        for (auto bb : members[l]) {
+            std::vector<koopa_raw_value_t> kept;
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                auto inst = slice_at<koopa_raw_value_t>(bb->insts, i);
+                auto &kind = inst->kind;
+                bool movable = false;
+                if (kind.tag == KOOPA_RVT_BINARY) {
+                    movable = is_safe_binary(kind.data.binary) &&
+                              is_invariant(kind.data.binary.lhs) && is_invariant(kind.data.binary.rhs);
+                } else if (is_address(inst)) {
+                    movable = is_invariant(address_src(inst)) && is_invariant(address_index(inst));
+                } else if (kind.tag == KOOPA_RVT_LOAD) {
+                    auto src = kind.data.load.src;
+                    movable = !clobbered && is_variable(src) && !stored.count(src);
+                }
+                if (movable) {
+                    invariant.insert(inst);
+                    hoist.push_back(inst);
+                } else {
+                    kept.push_back(inst);
+                }
+            }
+            if (kept.size() < bb->insts.len) {
+                mutable_block(bb)->insts = _builder.make_slice(kept, KOOPA_RSIK_VALUE);
+            }
+        }
+        if (hoist.empty()) {
+            continue;
+        }
+        hoisted += hoist.size();
+
+        std::vector<uint32_t> outside;
+        for (auto pred : cfg.preds[loop.header]) {
+            if (!loop.contains(pred)) {
+                outside.push_back(pred);
+            }
+        }
+        if (outside.size() == 1 && terminator(cfg.blocks[outside[0]])->kind.tag == KOOPA_RVT_JUMP) {
+            // 放在唯一前驱的 jump 之前
+            auto pred = cfg.blocks[outside[0]];
+            std::vector<koopa_raw_value_t> insts;
+            for (uint32_t i = 0; i + 1 < pred->insts.len; i++) {
+                insts.push_back(slice_at<koopa_raw_value_t>(pred->insts, i));
+            }
+            insts.insert(insts.end(), hoist.begin(), hoist.end());
+            insts.push_back(terminator(pred));
+            mutable_block(pred)->insts = _builder.make_slice(insts, KOOPA_RSIK_VALUE);
+            for (auto inst : hoist) {
+                owner[inst] = pred;
+            }
+            continue;
+        }
+
+        // 新建前置基本块, 参数与首部相同
+        auto preheader = _builder.new_block(block_name("preheader"));
+        std::vector<koopa_raw_value_t> params;
+        for (uint32_t i = 0; i < header->params.len; i++) {
+            auto param = _builder.new_value(slice_at<koopa_raw_value_t>(header->params, i)->ty,
+                                            KOOPA_RVT_BLOCK_ARG_REF);
+            param->kind.data.block_arg_ref.index = i;
+            params.push_back(param);
+            owner[param] = preheader;
+        }
+        preheader->params = _builder.make_slice(params, KOOPA_RSIK_VALUE);
+        for (auto inst : hoist) {
+            owner[inst] = preheader;
+        }
+        hoist.push_back(_builder.new_jump(header, params));
+        preheader->insts = _builder.make_slice(hoist, KOOPA_RSIK_VALUE);
+        for (auto pred : outside) {
+            auto &kind = mutable_value(terminator(cfg.blocks[pred]))->kind;
+            if (kind.tag == KOOPA_RVT_JUMP) {
+                kind.data.jump.target = preheader;
+            } else if (kind.tag == KOOPA_RVT_BRANCH) {
+                if (kind.data.branch.true_bb == header) {
+                    kind.data.branch.true_bb = preheader;
+                }
+                if (kind.data.branch.false_bb == header) {
+                    kind.data.branch.false_bb = preheader;
+                }
+            }
+        }
+        layout.insert(std::find(layout.begin(), layout.end(), header), preheader);
+        for (auto outer = loop.parent; outer != UINT32_MAX; outer = loops[outer].parent) {
+            auto &blocks = members[outer];
+            blocks.insert(std::find(blocks.begin(), blocks.end(), header), preheader);
+            member_set[outer].insert(preheader);
+        }
+        preheaders++;
+    }
+    if (preheaders) {
+        bbs = _builder.make_slice(layout, KOOPA_RSIK_BASIC_BLOCK);
+    }
+    count("hoisted instructions", hoisted);
+    count("preheaders", preheaders);
+}
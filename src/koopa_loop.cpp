@@ -0,0 +1,496 @@
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "koopa.h"
+#include "koopa_cfg.h"
+#include "koopa_optimizer.h"
+#include "koopa_util.h"
+
+// 归纳变量的强度削弱和循环展开
+// 只处理基本形式的循环: 首部在循环外只有一个以 jump 进入的前驱 (前置基本块), 回边都是 jump
+// 基本归纳变量: 首部的参数 p, 每条回边传入的实参都是 p + s, s 为非零常量
+// 派生归纳变量: 循环中每次迭代都执行的 p * k, k 为循环不变量
+//
+// 强度削弱: p * k 改为首部的新参数 q, 前置基本块传入 init * k, 每条回边传入 q + s * k
+// 循环展开: 只处理首部为 "比较 p 与不变量, 分支到循环体或出口" 且循环体只有一个基本块的循环
+//   %unroll(P):         原循环条件成立且剩余距离足够执行 factor 次时进入展开的循环体, 否则进入原循环
+//     c = lt p, n
+//     d = sub n, p
+//     g = gt d, (factor - 1) * s
+//     e = and c, g
+//     br e, %unroll_body, %unroll_exit
+//   %unroll_body:       循环体的 factor 个副本, 之后跳转回 %unroll
+//   %unroll_exit:       jump %header(P), 原循环作为剩余迭代的循环
+// p >= n 时 n - p 可能溢出为正数, 因此同时要求原循环条件成立
+// 原循环中 p 不会溢出, 因此 p < n 时 n - p 的数学值为正数, 超过 i32 范围时回绕为负数, 只会进入原循环
+
+namespace {
+    // 展开后循环体的最大指令数
+    constexpr size_t max_unrolled_insts = 64;
+
+    bool is_power_of_two(int64_t n) {
+        return n > 0 && !(n & (n - 1));
+    }
+
+    // 只有一个前置基本块且回边都是 jump 的循环
+    struct LoopShape {
+        koopa_raw_basic_block_t header = nullptr;
+        koopa_raw_basic_block_t preheader = nullptr;
+        // 循环中跳转到首部的基本块
+        std::vector<koopa_raw_basic_block_t> latches;
+        std::unordered_set<koopa_raw_basic_block_t> blocks;
+    };
+
+    bool get_shape(const ControlFlowGraph &cfg, const Loop &loop, LoopShape &shape) {
+        if (loop.header == 0) {
+            return false;
+        }
+        shape.header = cfg.blocks[loop.header];
+        for (auto bb : loop.blocks) {
+            shape.blocks.insert(cfg.blocks[bb]);
+        }
+        for (auto pred : cfg.preds[loop.header]) {
+            auto bb = cfg.blocks[pred];
+            if (terminator(bb)->kind.tag != KOOPA_RVT_JUMP) {
+                return false;
+            }
+            if (loop.contains(pred)) {
+                shape.latches.push_back(bb);
+            } else if (shape.preheader) {
+                return false;
+            } else {
+                shape.preheader = bb;
+            }
+        }
+        return shape.preheader != nullptr;
+    }
+
+    // 跳转传给首部第 index 个参数的实参
+    koopa_raw_value_t jump_arg(koopa_raw_basic_block_t bb, uint32_t index) {
+        return slice_at<koopa_raw_value_t>(terminator(bb)->kind.data.jump.args, index);
+    }
+
+    // 基本归纳变量
+    struct InductionVar {
+        koopa_raw_value_t param;
+        koopa_raw_value_t init;
+        int32_t step;
+    };
+
+    // value 是否为 p + s, 返回 s, 不是时返回 0
+    int32_t step_of(koopa_raw_value_t value, koopa_raw_value_t p) {
+        if (value->kind.tag != KOOPA_RVT_BINARY) {
+            return 0;
+        }
+        auto &binary = value->kind.data.binary;
+        auto constant = [](koopa_raw_value_t v) {
+            return v->kind.tag == KOOPA_RVT_INTEGER ? v->kind.data.integer.value : 0;
+        };
+        if (binary.op == KOOPA_RBO_ADD && binary.lhs == p) {
+            return constant(binary.rhs);
+        }
+        if (binary.op == KOOPA_RBO_ADD && binary.rhs == p) {
+            return constant(binary.lhs);
+        }
+        if (binary.op == KOOPA_RBO_SUB && binary.lhs == p && constant(binary.rhs) != INT32_MIN) {
+            return -constant(binary.rhs);
+        }
+        return 0;
+    }
+
+    std::unordered_map<koopa_raw_value_t, InductionVar> find_induction_vars(const LoopShape &shape) {
+        std::unordered_map<koopa_raw_value_t, InductionVar> ivs;
+        auto header = shape.header;
+        for (uint32_t i = 0; i < header->params.len; i++) {
+            auto param = slice_at<koopa_raw_value_t>(header->params, i);
+            int32_t step = 0;
+            for (auto latch : shape.latches) {
+                auto s = step_of(jump_arg(latch, i), param);
+                if (!s || (step && s != step)) {
+                    step = 0;
+                    break;
+                }
+                step = s;
+            }
+            if (step) {
+                ivs[param] = {param, jump_arg(shape.preheader, i), step};
+            }
+        }
+        return ivs;
+    }
+
+    // 不属于任何基本块的二元运算
+    koopa_raw_value_data_t *new_binary(KoopaBuilder &builder, koopa_raw_binary_op_t op,
+                                       koopa_raw_value_t lhs, koopa_raw_value_t rhs) {
+        auto value = builder.new_value(builder.i32_type(), KOOPA_RVT_BINARY);
+        value->kind.data.binary.op = op;
+        value->kind.data.binary.lhs = lhs;
+        value->kind.data.binary.rhs = rhs;
+        return value;
+    }
+
+    // 参数和指令所在的基本块
+    std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> value_owners(const ControlFlowGraph &cfg) {
+        std::unordered_map<koopa_raw_value_t, koopa_raw_basic_block_t> owner;
+        for (auto bb : cfg.blocks) {
+            for (uint32_t i = 0; i < bb->params.len; i++) {
+                owner[slice_at<koopa_raw_value_t>(bb->params, i)] = bb;
+            }
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                owner[slice_at<koopa_raw_value_t>(bb->insts, i)] = bb;
+            }
+        }
+        return owner;
+    }
+
+    // 在基本块的结束指令之前插入指令
+    std::vector<koopa_raw_value_t> insts_with(koopa_raw_basic_block_t bb, const std::vector<koopa_raw_value_t> &extra) {
+        std::vector<koopa_raw_value_t> insts;
+        for (uint32_t i = 0; i + 1 < bb->insts.len; i++) {
+            insts.push_back(slice_at<koopa_raw_value_t>(bb->insts, i));
+        }
+        insts.insert(insts.end(), extra.begin(), extra.end());
+        insts.push_back(terminator(bb));
+        return insts;
+    }
+}
+
+void KoopaOptimizer::reduce_induction_vars(koopa_raw_function_t func) {
+    ControlFlowGraph cfg(func);
+    auto loops = cfg.natural_loops();
+    if (loops.empty()) {
+        return;
+    }
+    auto owner = value_owners(cfg);
+    // 被替换的乘法到新参数的映射
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+    for (auto &loop : loops) {
+        LoopShape shape;
+        if (!get_shape(cfg, loop, shape)) {
+            continue;
+        }
+        auto ivs = find_induction_vars(shape);
+        if (ivs.empty()) {
+            continue;
+        }
+        auto is_invariant = [&](koopa_raw_value_t value) {
+            auto it = owner.find(value);
+            return it == owner.end() || !shape.blocks.count(it->second);
+        };
+        // 同一个归纳变量乘以同一个值只新建一个参数
+        std::vector<std::pair<std::pair<koopa_raw_value_t, koopa_raw_value_t>, koopa_raw_value_t>> derived;
+        std::vector<koopa_raw_value_t> in_preheader;
+        std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_value_t>> in_latch;
+        std::vector<koopa_raw_value_t> params, init_args;
+        for (auto bb : loop.blocks) {
+            // 只削弱每次迭代都执行的乘法, 否则每次迭代的加法可能比原来更多
+            bool every_iteration = true;
+            for (auto latch : loop.latches) {
+                every_iteration &= cfg.dominates(bb, latch);
+            }
+            if (!every_iteration) {
+                continue;
+            }
+            auto block = cfg.blocks[bb];
+            for (uint32_t i = 0; i < block->insts.len; i++) {
+                auto inst = slice_at<koopa_raw_value_t>(block->insts, i);
+                if (inst->kind.tag != KOOPA_RVT_BINARY || inst->kind.data.binary.op != KOOPA_RBO_MUL ||
+                    replace.count(inst)) {
+                    continue;
+                }
+                auto p = inst->kind.data.binary.lhs, k = inst->kind.data.binary.rhs;
+                if (!ivs.count(p)) {
+                    std::swap(p, k);
+                }
+                if (!ivs.count(p) || !is_invariant(k)) {
+                    continue;
+                }
+                // 乘以 0, ±1 和 2 的幂次的代价不高于加法
+                if (k->kind.tag == KOOPA_RVT_INTEGER) {
+                    int64_t c = k->kind.data.integer.value;
+                    if (c == 0 || is_power_of_two(c < 0 ? -c : c)) {
+                        continue;
+                    }
+                }
+                koopa_raw_value_t q = nullptr;
+                for (auto &item : derived) {
+                    if (item.first.first == p && item.first.second == k) {
+                        q = item.second;
+                    }
+                }
+                if (!q) {
+                    auto &iv = ivs.at(p);
+                    // 初值 init * k 和步长 s * k, 常量直接计算
+                    koopa_raw_value_t init, step;
+                    int32_t folded;
+                    if (iv.init->kind.tag == KOOPA_RVT_INTEGER && k->kind.tag == KOOPA_RVT_INTEGER &&
+                        fold_binary(KOOPA_RBO_MUL, iv.init->kind.data.integer.value,
+                                    k->kind.data.integer.value, folded)) {
+                        init = _builder.integer(folded);
+                    } else {
+                        init = new_binary(_builder, KOOPA_RBO_MUL, iv.init, k);
+                        in_preheader.push_back(init);
+                    }
+                    if (k->kind.tag == KOOPA_RVT_INTEGER) {
+                        fold_binary(KOOPA_RBO_MUL, iv.step, k->kind.data.integer.value, folded);
+                        step = _builder.integer(folded);
+                    } else if (iv.step == 1) {
+                        step = k;
+                    } else {
+                        step = new_binary(_builder, KOOPA_RBO_MUL, k, _builder.integer(iv.step));
+                        in_preheader.push_back(step);
+                    }
+                    auto param = _builder.new_value(_builder.i32_type(), KOOPA_RVT_BLOCK_ARG_REF);
+                    param->kind.data.block_arg_ref.index = shape.header->params.len + params.size();
+                    params.push_back(param);
+                    init_args.push_back(init);
+                    for (auto latch : shape.latches) {
+                        in_latch[latch].push_back(new_binary(_builder, KOOPA_RBO_ADD, param, step));
+                    }
+                    q = param;
+                    derived.push_back({{p, k}, q});
+                }
+                replace[inst] = q;
+            }
+        }
+        if (derived.empty()) {
+            continue;
+        }
+        // 追加首部参数, 以及前置基本块和回边的实参
+        auto append_args = [&](koopa_raw_basic_block_t bb, const std::vector<koopa_raw_value_t> &extra) {
+            auto &args = mutable_value(terminator(bb))->kind.data.jump.args;
+            std::vector<koopa_raw_value_t> all;
+            for (uint32_t i = 0; i < args.len; i++) {
+                all.push_back(slice_at<koopa_raw_value_t>(args, i));
+            }
+            all.insert(all.end(), extra.begin(), extra.end());
+            args = _builder.make_slice(all, KOOPA_RSIK_VALUE);
+        };
+        std::vector<koopa_raw_value_t> header_params;
+        for (uint32_t i = 0; i < shape.header->params.len; i++) {
+            header_params.push_back(slice_at<koopa_raw_value_t>(shape.header->params, i));
+        }
+        header_params.insert(header_params.end(), params.begin(), params.end());
+        mutable_block(shape.header)->params = _builder.make_slice(header_params, KOOPA_RSIK_VALUE);
+        mutable_block(shape.preheader)->insts =
+            _builder.make_slice(insts_with(shape.preheader, in_preheader), KOOPA_RSIK_VALUE);
+        append_args(shape.preheader, init_args);
+        for (auto inst : in_preheader) {
+            owner[inst] = shape.preheader;
+        }
+        for (auto latch : shape.latches) {
+            auto &next = in_latch[latch];
+            mutable_block(latch)->insts = _builder.make_slice(insts_with(latch, next), KOOPA_RSIK_VALUE);
+            append_args(latch, next);
+            for (auto inst : next) {
+                owner[inst] = latch;
+            }
+        }
+        count("reduced multiplies", derived.size());
+    }
+    if (replace.empty()) {
+        return;
+    }
+
+    // 删除被替换的乘法, 替换所有的使用
+    auto &bbs = func->bbs;
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+        std::vector<koopa_raw_value_t> insts;
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            if (replace.count(inst)) {
+                continue;
+            }
+            for_each_operand_ref(inst, [&](koopa_raw_value_t &operand) {
+                auto it = replace.find(operand);
+                if (it != replace.end()) {
+                    operand = it->second;
+                }
+            });
+            insts.push_back(inst);
+        }
+        if (insts.size() < bb->insts.len) {
+            mutable_block(bb)->insts = _builder.make_slice(insts, KOOPA_RSIK_VALUE);
+        }
+    }
+}
+
+void KoopaOptimizer::unroll_loops(koopa_raw_function_t func) {
+    if (_unroll < 2) {
+        return;
+    }
+    ControlFlowGraph cfg(func);
+    auto loops = cfg.natural_loops();
+    if (loops.empty()) {
+        return;
+    }
+    // 每个值的使用次数, 用于确认比较的结果只被分支使用
+    std::unordered_map<koopa_raw_value_t, int> uses;
+    auto owner = value_owners(cfg);
+    for (auto bb : cfg.blocks) {
+        for (uint32_t i = 0; i < bb->insts.len; i++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, i);
+            for_each_operand(inst, [&](koopa_raw_value_t operand) {
+                uses[operand]++;
+            });
+        }
+    }
+    auto &bbs = mutable_function(func)->bbs;
+    std::vector<koopa_raw_basic_block_t> layout;
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        layout.push_back(slice_at<koopa_raw_basic_block_t>(bbs, i));
+    }
+
+    int64_t unrolled = 0;
+    for (auto &loop : loops) {
+        LoopShape shape;
+        if (loop.blocks.size() != 2 || !get_shape(cfg, loop, shape) || shape.latches.size() != 1) {
+            continue;
+        }
+        auto header = shape.header, body = shape.latches[0];
+        if (header->insts.len != 2 || body == header) {
+            continue;
+        }
+        // 首部只有比较和分支, 比较的结果只被分支使用
+        auto cmp = slice_at<koopa_raw_value_t>(header->insts, 0);
+        auto br = terminator(header);
+        if (cmp->kind.tag != KOOPA_RVT_BINARY || br->kind.tag != KOOPA_RVT_BRANCH ||
+            br->kind.data.branch.cond != cmp || br->kind.data.branch.true_bb != body || uses[cmp] != 1) {
+            continue;
+        }
+        auto body_size = body->insts.len - 1;
+        if (body_size * _unroll > max_unrolled_insts) {
+            continue;
+        }
+        bool clonable = true;
+        for (uint32_t i = 0; i < body_size; i++) {
+            auto tag = slice_at<koopa_raw_value_t>(body->insts, i)->kind.tag;
+            clonable &= tag == KOOPA_RVT_BINARY || tag == KOOPA_RVT_LOAD || tag == KOOPA_RVT_STORE ||
+                        tag == KOOPA_RVT_GET_PTR || tag == KOOPA_RVT_GET_ELEM_PTR;
+        }
+        if (!clonable) {
+            continue;
+        }
+
+        // 比较化为 p < n, p <= n (s > 0) 或 p > n, p >= n (s < 0) 的形式
+        auto ivs = find_induction_vars(shape);
+        auto op = cmp->kind.data.binary.op;
+        auto p = cmp->kind.data.binary.lhs, n = cmp->kind.data.binary.rhs;
+        if (!ivs.count(p)) {
+            std::swap(p, n);
+            switch (op) {
+                case KOOPA_RBO_LT: op = KOOPA_RBO_GT; break;
+                case KOOPA_RBO_GT: op = KOOPA_RBO_LT; break;
+                case KOOPA_RBO_LE: op = KOOPA_RBO_GE; break;
+                case KOOPA_RBO_GE: op = KOOPA_RBO_LE; break;
+                default: break;
+            }
+        }
+        auto it = ivs.find(p);
+        auto defined = owner.find(n);
+        if (it == ivs.end() || (defined != owner.end() && shape.blocks.count(defined->second))) {
+            continue;
+        }
+        int64_t step = it->second.step;
+        bool increasing = op == KOOPA_RBO_LT || op == KOOPA_RBO_LE;
+        bool decreasing = op == KOOPA_RBO_GT || op == KOOPA_RBO_GE;
+        if (!(increasing && step > 0) && !(decreasing && step < 0)) {
+            continue;
+        }
+        int64_t distance = (_unroll - 1) * (step < 0 ? -step : step);
+        if (distance > INT32_MAX) {
+            continue;
+        }
+        // 常量次数的循环执行次数不足 factor 次时不展开
+        auto init = it->second.init;
+        if (init->kind.tag == KOOPA_RVT_INTEGER && n->kind.tag == KOOPA_RVT_INTEGER) {
+            int64_t a = init->kind.data.integer.value, b = n->kind.data.integer.value;
+            int64_t remain = increasing ? b - a : a - b;
+            if (op == KOOPA_RBO_LE || op == KOOPA_RBO_GE) {
+                remain++;
+            }
+            if (remain <= distance) {
+                continue;
+            }
+        }
+
+        auto unroll = _builder.new_block(block_name("unroll"));
+        auto unroll_body = _builder.new_block(block_name("unroll_body"));
+        auto unroll_exit = _builder.new_block(block_name("unroll_exit"));
+        std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> map;
+        std::vector<koopa_raw_value_t> params;
+        for (uint32_t i = 0; i < header->params.len; i++) {
+            auto param = slice_at<koopa_raw_value_t>(header->params, i);
+            auto copy = _builder.new_value(param->ty, KOOPA_RVT_BLOCK_ARG_REF);
+            copy->kind.data.block_arg_ref.index = i;
+            params.push_back(copy);
+            map[param] = copy;
+        }
+        unroll->params = _builder.make_slice(params, KOOPA_RSIK_VALUE);
+        auto remap = [&](koopa_raw_value_t &value) {
+            auto found = map.find(value);
+            if (found != map.end()) {
+                value = found->second;
+            }
+        };
+
+        // 原循环条件和剩余距离的判断
+        auto c = new_binary(_builder, op, map.at(p), n);
+        auto d = increasing ? new_binary(_builder, KOOPA_RBO_SUB, n, map.at(p))
+                            : new_binary(_builder, KOOPA_RBO_SUB, map.at(p), n);
+        bool inclusive = op == KOOPA_RBO_LE || op == KOOPA_RBO_GE;
+        auto g = new_binary(_builder, inclusive ? KOOPA_RBO_GE : KOOPA_RBO_GT, d,
+                            _builder.integer(static_cast<int32_t>(distance)));
+        auto e = new_binary(_builder, KOOPA_RBO_AND, c, g);
+        auto guard = _builder.new_value(_builder.unit_type(), KOOPA_RVT_BRANCH);
+        auto &branch = guard->kind.data.branch;
+        branch.cond = e;
+        branch.true_bb = unroll_body;
+        branch.false_bb = unroll_exit;
+        branch.true_args = _builder.empty_slice(KOOPA_RSIK_VALUE);
+        branch.false_args = _builder.empty_slice(KOOPA_RSIK_VALUE);
+        std::vector<koopa_raw_value_t> guard_insts = {c, d, g, e, guard};
+        unroll->insts = _builder.make_slice(guard_insts, KOOPA_RSIK_VALUE);
+        std::vector<koopa_raw_value_t> exit_insts = {_builder.new_jump(header, params)};
+        unroll_exit->insts = _builder.make_slice(exit_insts, KOOPA_RSIK_VALUE);
+
+        // 循环体的副本, 每个副本中首部参数替换为上一个副本传给首部的实参
+        std::vector<koopa_raw_value_t> insts, next;
+        for (int copy = 0; copy < _unroll; copy++) {
+            for (uint32_t i = 0; i < body_size; i++) {
+                auto inst = slice_at<koopa_raw_value_t>(body->insts, i);
+                auto clone = _builder.new_value(inst->ty, inst->kind.tag);
+                clone->kind = inst->kind;
+                for_each_operand_ref(clone, remap);
+                map[inst] = clone;
+                insts.push_back(clone);
+            }
+            next.clear();
+            for (uint32_t i = 0; i < header->params.len; i++) {
+                auto arg = jump_arg(body, i);
+                remap(arg);
+                next.push_back(arg);
+            }
+            for (uint32_t i = 0; i < header->params.len; i++) {
+                map[slice_at<koopa_raw_value_t>(header->params, i)] = next[i];
+            }
+        }
+        insts.push_back(_builder.new_jump(unroll, next));
+        unroll_body->insts = _builder.make_slice(insts, KOOPA_RSIK_VALUE);
+
+        mutable_value(terminator(shape.preheader))->kind.data.jump.target = unroll;
+        auto pos = layout.begin();
+        while (*pos != header) {
+            ++pos;
+        }
+        layout.insert(pos, {unroll, unroll_body, unroll_exit});
+        unrolled++;
+    }
+    if (unrolled) {
+        bbs = _builder.make_slice(layout, KOOPA_RSIK_BASIC_BLOCK);
+    }
+    count("unrolled loops", unrolled);
+}
@@ -0,0 +1,314 @@
+#include <cassert>
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+#include "koopa_cfg.h"
+#include "koopa_optimizer.h"
+#include "koopa_util.h"
+
+// mem2reg
+// 1. 找出只作为 load 的来源和 store 的目标使用的局部变量
+// 2. 在可达的基本块上求变量的活跃性, 在定义所在基本块的迭代支配边界中, 变量活跃的位置放置参数
+// 3. 沿支配树重命名: load 替换为当前的值, store 更新当前的值, 跳转时将当前的值作为实参传递
+// 不可达的基本块不参与重命名, 其中的 load 视为未初始化, 替换为 0
+
+void KoopaOptimizer::promote_memory(koopa_raw_function_t func) {
+    // 可以提升的变量
+    std::unordered_map<koopa_raw_value_t, uint32_t> var_index;
+    std::vector<koopa_raw_value_t> vars;
+    auto &bbs = func->bbs;
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            // 整数和指针 (数组形参) 变量可以提升, 数组留在内存中
+            if (inst->kind.tag == KOOPA_RVT_ALLOC && inst->ty->data.pointer.base->tag != KOOPA_RTT_ARRAY) {
+                var_index[inst] = vars.size();
+                vars.push_back(inst);
+            }
+        }
+    }
+    // 作为其他指令的操作数 (例如被存储的值) 时地址逃逸, 不能提升
+    std::vector<bool> escaped(vars.size());
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            for_each_operand(inst, [&](koopa_raw_value_t operand) {
+                auto it = var_index.find(operand);
+                if (it == var_index.end()) {
+                    return;
+                }
+                auto &kind = inst->kind;
+                bool access = kind.tag == KOOPA_RVT_LOAD ||
+                              (kind.tag == KOOPA_RVT_STORE && kind.data.store.value != operand);
+                if (!access) {
+                    escaped[it->second] = true;
+                }
+            });
+        }
+    }
+    {
+        std::vector<koopa_raw_value_t> promoted;
+        for (uint32_t i = 0; i < vars.size(); i++) {
+            if (!escaped[i]) {
+                var_index[vars[i]] = promoted.size();
+                promoted.push_back(vars[i]);
+            } else {
+                var_index.erase(vars[i]);
+            }
+        }
+        vars.swap(promoted);
+    }
+    if (vars.empty()) {
+        return;
+    }
+    auto var_of = [&](koopa_raw_value_t ptr) -> int64_t {
+        auto it = var_index.find(ptr);
+        return it == var_index.end() ? -1 : static_cast<int64_t>(it->second);
+    };
+
+    ControlFlowGraph cfg(func);
+    auto n = cfg.blocks.size();
+    auto m = vars.size();
+
+    // 基本块内定义的变量, 以及定义之前就被读取的变量
+    std::vector<BitSet> defs(n, BitSet(m)), uses(n, BitSet(m));
+    for (uint32_t i = 0; i < n; i++) {
+        auto bb = cfg.blocks[i];
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            auto &kind = inst->kind;
+            if (kind.tag == KOOPA_RVT_LOAD) {
+                auto var = var_of(kind.data.load.src);
+                if (var >= 0 && !defs[i].test(var)) {
+                    uses[i].set(var);
+                }
+            } else if (kind.tag == KOOPA_RVT_STORE) {
+                auto var = var_of(kind.data.store.dest);
+                if (var >= 0) {
+                    defs[i].set(var);
+                }
+            }
+        }
+    }
+    // 变量的活跃性, 只在活跃的位置放置参数 (剪枝 SSA)
+    std::vector<BitSet> live_in(uses), live_out(n, BitSet(m));
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (uint32_t i = n; i-- > 0;) {
+            for (auto succ : cfg.succs[i]) {
+                live_out[i].merge(live_in[succ]);
+            }
+            changed |= live_in[i].merge(live_out[i], &defs[i]);
+        }
+    }
+
+    // 在迭代支配边界中放置参数, phis[b] 为基本块 b 新增参数对应的变量
+    auto frontiers = cfg.dominance_frontiers();
+    std::vector<std::vector<uint32_t>> phis(n);
+    std::vector<int64_t> placed(n, -1), queued(n, -1);
+    for (uint32_t var = 0; var < m; var++) {
+        std::vector<uint32_t> worklist;
+        for (uint32_t i = 0; i < n; i++) {
+            if (defs[i].test(var)) {
+                worklist.push_back(i);
+                queued[i] = var;
+            }
+        }
+        while (!worklist.empty()) {
+            auto block = worklist.back();
+            worklist.pop_back();
+            for (auto frontier : frontiers[block]) {
+                if (placed[frontier] == var || !live_in[frontier].test(var)) {
+                    continue;
+                }
+                placed[frontier] = var;
+                phis[frontier].push_back(var);
+                if (queued[frontier] != var) {
+                    queued[frontier] = var;
+                    worklist.push_back(frontier);
+                }
+            }
+        }
+    }
+
+    // 创建基本块参数, 追加在已有参数之后
+    std::vector<std::vector<koopa_raw_value_t>> params(n);
+    int64_t param_count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (phis[i].empty()) {
+            continue;
+        }
+        auto bb = mutable_block(cfg.blocks[i]);
+        std::vector<koopa_raw_value_t> all;
+        for (uint32_t j = 0; j < bb->params.len; j++) {
+            all.push_back(slice_at<koopa_raw_value_t>(bb->params, j));
+        }
+        for (size_t j = 0; j < phis[i].size(); j++) {
+            auto param = _builder.new_value(vars[phis[i][j]]->ty->data.pointer.base, KOOPA_RVT_BLOCK_ARG_REF);
+            param->kind.data.block_arg_ref.index = all.size();
+            params[i].push_back(param);
+            all.push_back(param);
+        }
+        bb->params = _builder.make_slice(all, KOOPA_RSIK_VALUE);
+        param_count += phis[i].size();
+    }
+
+    // 被删除的 load 到替代值的映射
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+    auto resolve = [&](koopa_raw_value_t &value) {
+        auto it = replace.find(value);
+        if (it != replace.end()) {
+            value = it->second;
+        }
+    };
+    auto zero = _builder.integer(0);
+    // 新建的边基本块, 放在前驱之后
+    std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_basic_block_t>> edge_blocks;
+
+    // 为跳转到 target 的边追加实参, 分支指令的边拆分出新的基本块
+    auto add_args = [&](koopa_raw_basic_block_t bb, koopa_raw_basic_block_t &target,
+                        const std::vector<koopa_raw_value_t> &extra, bool is_jump) {
+        if (extra.empty()) {
+            return;
+        }
+        if (is_jump) {
+            auto &jump = mutable_value(terminator(bb))->kind.data.jump;
+            std::vector<koopa_raw_value_t> args;
+            for (uint32_t i = 0; i < jump.args.len; i++) {
+                args.push_back(slice_at<koopa_raw_value_t>(jump.args, i));
+            }
+            args.insert(args.end(), extra.begin(), extra.end());
+            jump.args = _builder.make_slice(args, KOOPA_RSIK_VALUE);
+            return;
+        }
+        auto edge = _builder.new_block(block_name("edge"));
+        std::vector<koopa_raw_value_t> insts = {_builder.new_jump(target, extra)};
+        edge->insts = _builder.make_slice(insts, KOOPA_RSIK_VALUE);
+        edge_blocks[bb].push_back(edge);
+        target = edge;
+    };
+    // 结束指令到每个后继的实参
+    auto pass_args = [&](koopa_raw_basic_block_t bb, auto &&value_of) {
+        auto &kind = mutable_value(terminator(bb))->kind;
+        auto args_for = [&](koopa_raw_basic_block_t target) {
+            std::vector<koopa_raw_value_t> args;
+            auto it = cfg.index.find(target);
+            if (it != cfg.index.end()) {
+                for (auto var : phis[it->second]) {
+                    args.push_back(value_of(var));
+                }
+            }
+            return args;
+        };
+        if (kind.tag == KOOPA_RVT_JUMP) {
+            add_args(bb, kind.data.jump.target, args_for(kind.data.jump.target), true);
+        } else if (kind.tag == KOOPA_RVT_BRANCH) {
+            auto &branch = kind.data.branch;
+            // 两个目标相同时拆分出的基本块不同, 先计算实参再修改目标
+            auto true_args = args_for(branch.true_bb);
+            auto false_args = args_for(branch.false_bb);
+            add_args(bb, branch.true_bb, true_args, false);
+            add_args(bb, branch.false_bb, false_args, false);
+        }
+    };
+
+    // 重写基本块中的指令, current 为各变量当前的值
+    int64_t removed = 0;
+    auto rewrite = [&](koopa_raw_basic_block_t bb, std::vector<koopa_raw_value_t> &current,
+                       std::vector<std::pair<uint32_t, koopa_raw_value_t>> *log) {
+        std::vector<koopa_raw_value_t> insts;
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            for_each_operand_ref(inst, resolve);
+            auto &kind = inst->kind;
+            if (kind.tag == KOOPA_RVT_ALLOC && var_of(inst) >= 0) {
+                continue;
+            }
+            if (kind.tag == KOOPA_RVT_LOAD && var_of(kind.data.load.src) >= 0) {
+                auto value = current[var_of(kind.data.load.src)];
+                replace[inst] = value ? value : zero;
+                removed++;
+                continue;
+            }
+            if (kind.tag == KOOPA_RVT_STORE && var_of(kind.data.store.dest) >= 0) {
+                auto var = var_of(kind.data.store.dest);
+                if (log) {
+                    log->push_back({var, current[var]});
+                }
+                current[var] = kind.data.store.value;
+                removed++;
+                continue;
+            }
+            insts.push_back(inst);
+        }
+        mutable_block(bb)->insts = _builder.make_slice(insts, KOOPA_RSIK_VALUE);
+    };
+
+    // 沿支配树重命名, 使用显式栈避免过深的递归
+    std::vector<koopa_raw_value_t> current(m, nullptr);
+    std::vector<std::pair<uint32_t, koopa_raw_value_t>> log;
+    struct Frame {
+        uint32_t block;
+        size_t child;
+        size_t mark;
+    };
+    std::vector<Frame> stack;
+    auto enter = [&](uint32_t block) {
+        stack.push_back({block, 0, log.size()});
+        for (size_t j = 0; j < phis[block].size(); j++) {
+            auto var = phis[block][j];
+            log.push_back({var, current[var]});
+            current[var] = params[block][j];
+        }
+        rewrite(cfg.blocks[block], current, &log);
+        pass_args(cfg.blocks[block], [&](uint32_t var) {
+            return current[var] ? current[var] : zero;
+        });
+    };
+    enter(0);
+    while (!stack.empty()) {
+        auto &frame = stack.back();
+        if (frame.child < cfg.dom_children[frame.block].size()) {
+            enter(cfg.dom_children[frame.block][frame.child++]);
+            continue;
+        }
+        // 离开支配子树时恢复变量的值
+        while (log.size() > frame.mark) {
+            current[log.back().first] = log.back().second;
+            log.pop_back();
+        }
+        stack.pop_back();
+    }
+
+    // 不可达的基本块, 变量的值均视为未初始化
+    std::vector<koopa_raw_value_t> undefined(m, nullptr);
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+        if (cfg.reachable(bb)) {
+            continue;
+        }
+        std::fill(undefined.begin(), undefined.end(), nullptr);
+        rewrite(bb, undefined, nullptr);
+        pass_args(bb, [&](uint32_t) { return zero; });
+    }
+
+    // 将新建的基本块放入布局
+    if (!edge_blocks.empty()) {
+        std::vector<koopa_raw_basic_block_t> layout;
+        for (uint32_t i = 0; i < bbs.len; i++) {
+            auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+            layout.push_back(bb);
+            auto it = edge_blocks.find(bb);
+            if (it != edge_blocks.end()) {
+                layout.insert(layout.end(), it->second.begin(), it->second.end());
+            }
+        }
+        mutable_function(func)->bbs = _builder.make_slice(layout, KOOPA_RSIK_BASIC_BLOCK);
+    }
+
+    count("promoted allocs", m);
+    count("block params", param_count);
+    count("removed loads/stores", removed);
+}
@@ -0,0 +1,83 @@
+#include <cstring>
+#include "koopa_optimizer.h"
+#include "koopa_util.h"
+
+void KoopaOptimizer::count(const char *name, int64_t value) {
+    for (auto &stat : _stats) {
+        if (std::strcmp(stat.first, name) == 0) {
+            stat.second += value;
+            return;
+        }
+    }
+    _stats.emplace_back(name, value);
+}
+
+std::string KoopaOptimizer::block_name(const char *prefix) {
+    return std::string("%") + prefix + "_" + std::to_string(_block_count++);
+}
+
+void KoopaOptimizer::remove_params(koopa_raw_function_t func,
+                                   const std::unordered_map<koopa_raw_basic_block_t, std::vector<bool>> &keep) {
+    if (keep.empty()) {
+        return;
+    }
+    // 过滤 slice, 保留 keep 为 true 的元素
+    auto filter = [&](const koopa_raw_slice_t &slice, const std::vector<bool> &mask) {
+        std::vector<koopa_raw_value_t> kept;
+        for (uint32_t i = 0; i < slice.len; i++) {
+            if (mask[i]) {
+                kept.push_back(slice_at<koopa_raw_value_t>(slice, i));
+            }
+        }
+        return kept;
+    };
+    for (uint32_t i = 0; i < func->bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(func->bbs, i);
+        auto it = keep.find(bb);
+        if (it != keep.end()) {
+            auto params = filter(bb->params, it->second);
+            for (size_t j = 0; j < params.size(); j++) {
+                mutable_value(params[j])->kind.data.block_arg_ref.index = j;
+            }
+            mutable_block(bb)->params = _builder.make_slice(params, KOOPA_RSIK_VALUE);
+        }
+        auto &kind = mutable_value(terminator(bb))->kind;
+        if (kind.tag == KOOPA_RVT_JUMP) {
+            auto target = keep.find(kind.data.jump.target);
+            if (target != keep.end()) {
+                kind.data.jump.args = _builder.make_slice(filter(kind.data.jump.args, target->second),
+                                                          KOOPA_RSIK_VALUE);
+            }
+        }
+    }
+}
+
+void KoopaOptimizer::run(koopa_raw_program_t &program) {
+    for (uint32_t i = 0; i < program.funcs.len; i++) {
+        auto func = slice_at<koopa_raw_function_t>(program.funcs, i);
+        if (!func->bbs.len) {
+            continue;
+        }
+        promote_memory(func);
+        propagate_constants(func);
+        number_values(func);
+        eliminate_dead_code(func);
+        simplify_cfg(func);
+        hoist_invariants(func);
+        if (_vectorize) {
+            vectorize_loops(func);
+        }
+        reduce_induction_vars(func);
+        unroll_loops(func);
+        // 删除强度削弱后不再使用的归纳变量
+        eliminate_dead_code(func);
+    }
+    if (!_kernels.empty()) {
+        std::vector<koopa_raw_function_t> funcs;
+        for (uint32_t i = 0; i < program.funcs.len; i++) {
+            funcs.push_back(slice_at<koopa_raw_function_t>(program.funcs, i));
+        }
+        funcs.insert(funcs.end(), _kernels.begin(), _kernels.end());
+        program.funcs = _builder.make_slice(funcs, KOOPA_RSIK_FUNCTION);
+    }
+}
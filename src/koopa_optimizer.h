@@ -0,0 +1,70 @@
+#ifndef __KOOPA_OPTIMIZER_H__
+#define __KOOPA_OPTIMIZER_H__
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "koopa.h"
+#include "koopa_builder.h"
+
+// raw program 上的优化
+// 直接修改 builder 构建的 raw program, 新增的值, 基本块和 slice 同样分配在 builder 的 arena 中
+// 各个 pass 分别实现在 koopa_<pass>.cpp 中, 由 run 按顺序对每个函数执行
+//
+// pass 之间约定的 IR 形式:
+// - 局部变量提升后, 汇合点的值通过基本块参数传递, 只有 jump 携带实参
+// - 分支指令不携带实参, 需要实参的边拆分为只含一条 jump 的基本块
+class KoopaOptimizer {
+private:
+    KoopaBuilder &_builder;
+    // 循环展开的倍数, 小于 2 时不展开
+    int _unroll;
+    // 是否向量化逐元素的循环
+    bool _vectorize;
+    // 向量化时提取出的函数, 全部函数优化完成后加入程序
+    std::vector<koopa_raw_function_t> _kernels;
+    // 新建基本块的编号, 用于生成不重复的名称
+    int _block_count = 0;
+    // 各 pass 的统计, 按第一次记录的顺序排列
+    std::vector<std::pair<const char*, int64_t>> _stats;
+
+    void count(const char *name, int64_t value);
+    // 新建基本块的名称
+    std::string block_name(const char *prefix);
+    // 删除基本块中 keep 为 false 的参数, 以及所有跳转传给这些参数的实参
+    void remove_params(koopa_raw_function_t func,
+                       const std::unordered_map<koopa_raw_basic_block_t, std::vector<bool>> &keep);
+
+public:
+    explicit KoopaOptimizer(KoopaBuilder &builder, int unroll = 4, bool vectorize = false)
+        : _builder(builder), _unroll(unroll), _vectorize(vectorize) {}
+
+    // 优化整个程序, 向量化提取出的函数追加到程序末尾
+    void run(koopa_raw_program_t &program);
+    const std::vector<std::pair<const char*, int64_t>> &stats() const { return _stats; }
+    // 向量化提取出的函数, 由后端生成 RVV 代码
+    const std::vector<koopa_raw_function_t> &kernels() const { return _kernels; }
+
+    // mem2reg: 将只被 load/store 访问的局部变量提升为 SSA 值, 实现见 koopa_mem2reg.cpp
+    void promote_memory(koopa_raw_function_t func);
+    // 稀疏条件常量传播, 实现见 koopa_sccp.cpp
+    void propagate_constants(koopa_raw_function_t func);
+    // 基于支配树的值编号, 删除公共子表达式, 实现见 koopa_gvn.cpp
+    void number_values(koopa_raw_function_t func);
+    // 删除不可达的基本块和无用的指令, 实现见 koopa_dce.cpp
+    void eliminate_dead_code(koopa_raw_function_t func);
+    // 合并基本块, 穿过空基本块的跳转, 实现见 koopa_simplify.cpp
+    void simplify_cfg(koopa_raw_function_t func);
+    // 循环不变量外提, 实现见 koopa_licm.cpp
+    void hoist_invariants(koopa_raw_function_t func);
+    // 将逐元素的循环提取为由后端生成 RVV 代码的函数, 实现见 koopa_vectorize.cpp
+    void vectorize_loops(koopa_raw_function_t func);
+    // 归纳变量的乘法改为加法, 实现见 koopa_loop.cpp
+    void reduce_induction_vars(koopa_raw_function_t func);
+    // 按 _unroll 倍展开只有一个循环体基本块的计数循环, 实现见 koopa_loop.cpp
+    void unroll_loops(koopa_raw_function_t func);
+};
+
+#endif
@@ -1,26 +1,50 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 #include "koopa.h"
 #include "koopa_parser.h"
+#include "koopa_util.h"
 
-#define Indentation (std::string(indent_level, ' '))
-#define OUT (o << Indentation)
+#define OUT (o.fill(' ', indent_level))
 #define real_name(v) (v->name + 1)
-#define debug(v) (std::cout << v << std::endl)
+// 调试输出只在以 DEBUG_LOG 构建时保留 (make DEBUG_LOG=1), 否则整条语句被编译掉
+#ifdef DEBUG_LOG
+#define debug(v) (std::cerr << v << std::endl)
+#else
+#define debug(v) ((void)0)
+#endif
+
+namespace {
+    // 传递前 8 个参数的寄存器
+    const char *const arg_regs[] = {"a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7"};
+    constexpr uint32_t arg_reg_count = sizeof(arg_regs) / sizeof(arg_regs[0]);
+
+    // 分配指令, 以及由它经过常量下标计算的地址, 相对 sp 的偏移量固定
+    bool in_frame(koopa_raw_value_t value) {
+        if (value->kind.tag == KOOPA_RVT_ALLOC) {
+            return true;
+        }
+        return is_address(value) && address_index(value)->kind.tag == KOOPA_RVT_INTEGER &&
+               in_frame(address_src(value));
+    }
+}
 
 // 程序
 void KoopaParser::Visit(const koopa_raw_program_t &program) {
-    OUT << "Global values:" << std::endl;
+    OUT << "Global values:" << '\n';
     indent_level += 2;
     Visit(program.values);
     indent_level -= 2;
-    OUT << "Functions:" << std::endl;
+    OUT << "Functions:" << '\n';
     indent_level += 2;
     Visit(program.funcs);
     indent_level -= 2;
-    OUT << std::endl;
+    OUT << '\n';
 }
 
 // 组成程序的各种类型的数据组, 如函数, 基本块, 指令等
@@ -68,7 +92,7 @@ void KoopaParser::Visit(const koopa_raw_value_t &value) {
     switch (kind.tag) {
         case KOOPA_RVT_RETURN:
             // 返回指令
-            OUT << "Return" << std::endl;
+            OUT << "Return" << '\n';
             if (kind.data.ret.value) {
                 indent_level += 2;
                 Visit(kind.data.ret.value);
@@ -77,11 +101,11 @@ void KoopaParser::Visit(const koopa_raw_value_t &value) {
             break;
         case KOOPA_RVT_INTEGER:
             // 整数指令
-            OUT << "Integer " << kind.data.integer.value << std::endl;
+            OUT << "Integer " << kind.data.integer.value << '\n';
             break;
         case KOOPA_RVT_BINARY:
             // 二元指令
-            OUT << "Binary " << kind.data.binary.op << std::endl;
+            OUT << "Binary " << kind.data.binary.op << '\n';
             indent_level += 2;
             Visit(kind.data.binary.lhs);
             Visit(kind.data.binary.rhs);
@@ -89,7 +113,7 @@ void KoopaParser::Visit(const koopa_raw_value_t &value) {
             break;
         case KOOPA_RVT_GLOBAL_ALLOC:
             // 全局变量分配指令
-            OUT << "Global alloc " << real_name(value) << std::endl;
+            OUT << "Global alloc " << real_name(value) << '\n';
             break;
         default:
             // 其他类型暂时遇不到
@@ -103,74 +127,99 @@ void KoopaParser::Visit(const koopa_raw_value_t &value) {
 
 // 获取指令在栈中的偏移量
 int KoopaParser::get_offset(const koopa_raw_value_t &value) {
-    std::cout << value->kind.tag << std::endl;
+    debug(value->kind.tag);
     assert(value_map.find(value) != value_map.end() && "value not found");
-    return stack_length - value_map[value];
+    return value_map[value];
 }
 
-// 设置指令在栈中的偏移量
-void KoopaParser::set_offset(const koopa_raw_value_t &value) {
-    value_map[value] = stack_length;
-    stack_length += 4;
+// 栈帧布局, 从低地址到高地址:
+// 调用时在栈上传递的实参, 被调用者保存寄存器和 ra, 打破环的栈槽, 分配指令和溢出的值, 数组
+// 经常访问的保存寄存器和打破环的栈槽放在低地址, 总能以 12 位立即数访问
+void KoopaParser::record_offset(const koopa_raw_function_t &func) {
+    value_map.clear();
+    for (auto &saved : saved_regs) {
+        saved.second = stack_length;
+        stack_length += 4;
+    }
+    // 偏移量超出 12 位立即数时 sw 需要 t0 或 t1 计算地址, 环中的值不能再保存在 t1 中
+    cycle_slot = -1;
+    if (!is_imm12(stack_length + 4 * slot_count)) {
+        cycle_slot = stack_length;
+        stack_length += 4;
+    }
+    for (auto &item : slot_map) {
+        value_map[item.first] = stack_length + 4 * item.second;
+    }
+    stack_length += 4 * slot_count;
+    for (auto array : arrays) {
+        value_map[array] = stack_length;
+        stack_length += type_size(array->ty->data.pointer.base);
+    }
 }
 
-// 遍历记录偏移量
-
-// 指令
-void KoopaParser::record_offset(const koopa_raw_value_t &value) {
-    // 无论是否有返回值, 都记录4字节的偏移量即可
-    set_offset(value);
+// 地址计算在源地址的偏移量上加上下标乘以步长
+int KoopaParser::frame_offset(const koopa_raw_value_t &value) {
+    if (value->kind.tag == KOOPA_RVT_ALLOC) {
+        return get_offset(value);
+    }
+    assert(in_frame(value));
+    return frame_offset(address_src(value)) +
+           address_index(value)->kind.data.integer.value * address_stride(value);
 }
 
-// 基本块
-void KoopaParser::record_offset(const koopa_raw_basic_block_t &bb) {
-    // 访问所有指令
-    auto &slice = bb->insts;
-    assert(slice.kind == KOOPA_RSIK_VALUE);
-    for (int i = 0; i < slice.len; i++) {
-        auto ptr = slice.buffer[i];
-        record_offset(reinterpret_cast<koopa_raw_value_t>(ptr));
+std::pair<const char*, int> KoopaParser::address(const koopa_raw_value_t &ptr, const char *reg) {
+    if (in_frame(ptr)) {
+        return {"sp", frame_offset(ptr)};
     }
+    return {load_value(ptr, reg), 0};
 }
 
-// 函数
-void KoopaParser::record_offset(const koopa_raw_function_t &func) {
-    // 访问所有基本块
-    auto &slice = func->bbs;
-    assert(slice.kind == KOOPA_RSIK_BASIC_BLOCK);
-    for (int i = 0; i < slice.len; i++) {
-        auto ptr = slice.buffer[i];
-        record_offset(reinterpret_cast<koopa_raw_basic_block_t>(ptr));
+// 调整栈指针
+void KoopaParser::adjust_stack(int delta) {
+    if (is_imm12(delta)) {
+        code.addi("sp", "sp", delta);
+    } else {
+        code.li("t0", delta);
+        code.inst(RiscvOp::Add, "sp", "sp", "t0");
     }
 }
 
 // 加载值到寄存器
-void KoopaParser::load_value(const koopa_raw_value_t &value, const std::string &reg) {
+const char* KoopaParser::load_value(const koopa_raw_value_t &value, const char *reg) {
     // 根据指令类型判断后续需要如何访问
     auto &kind = value->kind;
-    switch (kind.tag) {
-        case KOOPA_RVT_INTEGER:
-            // 整数指令
-            o << "li " << reg << ", " << kind.data.integer.value << std::endl;
-            break;
-        default:
-            // 其他类型从栈中加载
-            o << "lw " << reg << ", " << get_offset(value) << "(sp)" << std::endl;
+    if (kind.tag == KOOPA_RVT_INTEGER) {
+        // 整数指令, 0 直接使用 x0
+        if (kind.data.integer.value == 0) {
+            return "x0";
+        }
+        code.li(reg, kind.data.integer.value);
+        return reg;
+    }
+    auto it = reg_map.find(value);
+    if (it != reg_map.end()) {
+        return it->second;
     }
+    // 溢出的值从栈中加载
+    code.lw(reg, get_offset(value));
+    return reg;
 }
 
-// 保存值到栈
-void KoopaParser::store_value(const koopa_raw_value_t &value, const std::string &reg) {
-    // 根据指令类型判断后续需要如何访问
-    auto &kind = value->kind;
-    switch (kind.tag) {
-        case KOOPA_RVT_INTEGER:
-            // 整数指令
-            assert(false);
-            break;
-        default:
-            // 其他类型保存到栈中
-            o << "sw " << reg << ", " << get_offset(value) << "(sp)" << std::endl;
+// 获取写入结果的寄存器
+const char* KoopaParser::result_reg(const koopa_raw_value_t &value, const char *reg) {
+    auto it = reg_map.find(value);
+    return it != reg_map.end() ? it->second : reg;
+}
+
+// 保存结果
+void KoopaParser::store_value(const koopa_raw_value_t &value, const char *reg) {
+    assert(value->kind.tag != KOOPA_RVT_INTEGER);
+    auto it = reg_map.find(value);
+    if (it == reg_map.end()) {
+        // 溢出的值保存到栈中
+        code.sw(reg, get_offset(value));
+    } else if (it->second != reg) {
+        code.inst(RiscvOp::Mv, it->second, reg);
     }
 }
 
@@ -180,12 +229,16 @@ void KoopaParser::store_value(const koopa_raw_value_t &value, const std::string
 void KoopaParser::Compile(const koopa_raw_program_t &program) {
     // 函数
     if (program.funcs.len > 0) {
-        o << ".text" << std::endl;
-        Compile(program.funcs);
+        o << ".text" << '\n';
+        if (jobs > 1 && program.funcs.len > 1) {
+            CompileParallel(program.funcs);
+        } else {
+            Compile(program.funcs);
+        }
     }
     // 全局变量
     if (program.values.len > 0) {
-        o << ".data" << std::endl;
+        o << ".data" << '\n';
         Compile(program.values);
     }
 }
@@ -215,32 +268,121 @@ void KoopaParser::Compile(const koopa_raw_slice_t &slice) {
     }
 }
 
+// 并行编译函数
+// 每个函数由独立的 KoopaParser 编译到独立的缓冲区, 函数间没有共享的可变状态
+// 工作线程按顺序领取函数, 最后按源顺序拼接输出
+void KoopaParser::CompileParallel(const koopa_raw_slice_t &funcs) {
+    assert(funcs.kind == KOOPA_RSIK_FUNCTION);
+    uint32_t count = funcs.len;
+    std::vector<Emitter> outputs(count);
+    std::vector<int64_t> removed(count);
+    std::atomic<uint32_t> next{0};
+    auto worker = [&]() {
+        for (uint32_t i; (i = next++) < count;) {
+            KoopaParser parser(outputs[i], 1, peephole, kernels);
+            parser.Compile(reinterpret_cast<koopa_raw_function_t>(funcs.buffer[i]));
+            removed[i] = parser.peephole_removed;
+        }
+    };
+    // 当前线程也参与编译
+    std::vector<std::thread> pool;
+    int threads = std::min<uint32_t>(jobs, count);
+    for (int i = 1; i < threads; i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : pool) {
+        thread.join();
+    }
+    // 按顺序接入各函数的输出块, 不复制内容
+    for (auto &output : outputs) {
+        o.splice(std::move(output));
+    }
+    for (auto n : removed) {
+        peephole_removed += n;
+    }
+}
+
 // 函数
 void KoopaParser::Compile(const koopa_raw_function_t &func) {
+    // 函数声明没有函数体, 由其他目标文件提供
+    if (!func->bbs.len) {
+        return;
+    }
     // 声明函数
-    o << ".globl " << real_name(func) << std::endl;
+    o << ".globl " << real_name(func) << '\n';
     // 标记入口
-    o << real_name(func) << ":" << std::endl;
-    // 遍历并记录栈偏移量
-    stack_length = 0;
+    o << real_name(func) << ":" << '\n';
+    // 分配寄存器, 再为分配指令和溢出的值记录栈偏移量
+    code.clear();
+    function = func;
+    labels.clear();
+    if (kernels && kernels->count(func)) {
+        CompileVectorKernel(func);
+        code.print(o);
+        return;
+    }
+    find_fused(func);
+    find_folded(func);
+    find_calls(func);
+    allocate_registers(func);
+    // 调用时在栈上传递的实参位于栈帧底部
+    stack_length = outgoing_args;
     record_offset(func);
     // 栈偏移量以16字节为单位向上取值
     int round_up = 16;
     stack_length = (stack_length + round_up - 1) / round_up * round_up;
-    assert(stack_length < 0x800 && stack_length >= -0x800 && "stack overflow");
-    // 保存栈帧
-    o << "addi sp, sp, " << -stack_length << std::endl;
+    // 保存栈帧, 不需要栈空间时省略
+    if (stack_length) {
+        adjust_stack(-stack_length);
+    }
+    for (auto &saved : saved_regs) {
+        code.sw(saved.first, saved.second);
+    }
+    // 形参从 a0-a7 或调用者的栈帧复制到分配的位置, 调用自身的尾调用跳转到此之后
+    std::vector<Move> moves;
+    for (auto param : used_params) {
+        auto index = param->kind.data.func_arg_ref.index;
+        Location src = index < arg_reg_count ? Location{arg_regs[index], 0}
+                                             : Location{nullptr, stack_length + 4 * static_cast<int>(index - arg_reg_count)};
+        auto dest = location(param);
+        if (!(src == dest)) {
+            moves.push_back({dest, nullptr, src});
+        }
+    }
+    parallel_move(std::move(moves));
     // 编译所有基本块
     Compile(func->bbs);
     // 恢复栈帧由返回指令完成
+    // 经过窥孔优化后输出
+    if (peephole) {
+        peephole_removed += code.optimize();
+    }
+    code.print(o);
+}
+
+// 基本块的标签, 加上函数名作为前缀, 不同函数中的同名基本块不会冲突
+const char* KoopaParser::label(const koopa_raw_basic_block_t &bb) {
+    auto &name = labels[bb];
+    if (name.empty()) {
+        name = std::string(real_name(function)) + "." + real_name(bb);
+    }
+    return name.c_str();
 }
 
 // 基本块
 void KoopaParser::Compile(const koopa_raw_basic_block_t &bb) {
     // 标记基本块入口
-    o << real_name(bb) << ":" << std::endl;
-    // 编译所有指令
-    Compile(bb->insts);
+    code.label(label(bb));
+    // 编译所有指令, 尾调用代替其后的 ret
+    for (uint32_t i = 0; i < bb->insts.len; i++) {
+        auto inst = slice_at<koopa_raw_value_t>(bb->insts, i);
+        if (tail_calls.count(inst)) {
+            CompileTailCall(inst);
+            return;
+        }
+        Compile(inst);
+    }
 }
 
 // 指令
@@ -257,8 +399,10 @@ void KoopaParser::Compile(const koopa_raw_value_t &value) {
             o << kind.data.integer.value;
             break;
         case KOOPA_RVT_BINARY:
-            // 二元指令
-            CompileBinary(value);
+            // 二元指令, 与分支合并的比较由分支指令计算
+            if (!fused.count(value)) {
+                CompileBinary(value);
+            }
             break;
         case KOOPA_RVT_ALLOC:
         case KOOPA_RVT_GLOBAL_ALLOC:
@@ -273,14 +417,25 @@ void KoopaParser::Compile(const koopa_raw_value_t &value) {
             // 存储指令
             CompileStore(value);
             break;
+        case KOOPA_RVT_GET_PTR:
+        case KOOPA_RVT_GET_ELEM_PTR:
+            // 地址计算, 合并的地址计算由访存指令使用
+            if (!folded.count(value)) {
+                CompileGetPtr(value);
+            }
+            break;
         case KOOPA_RVT_JUMP:
             // 跳转指令
-            o << "j " << real_name(kind.data.jump.target) << std::endl;
+            CompileJump(value);
             break;
         case KOOPA_RVT_BRANCH:
             // 分支指令
             CompileBranch(value);
             break;
+        case KOOPA_RVT_CALL:
+            // 调用指令
+            CompileCall(value);
+            break;
         default:
             // 其他类型暂时遇不到
             debug(kind.tag);
@@ -293,10 +448,22 @@ void KoopaParser::CompileReturn(const koopa_raw_value_t &value) {
     const koopa_raw_value_kind_t &kind = value->kind;
     auto &ret = kind.data.ret.value;
     if (ret) {
-        load_value(ret, "a0");
+        auto reg = load_value(ret, "a0");
+        if (std::string(reg) != "a0") {
+            code.inst(RiscvOp::Mv, "a0", reg);
+        }
+    }
+    epilogue();
+    code.inst(RiscvOp::Ret, nullptr);
+}
+
+void KoopaParser::epilogue() {
+    for (auto &saved : saved_regs) {
+        code.lw(saved.first, saved.second);
+    }
+    if (stack_length) {
+        adjust_stack(stack_length);
     }
-    o << "addi sp, sp, " << stack_length << std::endl;
-    o << "ret" << std::endl;
 }
 
 void KoopaParser::CompileAlloc(const koopa_raw_value_t &value) {
@@ -319,8 +486,10 @@ void KoopaParser::CompileLoad(const koopa_raw_value_t &value) {
     const koopa_raw_value_kind_t &kind = value->kind;
     auto &load = kind.data.load;
     auto &ptr = load.src;
-    load_value(ptr, "t0");
-    store_value(value, "t0");
+    auto reg = result_reg(value, "t0");
+    auto addr = address(ptr, "t0");
+    code.lw(reg, addr.second, addr.first);
+    store_value(value, reg);
 }
 
 void KoopaParser::CompileStore(const koopa_raw_value_t &value) {
@@ -329,80 +498,506 @@ void KoopaParser::CompileStore(const koopa_raw_value_t &value) {
     auto &store = kind.data.store;
     auto &ptr = store.dest;
     auto &src = store.value;
-    load_value(src, "t0");
-    store_value(ptr, "t0");
+    auto reg = load_value(src, "t0");
+    auto addr = address(ptr, "t1");
+    code.sw(reg, addr.second, addr.first);
+}
+
+// 地址计算: 结果为 src + index * 步长
+// 下标乘以步长的结果放在 t1 中, 源地址在栈帧中时由 sp 计算
+void KoopaParser::CompileGetPtr(const koopa_raw_value_t &value) {
+    debug("CompileGetPtr");
+    auto src = address_src(value), index = address_index(value);
+    int stride = address_stride(value);
+    auto d = result_reg(value, "t0");
+    const char *offset = nullptr;
+    int32_t constant = 0;
+    if (index->kind.tag == KOOPA_RVT_INTEGER) {
+        constant = index->kind.data.integer.value * stride;
+    } else {
+        auto i = load_value(index, "t1");
+        if (!multiply_cheap("t1", i, stride, "t0")) {
+            code.li("t0", stride);
+            code.inst(RiscvOp::Mul, "t1", i, "t0");
+        }
+        offset = "t1";
+    }
+    const char *base;
+    if (in_frame(src)) {
+        constant += frame_offset(src);
+        base = "sp";
+    } else {
+        base = load_value(src, "t0");
+    }
+    if (offset) {
+        code.inst(RiscvOp::Add, d, base, offset);
+        base = d;
+    }
+    if (!constant && base == d) {
+        // 结果已经在 d 中
+    } else if (is_imm12(constant)) {
+        code.addi(d, base, constant);
+    } else {
+        code.li("t1", constant);
+        code.inst(RiscvOp::Add, d, base, "t1");
+    }
+    store_value(value, d);
+}
+
+// 值所在的位置, 寄存器或栈中的偏移量
+KoopaParser::Location KoopaParser::location(const koopa_raw_value_t &value) {
+    auto it = reg_map.find(value);
+    if (it != reg_map.end()) {
+        return {it->second, 0};
+    }
+    return {nullptr, get_offset(value)};
+}
+
+// 将 src 中的值复制到 dest, 栈之间的复制经过 t0
+void KoopaParser::move(const Location &dest, const Location &src) {
+    if (dest.reg && src.reg) {
+        code.inst(RiscvOp::Mv, dest.reg, src.reg);
+    } else if (dest.reg) {
+        code.lw(dest.reg, src.offset);
+    } else {
+        auto reg = src.reg;
+        if (!reg) {
+            code.lw("t0", src.offset);
+            reg = "t0";
+        }
+        code.sw(reg, dest.offset);
+    }
+}
+
+void KoopaParser::push_move(std::vector<Move> &moves, const Location &dest, const koopa_raw_value_t &value) {
+    if (value->kind.tag == KOOPA_RVT_INTEGER) {
+        moves.push_back({dest, value, {}});
+    } else if (!(location(value) == dest)) {
+        moves.push_back({dest, nullptr, location(value)});
+    }
+}
+
+void KoopaParser::parallel_move(std::vector<Move> moves) {
+    while (!moves.empty()) {
+        // 选择目标位置不再被其他传递读取的一项
+        auto ready = std::find_if(moves.begin(), moves.end(), [&](const Move &move) {
+            return std::none_of(moves.begin(), moves.end(), [&](const Move &other) {
+                return &other != &move && !other.constant && other.src == move.dest;
+            });
+        });
+        if (ready == moves.end()) {
+            // 剩余的传递构成环, 先将环中一项的来源保存到 t1, 常量不会出现在环中
+            // 栈帧较大时 t1 可能用于计算地址, 改为保存到栈帧底部的栈槽
+            auto cycle = std::find_if(moves.begin(), moves.end(), [](const Move &move) {
+                return !move.constant;
+            });
+            Location temp = cycle_slot < 0 ? Location{"t1", 0} : Location{nullptr, cycle_slot};
+            move(temp, cycle->src);
+            cycle->src = temp;
+            continue;
+        }
+        if (ready->constant) {
+            auto number = ready->constant->kind.data.integer.value;
+            auto reg = ready->dest.reg ? ready->dest.reg : "t0";
+            code.li(reg, number);
+            if (!ready->dest.reg) {
+                move(ready->dest, {"t0", 0});
+            }
+        } else {
+            move(ready->dest, ready->src);
+        }
+        moves.erase(ready);
+    }
+}
+
+void KoopaParser::CompileJump(const koopa_raw_value_t &value) {
+    debug("CompileJump");
+    auto &jump = value->kind.data.jump;
+    auto &target = jump.target;
+    // 实参到基本块参数的传递是并行赋值: 所有实参都在任何参数被写入之前读取
+    std::vector<Move> moves;
+    assert(jump.args.len == target->params.len && "argument count mismatch");
+    for (uint32_t i = 0; i < jump.args.len; i++) {
+        push_move(moves, location(slice_at<koopa_raw_value_t>(target->params, i)),
+                  slice_at<koopa_raw_value_t>(jump.args, i));
+    }
+    parallel_move(std::move(moves));
+    code.jump(RiscvOp::J, label(target));
+}
+
+// 调用
+// 前 8 个实参通过 a0-a7 传递, 其余依次放在栈帧底部, 同样是并行赋值
+// 寄存器分配保证跨越调用的值都在被调用者保存寄存器或栈中, 调用前后不需要保存其他寄存器
+void KoopaParser::CompileCall(const koopa_raw_value_t &value) {
+    debug("CompileCall");
+    auto &call = value->kind.data.call;
+    std::vector<Move> moves;
+    for (uint32_t i = 0; i < call.args.len; i++) {
+        Location dest = i < arg_reg_count ? Location{arg_regs[i], 0}
+                                          : Location{nullptr, 4 * static_cast<int>(i - arg_reg_count)};
+        push_move(moves, dest, slice_at<koopa_raw_value_t>(call.args, i));
+    }
+    parallel_move(std::move(moves));
+    code.jump(RiscvOp::Call, real_name(call.callee));
+    // 返回值在 a0 中
+    if (is_register_value(value)) {
+        store_value(value, "a0");
+    }
+}
+
+// 尾调用
+// 调用自身时实参直接写入形参的位置, 跳转到序言之后的入口基本块, 不需要重新建立栈帧
+// 调用其他函数时实参都在寄存器中, 先恢复寄存器并释放栈帧, 被调用的函数直接返回到调用者
+void KoopaParser::CompileTailCall(const koopa_raw_value_t &value) {
+    debug("CompileTailCall");
+    auto &call = value->kind.data.call;
+    std::vector<Move> moves;
+    if (call.callee == function) {
+        for (auto param : used_params) {
+            auto index = param->kind.data.func_arg_ref.index;
+            push_move(moves, location(param), slice_at<koopa_raw_value_t>(call.args, index));
+        }
+        parallel_move(std::move(moves));
+        code.jump(RiscvOp::J, label(slice_at<koopa_raw_basic_block_t>(function->bbs, 0)));
+        return;
+    }
+    assert(call.args.len <= arg_reg_count);
+    for (uint32_t i = 0; i < call.args.len; i++) {
+        push_move(moves, {arg_regs[i], 0}, slice_at<koopa_raw_value_t>(call.args, i));
+    }
+    parallel_move(std::move(moves));
+    epilogue();
+    code.jump(RiscvOp::Tail, real_name(call.callee));
+}
+
+namespace {
+    bool is_compare(koopa_raw_binary_op_t op) {
+        switch (op) {
+            case KOOPA_RBO_EQ:
+            case KOOPA_RBO_NOT_EQ:
+            case KOOPA_RBO_LT:
+            case KOOPA_RBO_GT:
+            case KOOPA_RBO_LE:
+            case KOOPA_RBO_GE:
+                return true;
+            default:
+                return false;
+        }
+    }
+}
+
+// 紧接 ret 且 ret 返回其结果或者不返回值的调用是尾调用
+// 调用其他函数时实参必须都能放在寄存器中, 栈上的实参位于调用者的栈帧, 不能在释放栈帧后传递
+// 同理, 栈帧中有数组时, 传递指针的调用不是尾调用, 指针可能指向这些数组
+void KoopaParser::find_calls(const koopa_raw_function_t &func) {
+    tail_calls.clear();
+    has_call = false;
+    outgoing_args = 0;
+    auto passes_frame = [&](const koopa_raw_call_t &call) {
+        if (arrays.empty()) {
+            return false;
+        }
+        for (uint32_t i = 0; i < call.args.len; i++) {
+            if (slice_at<koopa_raw_value_t>(call.args, i)->ty->tag == KOOPA_RTT_POINTER) {
+                return true;
+            }
+        }
+        return false;
+    };
+    for (uint32_t i = 0; i < func->bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(func->bbs, i);
+        auto last = terminator(bb);
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            if (inst->kind.tag != KOOPA_RVT_CALL) {
+                continue;
+            }
+            auto &call = inst->kind.data.call;
+            if (j + 2 == bb->insts.len && last->kind.tag == KOOPA_RVT_RETURN &&
+                (!last->kind.data.ret.value || last->kind.data.ret.value == inst) &&
+                (call.callee == func || call.args.len <= arg_reg_count) && !passes_frame(call)) {
+                tail_calls.insert(inst);
+                continue;
+            }
+            has_call = true;
+            if (call.args.len > arg_reg_count) {
+                outgoing_args = std::max<int>(outgoing_args, 4 * (call.args.len - arg_reg_count));
+            }
+        }
+    }
+}
+
+// 偏移量固定的地址只作为 load/store 的地址或者其他地址计算的源地址使用时不需要计算结果
+// 同时收集栈帧中的数组, 寄存器分配不为它们分配栈槽
+void KoopaParser::find_folded(const koopa_raw_function_t &func) {
+    folded.clear();
+    arrays.clear();
+    std::unordered_set<koopa_raw_value_t> escaped;
+    for (uint32_t i = 0; i < func->bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(func->bbs, i);
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            auto &kind = inst->kind;
+            if (kind.tag == KOOPA_RVT_ALLOC && inst->ty->data.pointer.base->tag == KOOPA_RTT_ARRAY) {
+                arrays.push_back(inst);
+            } else if (is_address(inst) && in_frame(inst)) {
+                folded.insert(inst);
+            }
+            for_each_operand(inst, [&](koopa_raw_value_t operand) {
+                bool access = (kind.tag == KOOPA_RVT_LOAD) ||
+                              (kind.tag == KOOPA_RVT_STORE && kind.data.store.dest == operand &&
+                               kind.data.store.value != operand) ||
+                              (is_address(inst) && address_src(inst) == operand);
+                if (!access) {
+                    escaped.insert(operand);
+                }
+            });
+        }
+    }
+    // 被其他方式使用的地址需要计算结果, 以它为源地址的地址计算仍然直接使用偏移量
+    for (auto value : escaped) {
+        folded.erase(value);
+    }
+}
+
+// 分支的条件是紧邻其前的比较, 且比较的结果没有其他使用时, 两者合并为一条比较分支指令
+void KoopaParser::find_fused(const koopa_raw_function_t &func) {
+    fused.clear();
+    std::unordered_map<koopa_raw_value_t, int> uses;
+    for (uint32_t i = 0; i < func->bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(func->bbs, i);
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            for_each_operand(slice_at<koopa_raw_value_t>(bb->insts, j), [&](koopa_raw_value_t operand) {
+                uses[operand]++;
+            });
+        }
+    }
+    for (uint32_t i = 0; i < func->bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(func->bbs, i);
+        auto last = terminator(bb);
+        if (last->kind.tag != KOOPA_RVT_BRANCH || bb->insts.len < 2) {
+            continue;
+        }
+        auto cond = last->kind.data.branch.cond;
+        if (cond == slice_at<koopa_raw_value_t>(bb->insts, bb->insts.len - 2) &&
+            cond->kind.tag == KOOPA_RVT_BINARY && is_compare(cond->kind.data.binary.op) && uses[cond] == 1) {
+            fused.insert(cond);
+        }
+    }
 }
 
 void KoopaParser::CompileBranch(const koopa_raw_value_t &value) {
     debug("CompileBranch");
     const koopa_raw_value_kind_t &kind = value->kind;
     auto &branch = kind.data.branch;
+    // 带有实参的边由优化 pass 拆分为单独的跳转
+    assert(!branch.true_args.len && !branch.false_args.len && "branch with arguments");
     auto &cond = branch.cond;
     auto &fbb = branch.false_bb;
     auto &tbb = branch.true_bb;
-    load_value(cond, "t0");
-    o << "beqz t0, " << real_name(fbb) << std::endl;
-    o << "j " << real_name(tbb) << std::endl;
+    if (fused.count(cond)) {
+        // 条件不成立时跳转到 false 分支
+        auto &bin = cond->kind.data.binary;
+        auto l = load_value(bin.lhs, "t0");
+        auto r = load_value(bin.rhs, "t1");
+        switch (bin.op) {
+            case KOOPA_RBO_EQ:
+                code.jump(RiscvOp::Bne, label(fbb), l, r);
+                break;
+            case KOOPA_RBO_NOT_EQ:
+                code.jump(RiscvOp::Beq, label(fbb), l, r);
+                break;
+            case KOOPA_RBO_LT:
+                code.jump(RiscvOp::Bge, label(fbb), l, r);
+                break;
+            case KOOPA_RBO_GT:
+                code.jump(RiscvOp::Bge, label(fbb), r, l);
+                break;
+            case KOOPA_RBO_LE:
+                code.jump(RiscvOp::Blt, label(fbb), r, l);
+                break;
+            case KOOPA_RBO_GE:
+                code.jump(RiscvOp::Blt, label(fbb), l, r);
+                break;
+            default:
+                assert(false);
+        }
+    } else {
+        auto reg = load_value(cond, "t0");
+        code.jump(RiscvOp::Beqz, label(fbb), reg);
+    }
+    code.jump(RiscvOp::J, label(tbb));
+}
+
+namespace {
+    // 常量操作数交换到右侧后的运算, 不能交换时返回 false
+    bool swap_operands(koopa_raw_binary_op_t &op) {
+        switch (op) {
+            case KOOPA_RBO_ADD:
+            case KOOPA_RBO_MUL:
+            case KOOPA_RBO_AND:
+            case KOOPA_RBO_OR:
+            case KOOPA_RBO_XOR:
+            case KOOPA_RBO_EQ:
+            case KOOPA_RBO_NOT_EQ:
+                return true;
+            case KOOPA_RBO_LT: op = KOOPA_RBO_GT; return true;
+            case KOOPA_RBO_GT: op = KOOPA_RBO_LT; return true;
+            case KOOPA_RBO_LE: op = KOOPA_RBO_GE; return true;
+            case KOOPA_RBO_GE: op = KOOPA_RBO_LE; return true;
+            default:
+                return false;
+        }
+    }
+}
+
+bool KoopaParser::CompileBinaryImm(koopa_raw_binary_op_t op, const char *d, const koopa_raw_value_t &lhs, int32_t imm) {
+    // 先确定能否使用立即数, 再加载左侧操作数
+    int64_t c = imm;
+    switch (op) {
+        case KOOPA_RBO_ADD:
+        case KOOPA_RBO_AND:
+        case KOOPA_RBO_OR:
+        case KOOPA_RBO_XOR:
+        case KOOPA_RBO_LT:
+        case KOOPA_RBO_GE:
+            if (!is_imm12(c)) {
+                return false;
+            }
+            break;
+        case KOOPA_RBO_SUB:
+            if (!is_imm12(-c)) {
+                return false;
+            }
+            break;
+        case KOOPA_RBO_LE:
+            if (!is_imm12(c + 1)) {
+                return false;
+            }
+            break;
+        case KOOPA_RBO_EQ:
+        case KOOPA_RBO_NOT_EQ:
+            if (c && !is_imm12(c)) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+    }
+    auto l = load_value(lhs, "t0");
+    switch (op) {
+        case KOOPA_RBO_ADD:
+            code.addi(d, l, imm);
+            break;
+        case KOOPA_RBO_SUB:
+            code.addi(d, l, -imm);
+            break;
+        case KOOPA_RBO_AND:
+            code.inst_imm(RiscvOp::Andi, d, l, imm);
+            break;
+        case KOOPA_RBO_OR:
+            code.inst_imm(RiscvOp::Ori, d, l, imm);
+            break;
+        case KOOPA_RBO_XOR:
+            code.inst_imm(RiscvOp::Xori, d, l, imm);
+            break;
+        case KOOPA_RBO_LT:
+            code.inst_imm(RiscvOp::Slti, d, l, imm);
+            break;
+        case KOOPA_RBO_LE:
+            // l <= c 即 l < c + 1
+            code.inst_imm(RiscvOp::Slti, d, l, imm + 1);
+            break;
+        case KOOPA_RBO_GE:
+            code.inst_imm(RiscvOp::Slti, d, l, imm);
+            code.inst_imm(RiscvOp::Xori, d, d, 1);
+            break;
+        case KOOPA_RBO_EQ:
+        case KOOPA_RBO_NOT_EQ:
+            // 与 0 比较时不需要先求差
+            if (imm) {
+                code.inst_imm(RiscvOp::Xori, d, l, imm);
+                l = d;
+            }
+            code.inst(op == KOOPA_RBO_EQ ? RiscvOp::Seqz : RiscvOp::Snez, d, l);
+            break;
+        default:
+            assert(false);
+    }
+    return true;
 }
 
 void KoopaParser::CompileBinary(const koopa_raw_value_t &value) {
     debug("CompileBinary");
     const koopa_raw_value_kind_t &kind = value->kind;
     auto &bin = kind.data.binary;
-    auto &lhs = bin.lhs;
-    auto &rhs = bin.rhs;
-    load_value(lhs, "t0");
-    load_value(rhs, "t1");
-    switch (bin.op) {
+    auto op = bin.op;
+    auto lhs = bin.lhs;
+    auto rhs = bin.rhs;
+    // 常量尽量放在右侧, 以便使用立即数
+    if (lhs->kind.tag == KOOPA_RVT_INTEGER && rhs->kind.tag != KOOPA_RVT_INTEGER && swap_operands(op)) {
+        std::swap(lhs, rhs);
+    }
+    auto d = result_reg(value, "t0");
+    if (rhs->kind.tag == KOOPA_RVT_INTEGER) {
+        auto imm = rhs->kind.data.integer.value;
+        if (CompileBinaryImm(op, d, lhs, imm) || CompileBinaryStrength(op, d, lhs, imm)) {
+            store_value(value, d);
+            return;
+        }
+    }
+    auto l = load_value(lhs, "t0");
+    auto r = load_value(rhs, "t1");
+    switch (op) {
         case KOOPA_RBO_ADD:
-            o << "add t0, t0, t1" << std::endl;
+            code.inst(RiscvOp::Add, d, l, r);
             break;
         case KOOPA_RBO_SUB:
-            o << "sub t0, t0, t1" << std::endl;
+            code.inst(RiscvOp::Sub, d, l, r);
             break;
         case KOOPA_RBO_MUL:
-            o << "mul t0, t0, t1" << std::endl;
+            code.inst(RiscvOp::Mul, d, l, r);
             break;
         case KOOPA_RBO_DIV:
-            o << "div t0, t0, t1" << std::endl;
+            code.inst(RiscvOp::Div, d, l, r);
             break;
         case KOOPA_RBO_MOD:
-            o << "rem t0, t0, t1" << std::endl;
+            code.inst(RiscvOp::Rem, d, l, r);
             break;
         case KOOPA_RBO_EQ:
-            o << "sub t0, t0, t1" << std::endl;
-            o << "seqz t0, t0" << std::endl;
+            code.inst(RiscvOp::Sub, d, l, r);
+            code.inst(RiscvOp::Seqz, d, d);
             break;
         case KOOPA_RBO_NOT_EQ:
-            o << "sub t0, t0, t1" << std::endl;
-            o << "snez t0, t0" << std::endl;
+            code.inst(RiscvOp::Sub, d, l, r);
+            code.inst(RiscvOp::Snez, d, d);
             break;
         case KOOPA_RBO_GT:
-            o << "slt t0, t1, t0" << std::endl;
+            code.inst(RiscvOp::Slt, d, r, l);
             break;
         case KOOPA_RBO_LT:
-            o << "slt t0, t0, t1" << std::endl;
+            code.inst(RiscvOp::Slt, d, l, r);
             break;
         case KOOPA_RBO_GE:
-            o << "slt t0, t0, t1" << std::endl;
-            o << "seqz t0, t0" << std::endl;
+            code.inst(RiscvOp::Slt, d, l, r);
+            code.inst(RiscvOp::Seqz, d, d);
             break;
         case KOOPA_RBO_LE:
-            o << "slt t0, t1, t0" << std::endl;
-            o << "seqz t0, t0" << std::endl;
+            code.inst(RiscvOp::Slt, d, r, l);
+            code.inst(RiscvOp::Seqz, d, d);
             break;
         case KOOPA_RBO_AND:
-            o << "and t0, t0, t1" << std::endl;
+            code.inst(RiscvOp::And, d, l, r);
             break;
         case KOOPA_RBO_OR:
-            o << "or t0, t0, t1" << std::endl;
+            code.inst(RiscvOp::Or, d, l, r);
             break;
         case KOOPA_RBO_XOR:
-            o << "xor t0, t0, t1" << std::endl;
+            code.inst(RiscvOp::Xor, d, l, r);
             break;
         default:
             // 不支持移位, SysY生成的代码不会遇到
             assert(false);
     }
-    store_value(value, "t0");
+    store_value(value, d);
 }
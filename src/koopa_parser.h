@@ -1,39 +1,129 @@
 #ifndef __KOOPA_PARSER_H__
 #define __KOOPA_PARSER_H__
 
-#include <iostream>
+#include <cstring>
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
+#include <utility>
+#include <vector>
 #include "koopa.h"
+#include "emitter.h"
+#include "riscv_code.h"
 
 class KoopaParser {
 private:
+    // 值的位置, reg 为空时位于栈中 offset 处
+    struct Location {
+        const char *reg;
+        int offset;
+        bool operator==(const Location &other) const {
+            return reg ? other.reg && std::strcmp(reg, other.reg) == 0 : !other.reg && offset == other.offset;
+        }
+    };
+    // 并行赋值中的一项
+    struct Move {
+        Location dest;
+        // 常量没有位置, 最后直接写入
+        koopa_raw_value_t constant;
+        Location src;
+    };
+
     int indent_level = 0;
     int stack_length = 0;
+    // 分配指令和溢出的值在栈中的偏移量
     std::unordered_map<koopa_raw_value_t, int> value_map;
-    std::ostream &o;
+    // 寄存器分配时为分配指令和溢出的值分配的栈槽, 活跃区间不重叠的值共享栈槽
+    std::unordered_map<koopa_raw_value_t, int> slot_map;
+    int slot_count = 0;
+    // 栈帧超出 12 位立即数的范围时, 并行赋值用于打破环的栈槽, 否则为 -1
+    int cycle_slot = -1;
+    // 分配到寄存器的值
+    std::unordered_map<koopa_raw_value_t, const char*> reg_map;
+    // 使用过的被调用者保存寄存器及其在栈中的偏移量
+    std::vector<std::pair<const char*, int>> saved_regs;
+    // 与紧随其后的分支合并的比较, 不单独计算结果, 也不分配寄存器
+    std::unordered_set<koopa_raw_value_t> fused;
+    // 栈帧中的数组, 放在栈槽之后, 不与其他值共享空间
+    std::vector<koopa_raw_value_t> arrays;
+    // 栈帧中固定位置的地址计算, 不生成指令, 访存时直接使用 sp 加偏移量
+    std::unordered_set<koopa_raw_value_t> folded;
+    // 代替其后 ret 的尾调用
+    std::unordered_set<koopa_raw_value_t> tail_calls;
+    // 是否有尾调用以外的调用, 有则需要保存 ra
+    bool has_call = false;
+    // 尾调用以外的调用在栈上传递的实参所需的空间, 位于栈帧底部
+    int outgoing_args = 0;
+    // 函数体中使用的形参, 在序言中从 a0-a7 或调用者的栈帧复制到分配的位置
+    std::vector<koopa_raw_value_t> used_params;
+    // 正在编译的函数, 以及以函数名为前缀的基本块标签
+    koopa_raw_function_t function = nullptr;
+    std::unordered_map<koopa_raw_basic_block_t, std::string> labels;
+    Emitter &o;
+    // 当前函数的指令序列, 函数编译完成后输出到 o
+    RiscvCode code;
+    // 并行编译函数时使用的线程数, 不超过 1 时串行编译
+    int jobs;
+    // 是否对指令序列做窥孔优化
+    bool peephole;
+    // 向量化提取出的函数, 为空指针时没有
+    const std::unordered_set<koopa_raw_function_t> *kernels;
 
 public:
-    KoopaParser(std::ostream &o) : o(o) {}
+    KoopaParser(Emitter &o, int jobs = 1, bool peephole = false,
+                const std::unordered_set<koopa_raw_function_t> *kernels = nullptr)
+        : o(o), jobs(jobs), peephole(peephole), kernels(kernels) {}
     ~KoopaParser() = default;
 
+    // 窥孔优化删除的指令数
+    int64_t peephole_removed = 0;
+
     void Visit(const koopa_raw_program_t &);
     void Visit(const koopa_raw_slice_t &);
     void Visit(const koopa_raw_function_t &);
     void Visit(const koopa_raw_basic_block_t &);
     void Visit(const koopa_raw_value_t &);
 
+    // 线性扫描寄存器分配, 实现见 koopa_regalloc.cpp
+    void allocate_registers(const koopa_raw_function_t &);
+    // 找出可以与分支合并的比较
+    void find_fused(const koopa_raw_function_t &);
+    // 找出尾调用, 并统计其余调用在栈上传递的实参
+    void find_calls(const koopa_raw_function_t &);
+    // 找出栈帧中偏移量固定, 且只用于访存和继续计算地址的 getptr/getelemptr
+    void find_folded(const koopa_raw_function_t &);
+    // 基本块的标签
+    const char* label(const koopa_raw_basic_block_t &);
+
     int get_offset(const koopa_raw_value_t &);
-    void set_offset(const koopa_raw_value_t &);
-    void record_offset(const koopa_raw_value_t &);
-    void record_offset(const koopa_raw_basic_block_t &);
+    // 分配指令和合并的地址计算相对 sp 的偏移量
+    int frame_offset(const koopa_raw_value_t &);
+    // 指针指向的地址, 表示为基址寄存器和偏移量, 不在栈帧中时将指针加载到 reg
+    std::pair<const char*, int> address(const koopa_raw_value_t &ptr, const char *reg);
+    // 由栈槽确定栈帧布局
     void record_offset(const koopa_raw_function_t &);
+    // 调整栈指针, 超出 12 位立即数时经过 t0
+    void adjust_stack(int delta);
 
-    void load_value(const koopa_raw_value_t &, const std::string&);
-    void store_value(const koopa_raw_value_t &, const std::string&);
+    // 获取保存值的寄存器, 不在寄存器中的值加载到 reg 中
+    const char* load_value(const koopa_raw_value_t &, const char *reg);
+    // 获取写入结果的寄存器, 溢出的值先写入 reg, 再由 store_value 保存
+    const char* result_reg(const koopa_raw_value_t &, const char *reg);
+    // 保存 reg 中的结果, 溢出的值写回栈中
+    void store_value(const koopa_raw_value_t &, const char *reg);
+    Location location(const koopa_raw_value_t &);
+    void move(const Location &dest, const Location &src);
+    // 添加将 value 复制到 dest 的一项, 已经位于 dest 时忽略
+    void push_move(std::vector<Move> &moves, const Location &dest, const koopa_raw_value_t &value);
+    // 所有来源都在任何目标被写入之前读取
+    void parallel_move(std::vector<Move> moves);
+    // 恢复被调用者保存寄存器并释放栈帧
+    void epilogue();
 
     void Compile(const koopa_raw_program_t &);
     void Compile(const koopa_raw_slice_t &);
+    // 多线程编译所有函数, 输出与串行编译完全相同
+    void CompileParallel(const koopa_raw_slice_t &);
     void Compile(const koopa_raw_function_t &);
     void Compile(const koopa_raw_basic_block_t &);
     void Compile(const koopa_raw_value_t &);
@@ -42,8 +132,20 @@ public:
     void CompileAlloc(const koopa_raw_value_t &);
     void CompileLoad(const koopa_raw_value_t &);
     void CompileStore(const koopa_raw_value_t &);
+    void CompileGetPtr(const koopa_raw_value_t &);
+    void CompileJump(const koopa_raw_value_t &);
     void CompileBranch(const koopa_raw_value_t &);
+    void CompileCall(const koopa_raw_value_t &);
+    void CompileTailCall(const koopa_raw_value_t &);
     void CompileBinary(const koopa_raw_value_t &);
+    // 右侧为 12 位立即数时使用 I 型指令, 不能使用时返回 false
+    bool CompileBinaryImm(koopa_raw_binary_op_t op, const char *d, const koopa_raw_value_t &lhs, int32_t imm);
+    // 右侧为常量的乘除法和取模的强度削弱, 不能削弱时返回 false, 实现见 koopa_strength.cpp
+    bool CompileBinaryStrength(koopa_raw_binary_op_t op, const char *d, const koopa_raw_value_t &lhs, int32_t imm);
+    bool multiply_cheap(const char *d, const char *src, int32_t c, const char *tmp);
+    void divide_magic(const char *l, uint32_t c);
+    // 向量化提取出的函数, 即 kernels 中的函数, 生成 RVV 的分段循环, 实现见 koopa_rvv.cpp
+    void CompileVectorKernel(const koopa_raw_function_t &);
 };
 
 #endif
@@ -0,0 +1,234 @@
+#include <cassert>
+#include "koopa_printer.h"
+#include "koopa_util.h"
+
+namespace {
+    // 与 koopa_raw_binary_op_t 的顺序一致
+    const char *const binary_op_str[] = {
+        "ne", "eq", "gt", "lt", "ge", "le",
+        "add", "sub", "mul", "div", "mod",
+        "and", "or", "xor", "shl", "shr", "sar",
+    };
+}
+
+const std::string& KoopaPrinter::name(koopa_raw_value_t value) {
+    auto &result = names[value];
+    if (result.empty()) {
+        result = value->name ? value->name : "%" + std::to_string(value_count++);
+    }
+    return result;
+}
+
+void KoopaPrinter::PrintType(koopa_raw_type_t ty) {
+    switch (ty->tag) {
+        case KOOPA_RTT_INT32:
+            o << "i32";
+            break;
+        case KOOPA_RTT_POINTER:
+            o << "*";
+            PrintType(ty->data.pointer.base);
+            break;
+        case KOOPA_RTT_ARRAY:
+            o << "[";
+            PrintType(ty->data.array.base);
+            o << ", " << ty->data.array.len << "]";
+            break;
+        default:
+            assert(false && "unexpected type");
+    }
+}
+
+void KoopaPrinter::PrintOperand(koopa_raw_value_t value) {
+    switch (value->kind.tag) {
+        case KOOPA_RVT_INTEGER:
+            o << value->kind.data.integer.value;
+            break;
+        case KOOPA_RVT_ZERO_INIT:
+            o << "zeroinit";
+            break;
+        case KOOPA_RVT_UNDEF:
+            o << "undef";
+            break;
+        case KOOPA_RVT_AGGREGATE: {
+            auto &elems = value->kind.data.aggregate.elems;
+            o << "{";
+            for (uint32_t i = 0; i < elems.len; i++) {
+                o << (i ? ", " : "");
+                PrintOperand(slice_at<koopa_raw_value_t>(elems, i));
+            }
+            o << "}";
+            break;
+        }
+        default:
+            o << name(value);
+    }
+}
+
+void KoopaPrinter::PrintTarget(koopa_raw_basic_block_t bb, const koopa_raw_slice_t &args) {
+    o << bb->name;
+    if (!args.len) {
+        return;
+    }
+    o << "(";
+    for (uint32_t i = 0; i < args.len; i++) {
+        o << (i ? ", " : "");
+        PrintOperand(slice_at<koopa_raw_value_t>(args, i));
+    }
+    o << ")";
+}
+
+void KoopaPrinter::Print(const koopa_raw_program_t &program) {
+    for (uint32_t i = 0; i < program.values.len; i++) {
+        auto value = slice_at<koopa_raw_value_t>(program.values, i);
+        o << "global " << name(value) << " = alloc ";
+        PrintType(value->ty->data.pointer.base);
+        o << ", ";
+        PrintOperand(value->kind.data.global_alloc.init);
+        o << '\n';
+    }
+    if (program.values.len) {
+        o << '\n';
+    }
+    // 先输出所有声明, 再输出定义
+    bool has_decl = false;
+    for (uint32_t i = 0; i < program.funcs.len; i++) {
+        auto func = slice_at<koopa_raw_function_t>(program.funcs, i);
+        if (func->bbs.len) {
+            continue;
+        }
+        has_decl = true;
+        auto &ty = func->ty->data.function;
+        o << "decl " << func->name << "(";
+        for (uint32_t j = 0; j < ty.params.len; j++) {
+            o << (j ? ", " : "");
+            PrintType(slice_at<koopa_raw_type_t>(ty.params, j));
+        }
+        o << ")";
+        if (ty.ret->tag != KOOPA_RTT_UNIT) {
+            o << ": ";
+            PrintType(ty.ret);
+        }
+        o << '\n';
+    }
+    if (has_decl) {
+        o << '\n';
+    }
+    for (uint32_t i = 0; i < program.funcs.len; i++) {
+        auto func = slice_at<koopa_raw_function_t>(program.funcs, i);
+        if (func->bbs.len) {
+            Print(func);
+        }
+    }
+}
+
+void KoopaPrinter::Print(const koopa_raw_function_t &func) {
+    // 值的编号在函数内有效
+    names.clear();
+    value_count = 0;
+    o << "fun " << func->name << "(";
+    for (uint32_t i = 0; i < func->params.len; i++) {
+        auto param = slice_at<koopa_raw_value_t>(func->params, i);
+        if (!param->name) {
+            names[param] = "%arg_" + std::to_string(i);
+        }
+        o << (i ? ", " : "") << name(param) << ": ";
+        PrintType(param->ty);
+    }
+    o << ")";
+    auto ret = func->ty->data.function.ret;
+    if (ret->tag != KOOPA_RTT_UNIT) {
+        o << ": ";
+        PrintType(ret);
+    }
+    o << " {" << '\n';
+    for (uint32_t i = 0; i < func->bbs.len; i++) {
+        Print(slice_at<koopa_raw_basic_block_t>(func->bbs, i));
+    }
+    o << "}" << '\n' << '\n';
+}
+
+void KoopaPrinter::Print(const koopa_raw_basic_block_t &bb) {
+    o << bb->name;
+    if (bb->params.len) {
+        o << "(";
+        for (uint32_t i = 0; i < bb->params.len; i++) {
+            auto param = slice_at<koopa_raw_value_t>(bb->params, i);
+            o << (i ? ", " : "") << name(param) << ": ";
+            PrintType(param->ty);
+        }
+        o << ")";
+    }
+    o << ":" << '\n';
+    for (uint32_t i = 0; i < bb->insts.len; i++) {
+        Print(slice_at<koopa_raw_value_t>(bb->insts, i));
+    }
+}
+
+void KoopaPrinter::Print(const koopa_raw_value_t &value) {
+    const auto &kind = value->kind;
+    o << "  ";
+    if (value->ty->tag != KOOPA_RTT_UNIT) {
+        o << name(value) << " = ";
+    }
+    switch (kind.tag) {
+        case KOOPA_RVT_ALLOC:
+            o << "alloc ";
+            PrintType(value->ty->data.pointer.base);
+            break;
+        case KOOPA_RVT_LOAD:
+            o << "load ";
+            PrintOperand(kind.data.load.src);
+            break;
+        case KOOPA_RVT_STORE:
+            o << "store ";
+            PrintOperand(kind.data.store.value);
+            o << ", ";
+            PrintOperand(kind.data.store.dest);
+            break;
+        case KOOPA_RVT_GET_PTR:
+        case KOOPA_RVT_GET_ELEM_PTR:
+            o << (kind.tag == KOOPA_RVT_GET_PTR ? "getptr " : "getelemptr ");
+            PrintOperand(address_src(value));
+            o << ", ";
+            PrintOperand(address_index(value));
+            break;
+        case KOOPA_RVT_BINARY:
+            o << binary_op_str[kind.data.binary.op] << " ";
+            PrintOperand(kind.data.binary.lhs);
+            o << ", ";
+            PrintOperand(kind.data.binary.rhs);
+            break;
+        case KOOPA_RVT_BRANCH:
+            o << "br ";
+            PrintOperand(kind.data.branch.cond);
+            o << ", ";
+            PrintTarget(kind.data.branch.true_bb, kind.data.branch.true_args);
+            o << ", ";
+            PrintTarget(kind.data.branch.false_bb, kind.data.branch.false_args);
+            break;
+        case KOOPA_RVT_JUMP:
+            o << "jump ";
+            PrintTarget(kind.data.jump.target, kind.data.jump.args);
+            break;
+        case KOOPA_RVT_CALL: {
+            auto &args = kind.data.call.args;
+            o << "call " << kind.data.call.callee->name << "(";
+            for (uint32_t i = 0; i < args.len; i++) {
+                o << (i ? ", " : "");
+                PrintOperand(slice_at<koopa_raw_value_t>(args, i));
+            }
+            o << ")";
+            break;
+        }
+        case KOOPA_RVT_RETURN:
+            o << "ret";
+            if (kind.data.ret.value) {
+                o << " ";
+                PrintOperand(kind.data.ret.value);
+            }
+            break;
+        default:
+            assert(false && "unexpected instruction");
+    }
+    o << '\n';
+}
@@ -0,0 +1,34 @@
+#ifndef __KOOPA_PRINTER_H__
+#define __KOOPA_PRINTER_H__
+
+#include <string>
+#include <unordered_map>
+#include "koopa.h"
+#include "emitter.h"
+
+// 将 raw program 输出为 Koopa IR 文本, 即 -koopa 模式的输出
+// AST 只构建 raw program, 文本由构建结果生成, 两者不会不一致
+class KoopaPrinter {
+private:
+    Emitter &o;
+    // 当前函数中没有名称的值, 如指令结果和参数, 按出现顺序编号
+    std::unordered_map<koopa_raw_value_t, std::string> names;
+    int value_count = 0;
+
+    // 值的名称, 没有名称时分配新的编号
+    const std::string& name(koopa_raw_value_t value);
+    void PrintType(koopa_raw_type_t ty);
+    void PrintOperand(koopa_raw_value_t value);
+    // 跳转目标, 带有基本块参数时同时输出实参
+    void PrintTarget(koopa_raw_basic_block_t bb, const koopa_raw_slice_t &args);
+
+public:
+    explicit KoopaPrinter(Emitter &o) : o(o) {}
+
+    void Print(const koopa_raw_program_t &);
+    void Print(const koopa_raw_function_t &);
+    void Print(const koopa_raw_basic_block_t &);
+    void Print(const koopa_raw_value_t &);
+};
+
+#endif
@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+#include "koopa_parser.h"
+#include "koopa_util.h"
+
+// 线性扫描寄存器分配
+// 1. 按基本块布局顺序为指令编号
+// 2. 在控制流图上做活跃变量分析, 得到每个值的活跃区间 (不考虑空洞)
+// 3. 按区间起点扫描, 优先分配空闲寄存器, 寄存器不足时溢出区间终点最远的值
+// 跨越调用的区间只使用被调用者保存寄存器, 调用前后不需要保存其他寄存器
+// 形参优先使用传入它的寄存器, 调用的结果优先使用 a0, 以省去复制
+// 溢出的值和局部变量同样按活跃区间分配栈槽, 区间不重叠的值共享同一个栈槽
+// 局部变量的写入相当于定义, 读取相当于使用, 区间之外栈槽中的值不会再被读取
+
+namespace {
+    // 可分配的寄存器, 调用者保存寄存器优先, 被调用者保存寄存器需要在序言中保存
+    // t0, t1 保留用于加载常量和溢出的值, 不参与分配
+    const char *const allocatable[] = {
+        "t2", "t3", "t4", "t5", "t6",
+        "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7",
+        "s1", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11",
+    };
+    constexpr int reg_count = sizeof(allocatable) / sizeof(allocatable[0]);
+
+    // 被调用者保存寄存器排在最后
+    constexpr int callee_saved_begin = 13;
+
+    bool is_callee_saved(int reg) {
+        return reg >= callee_saved_begin;
+    }
+
+    // a0 在可分配寄存器中的下标
+    constexpr int a0_index = 5;
+
+    // 值的活跃区间, 以指令编号表示的闭区间
+    struct Interval {
+        koopa_raw_value_t value;
+        int start, end;
+        // 优先使用的寄存器, 没有时为 -1
+        int hint = -1;
+        // 局部变量, 区间覆盖其地址的所有使用, 只分配栈槽
+        bool memory = false;
+    };
+}
+
+void KoopaParser::allocate_registers(const koopa_raw_function_t &func) {
+    reg_map.clear();
+    saved_regs.clear();
+    used_params.clear();
+    slot_map.clear();
+
+    // 为基本块和指令编号, 需要寄存器的值记录初始区间
+    auto &bbs = func->bbs;
+    std::unordered_map<koopa_raw_basic_block_t, uint32_t> bb_index;
+    std::vector<int> bb_start(bbs.len), bb_end(bbs.len);
+    std::unordered_map<koopa_raw_value_t, size_t> ids;
+    std::vector<Interval> intervals;
+    // 形参在序言中定义, 位于所有指令之前, 前 8 个形参优先使用传入的寄存器
+    for (uint32_t i = 0; i < func->params.len; i++) {
+        auto param = slice_at<koopa_raw_value_t>(func->params, i);
+        ids[param] = intervals.size();
+        intervals.push_back({param, -1, -1, i < 8 ? a0_index + static_cast<int>(i) : -1});
+    }
+    // 尾调用以外的调用的位置及其结果, 按顺序排列
+    std::vector<int> calls;
+    std::vector<koopa_raw_value_t> call_values;
+    int position = 0;
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+        bb_index[bb] = i;
+        bb_start[i] = position;
+        // 基本块参数在进入基本块时定义
+        for (uint32_t j = 0; j < bb->params.len; j++) {
+            auto param = slice_at<koopa_raw_value_t>(bb->params, j);
+            ids[param] = intervals.size();
+            intervals.push_back({param, position, position});
+        }
+        for (uint32_t j = 0; j < bb->insts.len; j++, position++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            if (inst->kind.tag == KOOPA_RVT_ALLOC) {
+                // 分配指令都在入口基本块开头, 局部变量的区间只由读写的位置决定
+                // 数组由 record_offset 单独放置
+                if (inst->ty->data.pointer.base->tag != KOOPA_RTT_ARRAY) {
+                    ids[inst] = intervals.size();
+                    intervals.push_back({inst, INT32_MAX, -1, -1, true});
+                }
+            } else if (is_register_value(inst) && !fused.count(inst) && !folded.count(inst)) {
+                ids[inst] = intervals.size();
+                intervals.push_back({inst, position, position, inst->kind.tag == KOOPA_RVT_CALL ? a0_index : -1});
+            }
+            if (inst->kind.tag == KOOPA_RVT_CALL && !tail_calls.count(inst)) {
+                calls.push_back(position);
+                call_values.push_back(inst);
+            }
+        }
+        bb_end[i] = position - 1;
+    }
+    auto n = intervals.size();
+
+    // 计算基本块的 use/def 集合, 同时用使用位置延长区间
+    std::vector<BitSet> use(bbs.len, BitSet(n)), def(bbs.len, BitSet(n));
+    std::vector<std::vector<uint32_t>> succs(bbs.len);
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+        int pos = bb_start[i];
+        for (uint32_t j = 0; j < bb->params.len; j++) {
+            def[i].set(ids[slice_at<koopa_raw_value_t>(bb->params, j)]);
+        }
+        for (uint32_t j = 0; j < bb->insts.len; j++, pos++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            for_each_operand(inst, [&](koopa_raw_value_t operand) {
+                auto it = ids.find(operand);
+                if (it == ids.end()) {
+                    return;
+                }
+                auto &interval = intervals[it->second];
+                interval.start = std::min(interval.start, pos);
+                interval.end = std::max(interval.end, pos);
+                // 写入局部变量覆盖原有的值, 相当于重新定义, 读取相当于使用
+                if (inst->kind.tag == KOOPA_RVT_STORE && operand == inst->kind.data.store.dest) {
+                    def[i].set(it->second);
+                } else if (!def[i].test(it->second)) {
+                    use[i].set(it->second);
+                }
+            });
+            if (ids.count(inst)) {
+                def[i].set(ids[inst]);
+            }
+        }
+        for_each_successor(terminator(bb), [&](koopa_raw_basic_block_t succ) {
+            succs[i].push_back(bb_index.at(succ));
+        });
+    }
+
+    // 迭代求解活跃变量: in = use | (out & ~def), out = U in(succ)
+    std::vector<BitSet> live_in(use), live_out(bbs.len, BitSet(n));
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (uint32_t i = bbs.len; i-- > 0;) {
+            for (auto succ : succs[i]) {
+                live_out[i].merge(live_in[succ]);
+            }
+            changed |= live_in[i].merge(live_out[i], &def[i]);
+        }
+    }
+
+    // 跨越基本块边界的值, 区间覆盖到对应基本块的边界
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        live_in[i].for_each([&](size_t id) {
+            auto &interval = intervals[id];
+            interval.start = std::min(interval.start, bb_start[i]);
+            interval.end = std::max(interval.end, bb_start[i]);
+        });
+        live_out[i].for_each([&](size_t id) {
+            auto &interval = intervals[id];
+            interval.start = std::min(interval.start, bb_end[i]);
+            interval.end = std::max(interval.end, bb_end[i]);
+        });
+    }
+
+    // 没有被使用的形参和局部变量不需要位置
+    intervals.erase(std::remove_if(intervals.begin(), intervals.end(), [](const Interval &interval) {
+        return interval.end < 0;
+    }), intervals.end());
+    for (auto &interval : intervals) {
+        if (interval.start < 0) {
+            used_params.push_back(interval.value);
+        }
+    }
+    // 值在定义之后, 最后一次使用之前经过调用
+    // 基本块参数和活跃进入基本块的值的起点是基本块的第一条指令, 该指令是调用时同样经过调用
+    // 只有调用自身的结果不经过定义它的调用
+    auto crosses_call = [&](const Interval &interval) {
+        auto call = std::lower_bound(calls.begin(), calls.end(), interval.start);
+        if (call != calls.end() && *call == interval.start && call_values[call - calls.begin()] == interval.value) {
+            ++call;
+        }
+        return call != calls.end() && *call < interval.end;
+    };
+
+    // 线性扫描
+    std::sort(intervals.begin(), intervals.end(), [](const Interval &a, const Interval &b) {
+        return a.start < b.start;
+    });
+    // 活跃中的区间及其寄存器
+    std::vector<std::pair<const Interval*, int>> active;
+    bool free_reg[reg_count];
+    bool used_reg[reg_count] = {};
+    std::fill(free_reg, free_reg + reg_count, true);
+    for (auto &current : intervals) {
+        // 释放已经结束的区间
+        auto expired = std::remove_if(active.begin(), active.end(), [&](const auto &item) {
+            if (item.first->end < current.start) {
+                free_reg[item.second] = true;
+                return true;
+            }
+            return false;
+        });
+        active.erase(expired, active.end());
+        if (current.memory) {
+            continue;
+        }
+        int first = crosses_call(current) ? callee_saved_begin : 0;
+        int reg = reg_count;
+        if (current.hint >= first && free_reg[current.hint]) {
+            reg = current.hint;
+        } else {
+            reg = std::find(free_reg + first, free_reg + reg_count, true) - free_reg;
+        }
+        if (reg == reg_count) {
+            // 寄存器不足, 溢出可用寄存器中终点最远的区间
+            auto victim = active.end();
+            for (auto it = active.begin(); it != active.end(); ++it) {
+                if (it->second >= first && (victim == active.end() || it->first->end > victim->first->end)) {
+                    victim = it;
+                }
+            }
+            if (victim == active.end() || victim->first->end <= current.end) {
+                // 当前区间终点最远, 直接溢出
+                continue;
+            }
+            reg = victim->second;
+            reg_map.erase(victim->first->value);
+            active.erase(victim);
+        }
+        free_reg[reg] = false;
+        used_reg[reg] = true;
+        reg_map[current.value] = allocatable[reg];
+        active.push_back({&current, reg});
+    }
+
+    // 为局部变量和溢出的值分配栈槽, 同样按起点扫描, 优先复用编号最小的空闲栈槽
+    std::vector<std::pair<int, int>> live_slots;
+    std::vector<int> free_slots;
+    slot_count = 0;
+    for (auto &current : intervals) {
+        if (!current.memory && reg_map.count(current.value)) {
+            continue;
+        }
+        auto expired = std::remove_if(live_slots.begin(), live_slots.end(), [&](const auto &item) {
+            if (item.first < current.start) {
+                free_slots.push_back(item.second);
+                return true;
+            }
+            return false;
+        });
+        live_slots.erase(expired, live_slots.end());
+        int slot;
+        if (free_slots.empty()) {
+            slot = slot_count++;
+        } else {
+            auto it = std::min_element(free_slots.begin(), free_slots.end());
+            slot = *it;
+            free_slots.erase(it);
+        }
+        slot_map[current.value] = slot;
+        live_slots.push_back({current.end, slot});
+    }
+
+    // 记录需要保存的被调用者保存寄存器, 偏移量由 record_offset 确定
+    for (int reg = 0; reg < reg_count; reg++) {
+        if (used_reg[reg] && is_callee_saved(reg)) {
+            saved_regs.push_back({allocatable[reg], 0});
+        }
+    }
+    // 调用会改写 ra, 只有尾调用的函数和叶函数不需要保存
+    if (has_call) {
+        saved_regs.push_back({"ra", 0});
+    }
+}
@@ -0,0 +1,176 @@
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+#include "koopa_parser.h"
+#include "koopa_util.h"
+
+// 向量化提取出的函数的 RVV 实现, 函数的形式见 koopa_vectorize.cpp
+// 参数 (基址..., 标量..., i0, n) 都在 a0-a7 中, 是不使用栈帧的叶函数
+//   bge i0, n, fallback
+//   t2 = n - i0                                 剩余的元素个数
+//   区间重叠检查: 每个被写入的基址 S 与其他基址 X 满足 X == S 或 |X - S| >= 4 * t2, 否则跳到 fallback
+//   每个基址加上 4 * i0
+// loop:
+//   vsetvli t3, t2, e32, m1, ta, ma             本轮处理 t3 个元素
+//   vle32.v / 运算 / vse32.v                   按循环体中的顺序
+//   每个基址加上 4 * t3, t2 -= t3, t2 不为 0 时继续
+//   返回 n
+// fallback:
+//   返回 i0, 所有元素由调用者中的原循环计算
+// 只使用 a0-a7 和 t2-t6, 不使用窥孔优化假定为临时值的 t0, t1
+
+namespace {
+    const char *const arg_regs[] = {"a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7"};
+
+    const char *const vector_regs[] = {
+        "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7", "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15",
+        "v16", "v17", "v18", "v19", "v20", "v21", "v22", "v23", "v24", "v25", "v26", "v27", "v28", "v29", "v30", "v31",
+    };
+
+    // 运算对应的 .vv 和 .vx 指令
+    RiscvOp vector_op(koopa_raw_binary_op_t op, bool scalar) {
+        switch (op) {
+            case KOOPA_RBO_ADD: return scalar ? RiscvOp::VaddVX : RiscvOp::VaddVV;
+            case KOOPA_RBO_SUB: return scalar ? RiscvOp::VsubVX : RiscvOp::VsubVV;
+            default: return scalar ? RiscvOp::VmulVX : RiscvOp::VmulVV;
+        }
+    }
+}
+
+void KoopaParser::CompileVectorKernel(const koopa_raw_function_t &func) {
+    // %entry, %cond, %body, %end, 循环体和出口的标签分别用作 loop 和 fallback
+    auto cond = slice_at<koopa_raw_basic_block_t>(func->bbs, 1);
+    auto body = terminator(cond)->kind.data.branch.true_bb;
+    auto end = slice_at<koopa_raw_basic_block_t>(func->bbs, 3);
+    auto loop_label = label(body), fallback = label(end);
+    auto param_count = func->params.len;
+    auto i0 = arg_regs[param_count - 2], n = arg_regs[param_count - 1];
+
+    // 参数的寄存器, 以及被写入的基址
+    std::unordered_map<koopa_raw_value_t, const char*> regs;
+    for (uint32_t i = 0; i < param_count; i++) {
+        regs[slice_at<koopa_raw_value_t>(func->params, i)] = arg_regs[i];
+    }
+    std::vector<const char*> bases, stored;
+    for (uint32_t i = 0; i < body->insts.len; i++) {
+        auto inst = slice_at<koopa_raw_value_t>(body->insts, i);
+        if (inst->kind.tag == KOOPA_RVT_GET_PTR) {
+            auto base = regs.at(inst->kind.data.get_ptr.src);
+            regs[inst] = base;
+            bool seen = false;
+            for (auto reg : bases) {
+                seen |= reg == base;
+            }
+            if (!seen) {
+                bases.push_back(base);
+            }
+        } else if (inst->kind.tag == KOOPA_RVT_STORE) {
+            auto base = regs.at(inst->kind.data.store.dest);
+            bool seen = false;
+            for (auto reg : stored) {
+                seen |= reg == base;
+            }
+            if (!seen) {
+                stored.push_back(base);
+            }
+        }
+    }
+
+    code.jump(RiscvOp::Bge, fallback, i0, n);
+    code.inst(RiscvOp::Sub, "t2", n, i0);
+    // 无符号比较 |X - S| - 1 < 4 * t2 - 1, X == S 时左侧为最大值, 不会跳转
+    bool checked = false;
+    for (auto s : stored) {
+        for (auto x : bases) {
+            if (x == s) {
+                continue;
+            }
+            if (!checked) {
+                code.inst_imm(RiscvOp::Slli, "t4", "t2", 2);
+                code.addi("t4", "t4", -1);
+                checked = true;
+            }
+            code.inst(RiscvOp::Sub, "t5", x, s);
+            code.inst_imm(RiscvOp::Srai, "t6", "t5", 31);
+            code.inst(RiscvOp::Xor, "t5", "t5", "t6");
+            code.inst(RiscvOp::Sub, "t5", "t5", "t6");
+            code.addi("t5", "t5", -1);
+            code.jump(RiscvOp::Bltu, fallback, "t5", "t4");
+        }
+    }
+    code.inst_imm(RiscvOp::Slli, "t5", i0, 2);
+    for (auto base : bases) {
+        code.inst(RiscvOp::Add, base, base, "t5");
+    }
+
+    code.label(loop_label);
+    code.inst(RiscvOp::Vsetvli, "t3", "t2");
+    // 向量值依次使用 v1-v31, 标量操作数为常量时加载到 t4
+    int next_vreg = 1;
+    auto scalar = [&](koopa_raw_value_t value) -> const char* {
+        if (value->kind.tag != KOOPA_RVT_INTEGER) {
+            return regs.at(value);
+        }
+        if (!value->kind.data.integer.value) {
+            return "zero";
+        }
+        code.li("t4", value->kind.data.integer.value);
+        return "t4";
+    };
+    std::unordered_map<koopa_raw_value_t, const char*> vregs;
+    for (uint32_t i = 0; i < body->insts.len; i++) {
+        auto inst = slice_at<koopa_raw_value_t>(body->insts, i);
+        auto &kind = inst->kind;
+        switch (kind.tag) {
+            case KOOPA_RVT_LOAD: {
+                auto vd = vregs[inst] = vector_regs[next_vreg++];
+                code.inst(RiscvOp::Vle32, vd, regs.at(kind.data.load.src));
+                break;
+            }
+            case KOOPA_RVT_STORE: {
+                auto value = kind.data.store.value;
+                auto vs = vregs.count(value) ? vregs.at(value) : nullptr;
+                if (!vs) {
+                    vs = vector_regs[next_vreg++];
+                    code.inst(RiscvOp::VmvVX, vs, scalar(value));
+                }
+                code.inst(RiscvOp::Vse32, nullptr, regs.at(kind.data.store.dest), vs);
+                break;
+            }
+            case KOOPA_RVT_BINARY: {
+                auto op = kind.data.binary.op;
+                auto lhs = kind.data.binary.lhs, rhs = kind.data.binary.rhs;
+                if (!vregs.count(lhs) && !vregs.count(rhs)) {
+                    // 下标的递增, 由 vsetvli 的结果代替
+                    break;
+                }
+                auto vd = vregs[inst] = vector_regs[next_vreg++];
+                if (vregs.count(lhs) && vregs.count(rhs)) {
+                    code.inst(vector_op(op, false), vd, vregs.at(lhs), vregs.at(rhs));
+                } else if (vregs.count(lhs)) {
+                    code.inst(vector_op(op, true), vd, vregs.at(lhs), scalar(rhs));
+                } else {
+                    // 标量在左侧: 减法使用 vrsub.vx, 加法和乘法交换操作数
+                    code.inst(op == KOOPA_RBO_SUB ? RiscvOp::VrsubVX : vector_op(op, true), vd, vregs.at(rhs),
+                              scalar(lhs));
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    code.inst_imm(RiscvOp::Slli, "t4", "t3", 2);
+    for (auto base : bases) {
+        code.inst(RiscvOp::Add, base, base, "t4");
+    }
+    code.inst(RiscvOp::Sub, "t2", "t2", "t3");
+    code.jump(RiscvOp::Bnez, loop_label, "t2");
+    code.inst(RiscvOp::Mv, "a0", n);
+    code.inst(RiscvOp::Ret, nullptr);
+
+    code.label(fallback);
+    code.inst(RiscvOp::Mv, "a0", i0);
+    code.inst(RiscvOp::Ret, nullptr);
+}
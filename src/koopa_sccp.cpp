@@ -0,0 +1,233 @@
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+#include "koopa_optimizer.h"
+#include "koopa_util.h"
+
+// 稀疏条件常量传播 (Wegman, Zadeck)
+// 值的格: 未定 (尚未执行到) > 常量 > 不确定, 只会单调下降
+// 同时维护可执行的边: 条件为常量的分支只有一条边可执行, 不可执行的前驱不参与基本块参数的计算
+// 求解后用常量替换值的使用, 删除结果为常量的指令和基本块参数, 条件为常量的分支改为跳转
+// 局部变量已经由 mem2reg 提升, 仍留在内存中的值 (load 的结果) 视为不确定
+
+namespace {
+    struct Lattice {
+        enum State { Top, Const, Bottom } state = Top;
+        int32_t value = 0;
+
+        bool operator!=(const Lattice &other) const {
+            return state != other.state || (state == Const && value != other.value);
+        }
+    };
+
+    Lattice meet(const Lattice &a, const Lattice &b) {
+        if (a.state == Lattice::Top) {
+            return b;
+        }
+        if (b.state == Lattice::Top || (a.state == Lattice::Const && b.state == Lattice::Const &&
+                                        a.value == b.value)) {
+            return a;
+        }
+        return {Lattice::Bottom, 0};
+    }
+}
+
+void KoopaOptimizer::propagate_constants(koopa_raw_function_t func) {
+    auto &bbs = func->bbs;
+    std::unordered_map<koopa_raw_basic_block_t, uint32_t> bb_index;
+    // 指令所在的基本块, 以及每个值的使用者
+    std::unordered_map<koopa_raw_value_t, uint32_t> owner;
+    std::unordered_map<koopa_raw_value_t, std::vector<koopa_raw_value_t>> users;
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+        bb_index[bb] = i;
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            owner[inst] = i;
+            for_each_operand(inst, [&](koopa_raw_value_t operand) {
+                auto &list = users[operand];
+                if (list.empty() || list.back() != inst) {
+                    list.push_back(inst);
+                }
+            });
+        }
+    }
+
+    std::unordered_map<koopa_raw_value_t, Lattice> values;
+    auto get = [&](koopa_raw_value_t value) -> Lattice {
+        if (value->kind.tag == KOOPA_RVT_INTEGER) {
+            return {Lattice::Const, value->kind.data.integer.value};
+        }
+        auto it = values.find(value);
+        return it == values.end() ? Lattice{} : it->second;
+    };
+    std::vector<koopa_raw_value_t> ssa_worklist;
+    auto update = [&](koopa_raw_value_t value, const Lattice &lattice) {
+        auto &old = values[value];
+        auto merged = meet(old, lattice);
+        if (merged != old) {
+            old = merged;
+            ssa_worklist.push_back(value);
+        }
+    };
+
+    std::vector<bool> executable(bbs.len);
+    // 可执行的边, 以 (前驱, 后继) 编号表示
+    std::vector<std::vector<uint32_t>> edges(bbs.len);
+    std::vector<std::pair<uint32_t, uint32_t>> flow_worklist;
+    auto mark_edge = [&](uint32_t from, koopa_raw_basic_block_t to) {
+        flow_worklist.push_back({from, bb_index.at(to)});
+    };
+
+    auto visit = [&](koopa_raw_value_t inst) {
+        auto &kind = inst->kind;
+        switch (kind.tag) {
+            case KOOPA_RVT_BINARY: {
+                auto l = get(kind.data.binary.lhs), r = get(kind.data.binary.rhs);
+                Lattice result;
+                if (l.state == Lattice::Bottom || r.state == Lattice::Bottom) {
+                    result.state = Lattice::Bottom;
+                } else if (l.state == Lattice::Const && r.state == Lattice::Const) {
+                    if (fold_binary(kind.data.binary.op, l.value, r.value, result.value)) {
+                        result.state = Lattice::Const;
+                    } else {
+                        result.state = Lattice::Bottom;
+                    }
+                }
+                update(inst, result);
+                break;
+            }
+            case KOOPA_RVT_BRANCH: {
+                auto &branch = kind.data.branch;
+                auto cond = get(branch.cond);
+                if (cond.state == Lattice::Const) {
+                    mark_edge(owner[inst], cond.value ? branch.true_bb : branch.false_bb);
+                } else if (cond.state == Lattice::Bottom) {
+                    mark_edge(owner[inst], branch.true_bb);
+                    mark_edge(owner[inst], branch.false_bb);
+                }
+                break;
+            }
+            case KOOPA_RVT_JUMP: {
+                // 实参并入目标基本块的参数
+                auto &jump = kind.data.jump;
+                for (uint32_t i = 0; i < jump.args.len; i++) {
+                    update(slice_at<koopa_raw_value_t>(jump.target->params, i),
+                           get(slice_at<koopa_raw_value_t>(jump.args, i)));
+                }
+                mark_edge(owner[inst], jump.target);
+                break;
+            }
+            default:
+                if (is_register_value(inst)) {
+                    update(inst, {Lattice::Bottom, 0});
+                }
+                break;
+        }
+    };
+
+    // 函数参数和入口基本块的参数 (如果有) 来自函数外部
+    for (uint32_t i = 0; i < func->params.len; i++) {
+        update(slice_at<koopa_raw_value_t>(func->params, i), {Lattice::Bottom, 0});
+    }
+    auto entry = slice_at<koopa_raw_basic_block_t>(bbs, 0);
+    for (uint32_t i = 0; i < entry->params.len; i++) {
+        update(slice_at<koopa_raw_value_t>(entry->params, i), {Lattice::Bottom, 0});
+    }
+    executable[0] = true;
+    for (uint32_t j = 0; j < entry->insts.len; j++) {
+        visit(slice_at<koopa_raw_value_t>(entry->insts, j));
+    }
+    while (!flow_worklist.empty() || !ssa_worklist.empty()) {
+        while (!flow_worklist.empty()) {
+            auto edge = flow_worklist.back();
+            flow_worklist.pop_back();
+            auto &out = edges[edge.first];
+            bool known = false;
+            for (auto succ : out) {
+                known |= succ == edge.second;
+            }
+            if (known) {
+                continue;
+            }
+            out.push_back(edge.second);
+            if (!executable[edge.second]) {
+                // 第一次到达的基本块, 访问其中所有指令
+                executable[edge.second] = true;
+                auto bb = slice_at<koopa_raw_basic_block_t>(bbs, edge.second);
+                for (uint32_t j = 0; j < bb->insts.len; j++) {
+                    visit(slice_at<koopa_raw_value_t>(bb->insts, j));
+                }
+            }
+        }
+        while (!ssa_worklist.empty()) {
+            auto value = ssa_worklist.back();
+            ssa_worklist.pop_back();
+            auto it = users.find(value);
+            if (it == users.end()) {
+                continue;
+            }
+            for (auto user : it->second) {
+                if (executable[owner[user]]) {
+                    visit(user);
+                }
+            }
+        }
+    }
+
+    // 用常量替换值的使用
+    int64_t replaced = 0, folded = 0;
+    auto constant = [&](koopa_raw_value_t value) -> koopa_raw_value_t {
+        if (value->kind.tag == KOOPA_RVT_INTEGER) {
+            return nullptr;
+        }
+        auto it = values.find(value);
+        if (it == values.end() || it->second.state != Lattice::Const) {
+            return nullptr;
+        }
+        return _builder.integer(it->second.value);
+    };
+    std::unordered_map<koopa_raw_basic_block_t, std::vector<bool>> keep_params;
+    for (uint32_t i = 0; i < bbs.len; i++) {
+        auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+        std::vector<bool> keep(bb->params.len, true);
+        bool drop = false;
+        for (uint32_t j = 0; j < bb->params.len; j++) {
+            if (constant(slice_at<koopa_raw_value_t>(bb->params, j))) {
+                keep[j] = false;
+                drop = true;
+            }
+        }
+        if (drop) {
+            keep_params[bb] = std::move(keep);
+        }
+
+        std::vector<koopa_raw_value_t> insts;
+        for (uint32_t j = 0; j < bb->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(bb->insts, j);
+            if (inst->kind.tag == KOOPA_RVT_BINARY && constant(inst)) {
+                continue;
+            }
+            for_each_operand_ref(inst, [&](koopa_raw_value_t &operand) {
+                if (auto number = constant(operand)) {
+                    operand = number;
+                    replaced++;
+                }
+            });
+            auto &kind = inst->kind;
+            if (kind.tag == KOOPA_RVT_BRANCH && kind.data.branch.cond->kind.tag == KOOPA_RVT_INTEGER) {
+                // 只有一条边可执行, 分支改为跳转
+                auto &branch = kind.data.branch;
+                auto target = branch.cond->kind.data.integer.value ? branch.true_bb : branch.false_bb;
+                inst = _builder.new_jump(target, {});
+                folded++;
+            }
+            insts.push_back(inst);
+        }
+        mutable_block(bb)->insts = _builder.make_slice(insts, KOOPA_RSIK_VALUE);
+    }
+    remove_params(func, keep_params);
+
+    count("constant uses", replaced);
+    count("folded branches", folded);
+}
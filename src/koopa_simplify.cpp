@@ -0,0 +1,192 @@
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "koopa.h"
+#include "koopa_cfg.h"
+#include "koopa_optimizer.h"
+#include "koopa_util.h"
+
+// 控制流图化简, 重复以下变换直到不再变化
+// 1. 两个目标相同的分支改为跳转
+// 2. 跳转穿过只含一条 jump 的基本块, 直接到达其目标
+//    分支不携带实参, 只能穿过不传递实参的基本块
+// 3. 只有一个后继的基本块与其唯一的前驱合并, 后继的参数替换为前驱传递的实参
+// 4. 删除变换后不可达的基本块
+
+namespace {
+    // 只含一条 jump 的基本块, 跳转目标不能是自身
+    bool is_empty(koopa_raw_basic_block_t bb) {
+        if (bb->insts.len != 1) {
+            return false;
+        }
+        auto inst = terminator(bb);
+        return inst->kind.tag == KOOPA_RVT_JUMP && inst->kind.data.jump.target != bb;
+    }
+
+
+    // 实参是基本块的参数时, 替换为到达该基本块时传递的实参
+    koopa_raw_value_t substitute(koopa_raw_value_t value, koopa_raw_basic_block_t bb,
+                                 const koopa_raw_slice_t &args) {
+        if (value->kind.tag == KOOPA_RVT_BLOCK_ARG_REF) {
+            auto index = value->kind.data.block_arg_ref.index;
+            if (index < bb->params.len && slice_at<koopa_raw_value_t>(bb->params, index) == value) {
+                return slice_at<koopa_raw_value_t>(args, index);
+            }
+        }
+        return value;
+    }
+}
+
+void KoopaOptimizer::simplify_cfg(koopa_raw_function_t func) {
+    auto &bbs = mutable_function(func)->bbs;
+    auto entry = slice_at<koopa_raw_basic_block_t>(bbs, 0);
+    int64_t folded = 0, threaded = 0, merged = 0, removed = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+
+        // 删除不可达的基本块, 保持原有的排列顺序
+        ControlFlowGraph cfg(func);
+        std::vector<koopa_raw_basic_block_t> blocks;
+        for (uint32_t i = 0; i < bbs.len; i++) {
+            auto bb = slice_at<koopa_raw_basic_block_t>(bbs, i);
+            if (cfg.reachable(bb)) {
+                blocks.push_back(bb);
+            }
+        }
+        removed += bbs.len - blocks.size();
+
+        // 在所属基本块之外被使用的参数, 含有这样的参数的基本块不能穿过
+        std::unordered_set<koopa_raw_value_t> escaped;
+        for (auto bb : blocks) {
+            std::unordered_set<koopa_raw_value_t> params;
+            for (uint32_t i = 0; i < bb->params.len; i++) {
+                params.insert(slice_at<koopa_raw_value_t>(bb->params, i));
+            }
+            for (uint32_t i = 0; i < bb->insts.len; i++) {
+                for_each_operand(slice_at<koopa_raw_value_t>(bb->insts, i), [&](koopa_raw_value_t operand) {
+                    if (operand->kind.tag == KOOPA_RVT_BLOCK_ARG_REF && !params.count(operand)) {
+                        escaped.insert(operand);
+                    }
+                });
+            }
+        }
+        // 可以穿过的基本块
+        // 目标同样为空时不穿过, 由目标先穿过, 避免在只含空基本块的环路中反复穿过
+        auto is_forwarder = [&](koopa_raw_basic_block_t bb) {
+            if (!is_empty(bb) || is_empty(terminator(bb)->kind.data.jump.target)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < bb->params.len; i++) {
+                if (escaped.count(slice_at<koopa_raw_value_t>(bb->params, i))) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        for (auto bb : blocks) {
+            auto index = bb->insts.len - 1;
+            auto &kind = mutable_value(terminator(bb))->kind;
+            if (kind.tag == KOOPA_RVT_BRANCH) {
+                auto &branch = kind.data.branch;
+                for (auto target : {&branch.true_bb, &branch.false_bb}) {
+                    auto next = *target;
+                    if (is_forwarder(next) && !terminator(next)->kind.data.jump.args.len) {
+                        *target = terminator(next)->kind.data.jump.target;
+                        threaded++;
+                        changed = true;
+                    }
+                }
+                if (branch.true_bb == branch.false_bb) {
+                    bb->insts.buffer[index] = _builder.new_jump(branch.true_bb, {});
+                    folded++;
+                    changed = true;
+                }
+            } else if (kind.tag == KOOPA_RVT_JUMP) {
+                auto &jump = kind.data.jump;
+                auto next = jump.target;
+                if (next != bb && is_forwarder(next)) {
+                    auto &forward = terminator(next)->kind.data.jump;
+                    std::vector<koopa_raw_value_t> args;
+                    for (uint32_t i = 0; i < forward.args.len; i++) {
+                        args.push_back(substitute(slice_at<koopa_raw_value_t>(forward.args, i), next, jump.args));
+                    }
+                    jump.target = forward.target;
+                    jump.args = _builder.make_slice(args, KOOPA_RSIK_VALUE);
+                    threaded++;
+                    changed = true;
+                }
+            }
+        }
+
+        // 按边计数的前驱数量, 同一分支的两条边分别计数
+        std::unordered_map<koopa_raw_basic_block_t, uint32_t> preds;
+        for (auto bb : blocks) {
+            for_each_successor(terminator(bb), [&](koopa_raw_basic_block_t succ) {
+                preds[succ]++;
+            });
+        }
+        // 合并后继的参数被替换为的值
+        std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+        std::unordered_set<koopa_raw_basic_block_t> dead;
+        for (auto bb : blocks) {
+            if (dead.count(bb)) {
+                continue;
+            }
+            for (;;) {
+                auto last = terminator(bb);
+                if (last->kind.tag != KOOPA_RVT_JUMP) {
+                    break;
+                }
+                auto next = last->kind.data.jump.target;
+                if (next == bb || next == entry || preds[next] != 1) {
+                    break;
+                }
+                auto &args = last->kind.data.jump.args;
+                for (uint32_t i = 0; i < next->params.len; i++) {
+                    replace[slice_at<koopa_raw_value_t>(next->params, i)] = slice_at<koopa_raw_value_t>(args, i);
+                }
+                std::vector<koopa_raw_value_t> insts;
+                for (uint32_t i = 0; i + 1 < bb->insts.len; i++) {
+                    insts.push_back(slice_at<koopa_raw_value_t>(bb->insts, i));
+                }
+                for (uint32_t i = 0; i < next->insts.len; i++) {
+                    insts.push_back(slice_at<koopa_raw_value_t>(next->insts, i));
+                }
+                mutable_block(bb)->insts = _builder.make_slice(insts, KOOPA_RSIK_VALUE);
+                dead.insert(next);
+                merged++;
+                changed = true;
+            }
+        }
+        if (!dead.empty()) {
+            std::vector<koopa_raw_basic_block_t> kept;
+            for (auto bb : blocks) {
+                if (!dead.count(bb)) {
+                    kept.push_back(bb);
+                }
+            }
+            blocks.swap(kept);
+        }
+        if (!replace.empty()) {
+            for (auto bb : blocks) {
+                for (uint32_t i = 0; i < bb->insts.len; i++) {
+                    for_each_operand_ref(slice_at<koopa_raw_value_t>(bb->insts, i), [&](koopa_raw_value_t &operand) {
+                        // 被合并的基本块可能连续出现, 替换为最终的值
+                        for (auto it = replace.find(operand); it != replace.end(); it = replace.find(operand)) {
+                            operand = it->second;
+                        }
+                    });
+                }
+            }
+        }
+        if (blocks.size() < bbs.len) {
+            bbs = _builder.make_slice(blocks, KOOPA_RSIK_BASIC_BLOCK);
+        }
+    }
+
+    count("removed blocks", removed);
+    count("folded branches", folded);
+    count("threaded jumps", threaded);
+    count("merged blocks", merged);
+}
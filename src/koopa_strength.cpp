@@ -0,0 +1,177 @@
+#include <cassert>
+#include <cstdint>
+#include "koopa.h"
+#include "koopa_parser.h"
+
+// 常量乘除法的强度削弱
+// 乘法: 2 的幂次改为移位, 2^k ± 1 改为移位和加减
+// 除法: 2 的幂次加上负数的舍入偏置后算术右移, 其他常量使用 mulh 乘以魔数 (Hacker's Delight 10-4)
+// 取模: 由商计算 l - q * c
+// 结果均按向零取整, 与 div/rem 相同; 除数为 0 和 INT_MIN 时保留 div/rem
+
+namespace {
+    bool is_power_of_two(uint32_t n) {
+        return n && !(n & (n - 1));
+    }
+
+    int log2(uint32_t n) {
+        int k = 0;
+        while (n >>= 1) {
+            k++;
+        }
+        return k;
+    }
+
+    // 有符号除以 d (d >= 2) 的魔数和移位量
+    struct Magic {
+        int32_t multiplier;
+        int shift;
+    };
+
+    Magic magic(uint32_t d) {
+        const uint32_t two31 = 0x80000000u;
+        uint32_t anc = two31 - 1 - two31 % d;
+        uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+        uint32_t q2 = two31 / d, r2 = two31 - q2 * d;
+        uint32_t delta;
+        int p = 31;
+        do {
+            p++;
+            q1 *= 2;
+            r1 *= 2;
+            if (r1 >= anc) {
+                q1++;
+                r1 -= anc;
+            }
+            q2 *= 2;
+            r2 *= 2;
+            if (r2 >= d) {
+                q2++;
+                r2 -= d;
+            }
+            delta = d - r2;
+        } while (q1 < delta || (q1 == delta && r1 == 0));
+        return {static_cast<int32_t>(q2 + 1), p - 32};
+    }
+}
+
+// d = src * c, 只使用移位和加减, 不能时返回 false, tmp 不能与 src 相同
+bool KoopaParser::multiply_cheap(const char *d, const char *src, int32_t c, const char *tmp) {
+    auto u = static_cast<uint32_t>(c);
+    if (c == 0) {
+        code.li(d, 0);
+    } else if (c == 1) {
+        code.inst(RiscvOp::Mv, d, src);
+    } else if (c == -1) {
+        code.inst(RiscvOp::Sub, d, "x0", src);
+    } else if (is_power_of_two(u)) {
+        code.inst_imm(RiscvOp::Slli, d, src, log2(u));
+    } else if (is_power_of_two(-u)) {
+        code.inst_imm(RiscvOp::Slli, d, src, log2(-u));
+        code.inst(RiscvOp::Sub, d, "x0", d);
+    } else if (is_power_of_two(u - 1)) {
+        code.inst_imm(RiscvOp::Slli, tmp, src, log2(u - 1));
+        code.inst(RiscvOp::Add, d, tmp, src);
+    } else if (is_power_of_two(u + 1)) {
+        code.inst_imm(RiscvOp::Slli, tmp, src, log2(u + 1));
+        code.inst(RiscvOp::Sub, d, tmp, src);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// t1 = floor(l / c), c 不是 2 的幂次, 被除数为负时还需要加 1 才是向零取整的商
+void KoopaParser::divide_magic(const char *l, uint32_t c) {
+    auto m = magic(c);
+    code.li("t1", m.multiplier);
+    code.inst(RiscvOp::Mulh, "t1", l, "t1");
+    // 魔数超过 2^31 时按负数相乘, 需要加回被除数
+    if (m.multiplier < 0) {
+        code.inst(RiscvOp::Add, "t1", "t1", l);
+    }
+    if (m.shift) {
+        code.inst_imm(RiscvOp::Srai, "t1", "t1", m.shift);
+    }
+}
+
+bool KoopaParser::CompileBinaryStrength(koopa_raw_binary_op_t op, const char *d,
+                                        const koopa_raw_value_t &lhs, int32_t c) {
+    if (op == KOOPA_RBO_MUL) {
+        // 只在不需要 li 和 mul 时削弱
+        auto u = static_cast<uint32_t>(c);
+        if (!c || is_power_of_two(u) || is_power_of_two(-u) || is_power_of_two(u - 1) || is_power_of_two(u + 1)) {
+            auto l = load_value(lhs, "t0");
+            bool done = multiply_cheap(d, l, c, "t1");
+            assert(done);
+            (void)done;
+            return true;
+        }
+        return false;
+    }
+    if ((op != KOOPA_RBO_DIV && op != KOOPA_RBO_MOD) || c == 0 || c == INT32_MIN) {
+        return false;
+    }
+    auto a = static_cast<uint32_t>(c < 0 ? -c : c);
+    bool power = is_power_of_two(a);
+    if (op == KOOPA_RBO_MOD && !power && a != 1 && !reg_map.count(lhs)) {
+        // 取模需要保留被除数, 被除数不在寄存器中时 t0, t1 不够用
+        return false;
+    }
+    auto l = load_value(lhs, "t0");
+    if (a == 1) {
+        if (op == KOOPA_RBO_MOD) {
+            code.li(d, 0);
+        } else if (c > 0) {
+            code.inst(RiscvOp::Mv, d, l);
+        } else {
+            code.inst(RiscvOp::Sub, d, "x0", l);
+        }
+        return true;
+    }
+    if (power) {
+        // 被除数为负时加上 |c| - 1, 使算术右移向零取整
+        int k = log2(a);
+        if (k == 1) {
+            code.inst_imm(RiscvOp::Srli, "t1", l, 31);
+        } else {
+            code.inst_imm(RiscvOp::Srai, "t1", l, 31);
+            code.inst_imm(RiscvOp::Srli, "t1", "t1", 32 - k);
+        }
+        code.inst(RiscvOp::Add, "t1", l, "t1");
+        if (op == KOOPA_RBO_DIV) {
+            code.inst_imm(RiscvOp::Srai, d, "t1", k);
+            if (c < 0) {
+                code.inst(RiscvOp::Sub, d, "x0", d);
+            }
+        } else {
+            // 清除低 k 位得到 q * |c|, 余数的符号与被除数相同
+            if (is_imm12(-static_cast<int64_t>(a))) {
+                code.inst_imm(RiscvOp::Andi, "t1", "t1", -static_cast<int32_t>(a));
+            } else {
+                code.inst_imm(RiscvOp::Srai, "t1", "t1", k);
+                code.inst_imm(RiscvOp::Slli, "t1", "t1", k);
+            }
+            code.inst(RiscvOp::Sub, d, l, "t1");
+        }
+        return true;
+    }
+    divide_magic(l, a);
+    // 被除数为负时商加 1, 除数为负时再取相反数: q = (l >> 31) - t1
+    if (op == KOOPA_RBO_DIV && c < 0) {
+        code.inst_imm(RiscvOp::Srai, "t0", l, 31);
+        code.inst(RiscvOp::Sub, d, "t0", "t1");
+    } else if (op == KOOPA_RBO_DIV) {
+        code.inst_imm(RiscvOp::Srli, "t0", l, 31);
+        code.inst(RiscvOp::Add, d, "t1", "t0");
+    } else {
+        code.inst_imm(RiscvOp::Srli, "t0", l, 31);
+        code.inst(RiscvOp::Add, "t1", "t1", "t0");
+        if (!multiply_cheap("t1", "t1", a, "t0")) {
+            code.li("t0", a);
+            code.inst(RiscvOp::Mul, "t1", "t1", "t0");
+        }
+        code.inst(RiscvOp::Sub, d, l, "t1");
+    }
+    return true;
+}
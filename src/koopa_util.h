@@ -0,0 +1,256 @@
+#ifndef __KOOPA_UTIL_H__
+#define __KOOPA_UTIL_H__
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include "koopa.h"
+
+// raw program 遍历的公共工具
+
+// 按下标取出 slice 中的元素
+template <typename T>
+inline T slice_at(const koopa_raw_slice_t &slice, uint32_t i) {
+    return reinterpret_cast<T>(slice.buffer[i]);
+}
+
+// 基本块的结束指令
+inline koopa_raw_value_t terminator(koopa_raw_basic_block_t bb) {
+    assert(bb->insts.len > 0 && "empty basic block");
+    return slice_at<koopa_raw_value_t>(bb->insts, bb->insts.len - 1);
+}
+
+// 指令的结果是否需要寄存器保存: 有返回值且不是栈上的内存分配
+inline bool is_register_value(koopa_raw_value_t value) {
+    return value->ty->tag != KOOPA_RTT_UNIT && value->kind.tag != KOOPA_RVT_ALLOC;
+}
+
+// 类型占用的字节数, 指针与 i32 相同为 4 字节
+inline int type_size(koopa_raw_type_t ty) {
+    switch (ty->tag) {
+        case KOOPA_RTT_INT32:
+        case KOOPA_RTT_POINTER:
+            return 4;
+        case KOOPA_RTT_ARRAY:
+            return static_cast<int>(ty->data.array.len) * type_size(ty->data.array.base);
+        default:
+            return 0;
+    }
+}
+
+// 地址计算: getptr 和 getelemptr 的结果为 src + index * 步长
+inline bool is_address(koopa_raw_value_t value) {
+    return value->kind.tag == KOOPA_RVT_GET_PTR || value->kind.tag == KOOPA_RVT_GET_ELEM_PTR;
+}
+
+// 地址计算的源指针和下标, 两种指令的数据布局相同
+inline koopa_raw_value_t address_src(koopa_raw_value_t value) {
+    return value->kind.tag == KOOPA_RVT_GET_PTR ? value->kind.data.get_ptr.src : value->kind.data.get_elem_ptr.src;
+}
+inline koopa_raw_value_t address_index(koopa_raw_value_t value) {
+    return value->kind.tag == KOOPA_RVT_GET_PTR ? value->kind.data.get_ptr.index
+                                                : value->kind.data.get_elem_ptr.index;
+}
+
+// 下标每增加 1 地址增加的字节数, 即结果指向的类型的大小
+inline int address_stride(koopa_raw_value_t value) {
+    return type_size(value->ty->data.pointer.base);
+}
+
+// 遍历指令的所有操作数
+template <typename F>
+inline void for_each_operand(koopa_raw_value_t value, F &&f) {
+    auto &kind = value->kind;
+    switch (kind.tag) {
+        case KOOPA_RVT_LOAD:
+            f(kind.data.load.src);
+            break;
+        case KOOPA_RVT_STORE:
+            f(kind.data.store.value);
+            f(kind.data.store.dest);
+            break;
+        case KOOPA_RVT_GET_PTR:
+            f(kind.data.get_ptr.src);
+            f(kind.data.get_ptr.index);
+            break;
+        case KOOPA_RVT_GET_ELEM_PTR:
+            f(kind.data.get_elem_ptr.src);
+            f(kind.data.get_elem_ptr.index);
+            break;
+        case KOOPA_RVT_BINARY:
+            f(kind.data.binary.lhs);
+            f(kind.data.binary.rhs);
+            break;
+        case KOOPA_RVT_BRANCH:
+            f(kind.data.branch.cond);
+            for (uint32_t i = 0; i < kind.data.branch.true_args.len; i++) {
+                f(slice_at<koopa_raw_value_t>(kind.data.branch.true_args, i));
+            }
+            for (uint32_t i = 0; i < kind.data.branch.false_args.len; i++) {
+                f(slice_at<koopa_raw_value_t>(kind.data.branch.false_args, i));
+            }
+            break;
+        case KOOPA_RVT_JUMP:
+            for (uint32_t i = 0; i < kind.data.jump.args.len; i++) {
+                f(slice_at<koopa_raw_value_t>(kind.data.jump.args, i));
+            }
+            break;
+        case KOOPA_RVT_CALL:
+            for (uint32_t i = 0; i < kind.data.call.args.len; i++) {
+                f(slice_at<koopa_raw_value_t>(kind.data.call.args, i));
+            }
+            break;
+        case KOOPA_RVT_RETURN:
+            if (kind.data.ret.value) {
+                f(kind.data.ret.value);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// 可修改的 raw 数据
+// raw program 的数据均由 KoopaBuilder 分配, 优化 pass 可以直接修改
+inline koopa_raw_value_data_t *mutable_value(koopa_raw_value_t value) {
+    return const_cast<koopa_raw_value_data_t*>(value);
+}
+inline koopa_raw_basic_block_data_t *mutable_block(koopa_raw_basic_block_t bb) {
+    return const_cast<koopa_raw_basic_block_data_t*>(bb);
+}
+inline koopa_raw_function_data_t *mutable_function(koopa_raw_function_t func) {
+    return const_cast<koopa_raw_function_data_t*>(func);
+}
+
+// 遍历指令的所有操作数, f 接收操作数的引用, 可以就地替换
+template <typename F>
+inline void for_each_operand_ref(koopa_raw_value_t value, F &&f) {
+    auto &kind = mutable_value(value)->kind;
+    auto each_arg = [&](koopa_raw_slice_t &args) {
+        for (uint32_t i = 0; i < args.len; i++) {
+            f(reinterpret_cast<koopa_raw_value_t&>(args.buffer[i]));
+        }
+    };
+    switch (kind.tag) {
+        case KOOPA_RVT_LOAD:
+            f(kind.data.load.src);
+            break;
+        case KOOPA_RVT_STORE:
+            f(kind.data.store.value);
+            f(kind.data.store.dest);
+            break;
+        case KOOPA_RVT_GET_PTR:
+            f(kind.data.get_ptr.src);
+            f(kind.data.get_ptr.index);
+            break;
+        case KOOPA_RVT_GET_ELEM_PTR:
+            f(kind.data.get_elem_ptr.src);
+            f(kind.data.get_elem_ptr.index);
+            break;
+        case KOOPA_RVT_BINARY:
+            f(kind.data.binary.lhs);
+            f(kind.data.binary.rhs);
+            break;
+        case KOOPA_RVT_BRANCH:
+            f(kind.data.branch.cond);
+            each_arg(kind.data.branch.true_args);
+            each_arg(kind.data.branch.false_args);
+            break;
+        case KOOPA_RVT_JUMP:
+            each_arg(kind.data.jump.args);
+            break;
+        case KOOPA_RVT_CALL:
+            each_arg(kind.data.call.args);
+            break;
+        case KOOPA_RVT_RETURN:
+            if (kind.data.ret.value) {
+                f(kind.data.ret.value);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// 遍历结束指令的所有后继基本块
+template <typename F>
+inline void for_each_successor(koopa_raw_value_t value, F &&f) {
+    auto &kind = value->kind;
+    switch (kind.tag) {
+        case KOOPA_RVT_BRANCH:
+            f(kind.data.branch.true_bb);
+            f(kind.data.branch.false_bb);
+            break;
+        case KOOPA_RVT_JUMP:
+            f(kind.data.jump.target);
+            break;
+        default:
+            break;
+    }
+}
+
+// 计算整数二元运算, 结果按 32 位回绕
+// 除数为 0 以及溢出的除法在运行时才有意义, 不做计算, 返回 false
+inline bool fold_binary(koopa_raw_binary_op_t op, int32_t lhs, int32_t rhs, int32_t &result) {
+    auto l = static_cast<uint32_t>(lhs), r = static_cast<uint32_t>(rhs);
+    switch (op) {
+        case KOOPA_RBO_NOT_EQ: result = lhs != rhs; break;
+        case KOOPA_RBO_EQ: result = lhs == rhs; break;
+        case KOOPA_RBO_GT: result = lhs > rhs; break;
+        case KOOPA_RBO_LT: result = lhs < rhs; break;
+        case KOOPA_RBO_GE: result = lhs >= rhs; break;
+        case KOOPA_RBO_LE: result = lhs <= rhs; break;
+        case KOOPA_RBO_ADD: result = static_cast<int32_t>(l + r); break;
+        case KOOPA_RBO_SUB: result = static_cast<int32_t>(l - r); break;
+        case KOOPA_RBO_MUL: result = static_cast<int32_t>(l * r); break;
+        case KOOPA_RBO_DIV:
+        case KOOPA_RBO_MOD:
+            if (rhs == 0 || (lhs == INT32_MIN && rhs == -1)) {
+                return false;
+            }
+            result = op == KOOPA_RBO_DIV ? lhs / rhs : lhs % rhs;
+            break;
+        case KOOPA_RBO_AND: result = lhs & rhs; break;
+        case KOOPA_RBO_OR: result = lhs | rhs; break;
+        case KOOPA_RBO_XOR: result = lhs ^ rhs; break;
+        case KOOPA_RBO_SHL: result = static_cast<int32_t>(l << (r & 31)); break;
+        case KOOPA_RBO_SHR: result = static_cast<int32_t>(l >> (r & 31)); break;
+        case KOOPA_RBO_SAR: result = lhs >> (r & 31); break;
+        default: return false;
+    }
+    return true;
+}
+
+// 数据流分析使用的位集合
+class BitSet {
+private:
+    std::vector<uint64_t> _bits;
+public:
+    explicit BitSet(size_t n = 0) : _bits((n + 63) / 64) {}
+    void set(size_t i) { _bits[i / 64] |= uint64_t(1) << (i % 64); }
+    void reset(size_t i) { _bits[i / 64] &= ~(uint64_t(1) << (i % 64)); }
+    bool test(size_t i) const { return _bits[i / 64] >> (i % 64) & 1; }
+    // this |= other & ~mask, 返回是否发生变化
+    bool merge(const BitSet &other, const BitSet *mask = nullptr) {
+        bool changed = false;
+        for (size_t i = 0; i < _bits.size(); i++) {
+            auto bits = other._bits[i];
+            if (mask) bits &= ~mask->_bits[i];
+            if (bits & ~_bits[i]) {
+                _bits[i] |= bits;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+    template <typename F>
+    void for_each(F &&f) const {
+        for (size_t i = 0; i < _bits.size(); i++) {
+            for (auto bits = _bits[i]; bits; bits &= bits - 1) {
+                f(i * 64 + __builtin_ctzll(bits));
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,284 @@
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "koopa.h"
+#include "koopa_cfg.h"
+#include "koopa_optimizer.h"
+#include "koopa_util.h"
+
+// 逐元素循环的向量化
+// 只处理如下形式的循环, 首部在循环外只有一个以 jump 进入的前置基本块:
+//   %header(i):  c = lt i, n; br c, %body, %exit     n 为循环不变量
+//   %body:       逐元素的计算; i1 = add i, 1; jump %header(i1)
+// 循环体中的地址都是 getptr/getelemptr src, i, src 为循环不变量, 结果指向 i32
+// 其余指令只能是这些地址的 load/store, 以及至少有一个操作数来自 load 的 add/sub/mul
+//
+// 循环体提取为函数 @<函数名>.vec<k>(基址..., 标量..., i0, n), 计算下标 i0 到 n - 1 的所有元素后返回 n
+// 前置基本块调用它, 原循环从返回值开始执行剩余的迭代, 作为标量的回退
+// 函数本身仍是等价的标量循环, 提取出的函数记录在 _kernels 中, 后端将其编译为 RVV 的分段循环, 见 koopa_rvv.cpp
+// 后端在数组的区间部分重叠时直接返回 i0, 全部元素由原循环计算
+
+namespace {
+    // 参数都经过 a0-a7 传递
+    constexpr size_t max_kernel_params = 8;
+    // v0 保留给掩码, 每个向量值和存储的标量各使用一个向量寄存器
+    constexpr size_t max_vector_regs = 31;
+
+    // 循环体中的指令可以逐元素并行计算时, 记录提取函数需要的信息
+    struct Kernel {
+        koopa_raw_basic_block_t preheader, header, body;
+        koopa_raw_value_t i, n, init, inc;
+        // 基址和标量按第一次出现的顺序排列, 成为函数的参数
+        std::vector<koopa_raw_value_t> bases, scalars;
+    };
+
+    bool contains(const std::vector<koopa_raw_value_t> &values, koopa_raw_value_t value) {
+        for (auto item : values) {
+            if (item == value) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool match_kernel(const ControlFlowGraph &cfg, const Loop &loop, Kernel &kernel) {
+        if (loop.header == 0 || loop.blocks.size() != 2 || loop.latches.size() != 1 ||
+            cfg.preds[loop.header].size() != 2) {
+            return false;
+        }
+        auto header = cfg.blocks[loop.header], body = cfg.blocks[loop.latches[0]];
+        if (header == body) {
+            return false;
+        }
+        for (auto pred : cfg.preds[loop.header]) {
+            if (!loop.contains(pred)) {
+                kernel.preheader = cfg.blocks[pred];
+            }
+        }
+        if (terminator(kernel.preheader)->kind.tag != KOOPA_RVT_JUMP || terminator(body)->kind.tag != KOOPA_RVT_JUMP) {
+            return false;
+        }
+        kernel.header = header;
+        kernel.body = body;
+
+        // 首部: c = lt i, n; br c, %body, %exit
+        if (header->params.len != 1 || header->insts.len != 2) {
+            return false;
+        }
+        auto i = slice_at<koopa_raw_value_t>(header->params, 0);
+        auto cmp = slice_at<koopa_raw_value_t>(header->insts, 0);
+        auto br = terminator(header);
+        if (cmp->kind.tag != KOOPA_RVT_BINARY || cmp->kind.data.binary.op != KOOPA_RBO_LT ||
+            cmp->kind.data.binary.lhs != i || br->kind.tag != KOOPA_RVT_BRANCH ||
+            br->kind.data.branch.cond != cmp || br->kind.data.branch.true_bb != body) {
+            return false;
+        }
+        kernel.i = i;
+        kernel.n = cmp->kind.data.binary.rhs;
+        kernel.init = slice_at<koopa_raw_value_t>(terminator(kernel.preheader)->kind.data.jump.args, 0);
+        kernel.inc = slice_at<koopa_raw_value_t>(terminator(body)->kind.data.jump.args, 0);
+
+        // 循环中定义的值
+        std::unordered_set<koopa_raw_value_t> local = {i, cmp};
+        for (uint32_t j = 0; j < body->insts.len; j++) {
+            local.insert(slice_at<koopa_raw_value_t>(body->insts, j));
+        }
+        if (local.count(kernel.n)) {
+            return false;
+        }
+        auto &inc = kernel.inc->kind;
+        if (!local.count(kernel.inc) || inc.tag != KOOPA_RVT_BINARY || inc.data.binary.op != KOOPA_RBO_ADD ||
+            inc.data.binary.lhs != i || inc.data.binary.rhs->kind.tag != KOOPA_RVT_INTEGER ||
+            inc.data.binary.rhs->kind.data.integer.value != 1) {
+            return false;
+        }
+
+        // 逐条检查循环体, 地址和向量值只能在定义之后使用
+        std::unordered_set<koopa_raw_value_t> addresses, vectors;
+        size_t stores = 0, scalar_stores = 0;
+        auto scalar = [&](koopa_raw_value_t value) {
+            if (local.count(value)) {
+                return false;
+            }
+            if (value->kind.tag != KOOPA_RVT_INTEGER && !contains(kernel.scalars, value)) {
+                kernel.scalars.push_back(value);
+            }
+            return true;
+        };
+        for (uint32_t j = 0; j + 1 < body->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(body->insts, j);
+            auto &kind = inst->kind;
+            if (inst == kernel.inc) {
+                continue;
+            }
+            switch (kind.tag) {
+                case KOOPA_RVT_GET_PTR:
+                case KOOPA_RVT_GET_ELEM_PTR: {
+                    auto src = address_src(inst);
+                    if (address_index(inst) != i || local.count(src) ||
+                        inst->ty->data.pointer.base->tag != KOOPA_RTT_INT32) {
+                        return false;
+                    }
+                    if (!contains(kernel.bases, src)) {
+                        kernel.bases.push_back(src);
+                    }
+                    addresses.insert(inst);
+                    break;
+                }
+                case KOOPA_RVT_LOAD:
+                    if (!addresses.count(kind.data.load.src)) {
+                        return false;
+                    }
+                    vectors.insert(inst);
+                    break;
+                case KOOPA_RVT_STORE:
+                    if (!addresses.count(kind.data.store.dest) ||
+                        !(vectors.count(kind.data.store.value) || scalar(kind.data.store.value))) {
+                        return false;
+                    }
+                    stores++;
+                    scalar_stores += !vectors.count(kind.data.store.value);
+                    break;
+                case KOOPA_RVT_BINARY: {
+                    auto op = kind.data.binary.op;
+                    auto lhs = kind.data.binary.lhs, rhs = kind.data.binary.rhs;
+                    if (op != KOOPA_RBO_ADD && op != KOOPA_RBO_SUB && op != KOOPA_RBO_MUL) {
+                        return false;
+                    }
+                    bool l = vectors.count(lhs), r = vectors.count(rhs);
+                    if (!(l || r) || !(l || scalar(lhs)) || !(r || scalar(rhs))) {
+                        return false;
+                    }
+                    vectors.insert(inst);
+                    break;
+                }
+                default:
+                    return false;
+            }
+        }
+        return stores > 0 && vectors.size() + scalar_stores <= max_vector_regs &&
+               kernel.bases.size() + kernel.scalars.size() + 2 <= max_kernel_params;
+    }
+
+    // 在基本块的结束指令之前插入指令
+    std::vector<koopa_raw_value_t> insts_with(koopa_raw_basic_block_t bb, const std::vector<koopa_raw_value_t> &extra) {
+        std::vector<koopa_raw_value_t> insts;
+        for (uint32_t i = 0; i + 1 < bb->insts.len; i++) {
+            insts.push_back(slice_at<koopa_raw_value_t>(bb->insts, i));
+        }
+        insts.insert(insts.end(), extra.begin(), extra.end());
+        insts.push_back(terminator(bb));
+        return insts;
+    }
+}
+
+void KoopaOptimizer::vectorize_loops(koopa_raw_function_t func) {
+    ControlFlowGraph cfg(func);
+    auto loops = cfg.natural_loops();
+    int64_t vectorized = 0;
+    for (auto &loop : loops) {
+        Kernel kernel;
+        if (!match_kernel(cfg, loop, kernel)) {
+            continue;
+        }
+        auto i32 = _builder.i32_type(), i32_ptr = _builder.pointer_type(i32);
+        std::vector<koopa_raw_type_t> types(kernel.bases.size(), i32_ptr);
+        types.insert(types.end(), kernel.scalars.size() + 2, i32);
+        auto name = std::string(func->name + 1) + ".vec" + std::to_string(_kernels.size());
+        auto vec = _builder.create_function(name, types, true);
+        auto param = [&](size_t index) {
+            return slice_at<koopa_raw_value_t>(vec->params, index);
+        };
+
+        // 函数体: 与原循环相同的标量循环, 基址改为 *i32 的参数
+        auto entry = _builder.new_block("%entry");
+        auto cond = _builder.new_block("%cond");
+        auto body = _builder.new_block("%body");
+        auto end = _builder.new_block("%end");
+        auto i = _builder.new_value(i32, KOOPA_RVT_BLOCK_ARG_REF);
+        i->kind.data.block_arg_ref.index = 0;
+        std::vector<koopa_raw_value_t> params = {i};
+        cond->params = _builder.make_slice(params, KOOPA_RSIK_VALUE);
+        auto i0 = param(types.size() - 2), n = param(types.size() - 1);
+        std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> map = {{kernel.i, i}};
+        for (size_t k = 0; k < kernel.scalars.size(); k++) {
+            map[kernel.scalars[k]] = param(kernel.bases.size() + k);
+        }
+        auto remap = [&](koopa_raw_value_t &value) {
+            auto found = map.find(value);
+            if (found != map.end()) {
+                value = found->second;
+            }
+        };
+
+        std::vector<koopa_raw_value_t> insts = {_builder.new_jump(cond, {i0})};
+        entry->insts = _builder.make_slice(insts, KOOPA_RSIK_VALUE);
+        auto c = _builder.new_value(i32, KOOPA_RVT_BINARY);
+        c->kind.data.binary = {KOOPA_RBO_LT, i, n};
+        auto br = _builder.new_value(_builder.unit_type(), KOOPA_RVT_BRANCH);
+        br->kind.data.branch.cond = c;
+        br->kind.data.branch.true_bb = body;
+        br->kind.data.branch.false_bb = end;
+        br->kind.data.branch.true_args = _builder.empty_slice(KOOPA_RSIK_VALUE);
+        br->kind.data.branch.false_args = _builder.empty_slice(KOOPA_RSIK_VALUE);
+        insts = {c, br};
+        cond->insts = _builder.make_slice(insts, KOOPA_RSIK_VALUE);
+        insts.clear();
+        for (uint32_t j = 0; j < kernel.body->insts.len; j++) {
+            auto inst = slice_at<koopa_raw_value_t>(kernel.body->insts, j);
+            koopa_raw_value_data_t *clone;
+            if (inst->kind.tag == KOOPA_RVT_JUMP) {
+                clone = _builder.new_jump(cond, {map.at(kernel.inc)});
+            } else if (is_address(inst)) {
+                clone = _builder.new_value(i32_ptr, KOOPA_RVT_GET_PTR);
+                size_t base = 0;
+                while (kernel.bases[base] != address_src(inst)) {
+                    base++;
+                }
+                clone->kind.data.get_ptr = {param(base), i};
+            } else {
+                clone = _builder.new_value(inst->ty, inst->kind.tag);
+                clone->kind = inst->kind;
+                for_each_operand_ref(clone, remap);
+            }
+            map[inst] = clone;
+            insts.push_back(clone);
+        }
+        body->insts = _builder.make_slice(insts, KOOPA_RSIK_VALUE);
+        auto ret = _builder.new_value(_builder.unit_type(), KOOPA_RVT_RETURN);
+        ret->kind.data.ret.value = i;
+        insts = {ret};
+        end->insts = _builder.make_slice(insts, KOOPA_RSIK_VALUE);
+        std::vector<koopa_raw_basic_block_t> bbs = {entry, cond, body, end};
+        vec->bbs = _builder.make_slice(bbs, KOOPA_RSIK_BASIC_BLOCK);
+        _kernels.push_back(vec);
+
+        // 前置基本块中调用, 数组的基址先转换为指向首个元素的指针
+        std::vector<koopa_raw_value_t> extra, args;
+        for (auto base : kernel.bases) {
+            if (base->ty->data.pointer.base->tag == KOOPA_RTT_ARRAY) {
+                auto first = _builder.new_value(i32_ptr, KOOPA_RVT_GET_ELEM_PTR);
+                first->kind.data.get_elem_ptr = {base, _builder.integer(0)};
+                extra.push_back(first);
+                base = first;
+            }
+            args.push_back(base);
+        }
+        args.insert(args.end(), kernel.scalars.begin(), kernel.scalars.end());
+        args.push_back(kernel.init);
+        args.push_back(kernel.n);
+        auto call = _builder.new_value(i32, KOOPA_RVT_CALL);
+        call->kind.data.call.callee = vec;
+        call->kind.data.call.args = _builder.make_slice(args, KOOPA_RSIK_VALUE);
+        extra.push_back(call);
+        mutable_block(kernel.preheader)->insts =
+            _builder.make_slice(insts_with(kernel.preheader, extra), KOOPA_RSIK_VALUE);
+        params = {call};
+        mutable_value(terminator(kernel.preheader))->kind.data.jump.args =
+            _builder.make_slice(params, KOOPA_RSIK_VALUE);
+        vectorized++;
+    }
+    count("vectorized loops", vectorized);
+}
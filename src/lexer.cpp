@@ -0,0 +1,267 @@
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "lexer.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#define LEXER_SIMD
+#endif
+
+namespace {
+
+// 向量操作, 只用到按字节比较和取掩码
+#if defined(__AVX2__)
+    constexpr size_t lanes = 32;
+    using vec = __m256i;
+    inline vec load(const char *p) { return _mm256_loadu_si256(reinterpret_cast<const vec*>(p)); }
+    inline vec splat(char c) { return _mm256_set1_epi8(c); }
+    inline vec eq(vec a, vec b) { return _mm256_cmpeq_epi8(a, b); }
+    inline vec gt(vec a, vec b) { return _mm256_cmpgt_epi8(a, b); }
+    inline vec either(vec a, vec b) { return _mm256_or_si256(a, b); }
+    inline vec both(vec a, vec b) { return _mm256_and_si256(a, b); }
+    inline uint32_t bits(vec v) { return static_cast<uint32_t>(_mm256_movemask_epi8(v)); }
+#elif defined(__SSE2__)
+    constexpr size_t lanes = 16;
+    using vec = __m128i;
+    inline vec load(const char *p) { return _mm_loadu_si128(reinterpret_cast<const vec*>(p)); }
+    inline vec splat(char c) { return _mm_set1_epi8(c); }
+    inline vec eq(vec a, vec b) { return _mm_cmpeq_epi8(a, b); }
+    inline vec gt(vec a, vec b) { return _mm_cmpgt_epi8(a, b); }
+    inline vec either(vec a, vec b) { return _mm_or_si128(a, b); }
+    inline vec both(vec a, vec b) { return _mm_and_si128(a, b); }
+    inline uint32_t bits(vec v) { return static_cast<uint32_t>(_mm_movemask_epi8(v)); }
+#endif
+
+#ifdef LEXER_SIMD
+    constexpr uint32_t all_lanes = static_cast<uint32_t>((1ull << lanes) - 1);
+
+    // 空白字符所在位置的掩码
+    inline uint32_t space_bits(vec v) {
+        return bits(either(either(eq(v, splat(' ')), eq(v, splat('\t'))),
+                           either(eq(v, splat('\n')), eq(v, splat('\r')))));
+    }
+    // 标识符字符所在位置的掩码, 有符号比较使 0x80 以上的字节不落在任何区间内
+    inline uint32_t ident_bits(vec v) {
+        vec lower = either(v, splat(0x20));
+        vec alpha = both(gt(lower, splat('a' - 1)), gt(splat('z' + 1), lower));
+        vec digit = both(gt(v, splat('0' - 1)), gt(splat('9' + 1), v));
+        return bits(either(either(alpha, digit), eq(v, splat('_'))));
+    }
+#endif
+
+    inline bool is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+    inline bool is_alpha(char c) { return (c | 0x20) >= 'a' && (c | 0x20) <= 'z'; }
+    inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+    inline bool is_ident(char c) { return is_alpha(c) || is_digit(c) || c == '_'; }
+
+    // 跳过空白, 返回第一个非空白字符的位置
+    // token 之间通常只有一两个空白, 先逐字节检查, 遇到较长的空白 (缩进, 空行) 再批量跳过
+    const char *skip_space(const char *p, const char *end) {
+        for (int i = 0; i < 2; i++, p++) {
+            if (p == end || !is_space(*p)) {
+                return p;
+            }
+        }
+#ifdef LEXER_SIMD
+        while (static_cast<size_t>(end - p) >= lanes) {
+            uint32_t rest = space_bits(load(p)) ^ all_lanes;
+            if (rest) {
+                return p + __builtin_ctz(rest);
+            }
+            p += lanes;
+        }
+#endif
+        while (p < end && is_space(*p)) {
+            p++;
+        }
+        return p;
+    }
+
+    // 查找字符 c, 不存在时返回 end
+    const char *find_char(const char *p, const char *end, char c) {
+#ifdef LEXER_SIMD
+        vec target = splat(c);
+        while (static_cast<size_t>(end - p) >= lanes) {
+            uint32_t found = bits(eq(load(p), target));
+            if (found) {
+                return p + __builtin_ctz(found);
+            }
+            p += lanes;
+        }
+#endif
+        while (p < end && *p != c) {
+            p++;
+        }
+        return p;
+    }
+
+    // 返回标识符结尾的位置, 短标识符同样先逐字节检查
+    const char *ident_end(const char *p, const char *end) {
+        for (int i = 0; i < 4; i++, p++) {
+            if (p == end || !is_ident(*p)) {
+                return p;
+            }
+        }
+#ifdef LEXER_SIMD
+        while (static_cast<size_t>(end - p) >= lanes) {
+            uint32_t rest = ident_bits(load(p)) ^ all_lanes;
+            if (rest) {
+                return p + __builtin_ctz(rest);
+            }
+            p += lanes;
+        }
+#endif
+        while (p < end && is_ident(*p)) {
+            p++;
+        }
+        return p;
+    }
+
+    // 关键字的完美哈希, 9 个关键字的首尾字符与长度恰好映射到不同的位置
+    struct Keyword {
+        const char *text;
+        size_t length;
+        int token;
+    };
+    inline unsigned keyword_hash(const char *p, size_t length) {
+        return (p[0] * 5 + p[length - 1] + length) & 15;
+    }
+    const Keyword keywords[16] = {
+        {}, {}, {"else", 4, ELSE}, {}, {"int", 3, INT}, {"if", 2, IF}, {"void", 4, VOID}, {},
+        {"const", 5, CONST}, {}, {"break", 5, BREAK}, {}, {"continue", 8, CONTINUE}, {"while", 5, WHILE},
+        {"return", 6, RETURN}, {},
+    };
+
+    // 按 strtol 的规则累加数字, 溢出时取 LONG_MAX
+    inline void accumulate(unsigned long &value, unsigned base, unsigned digit) {
+        if (value > (static_cast<unsigned long>(LONG_MAX) - digit) / base) {
+            value = LONG_MAX;
+        } else {
+            value = value * base + digit;
+        }
+    }
+    inline int hex_digit(char c) {
+        if (is_digit(c)) {
+            return c - '0';
+        }
+        c |= 0x20;
+        return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+    }
+}
+
+void Lexer::read(FILE *in) {
+    _owned.clear();
+    char buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        _owned.append(buffer, n);
+    }
+    reset(_owned.data(), _owned.data() + _owned.size());
+}
+
+int Lexer::next(YYSTYPE *yylval) {
+    auto p = _cur, end = _end;
+    for (;;) {
+        p = skip_space(p, end);
+        if (p == end) {
+            _cur = p;
+            return 0;
+        }
+        // 注释, 未闭合的块注释与 SysY.l 一致, 只返回一个 '/'
+        if (*p == '/' && p + 1 < end) {
+            if (p[1] == '/') {
+                p = find_char(p + 2, end, '\n');
+                continue;
+            }
+            if (p[1] == '*') {
+                auto q = p + 2;
+                while ((q = find_char(q, end, '*')) < end && (q + 1 == end || q[1] != '/')) {
+                    q++;
+                }
+                if (q < end) {
+                    p = q + 2;
+                    continue;
+                }
+            }
+        }
+        break;
+    }
+
+    auto start = p;
+    char c = *p;
+    if (is_alpha(c) || c == '_') {
+        // 标识符与关键字
+        p = ident_end(p + 1, end);
+        _cur = p;
+        size_t length = p - start;
+        if (length >= 2 && length <= 8) {
+            auto &keyword = keywords[keyword_hash(start, length)];
+            if (keyword.length == length && std::memcmp(keyword.text, start, length) == 0) {
+                return keyword.token;
+            }
+        }
+        yylval->sym_val = context->interner.intern(start, length);
+        return IDENTIFIER;
+    }
+    if (is_digit(c)) {
+        // 整数字面量, 与 SysY.l 中的三种形式相同
+        unsigned long value = 0;
+        p++;
+        if (c != '0') {
+            value = c - '0';
+            while (p < end && is_digit(*p)) {
+                accumulate(value, 10, *p++ - '0');
+            }
+        } else if (p + 1 < end && (*p | 0x20) == 'x' && hex_digit(p[1]) >= 0) {
+            p++;
+            int digit;
+            while (p < end && (digit = hex_digit(*p)) >= 0) {
+                accumulate(value, 16, digit);
+                p++;
+            }
+        } else {
+            while (p < end && *p >= '0' && *p <= '7') {
+                accumulate(value, 8, *p++ - '0');
+            }
+        }
+        _cur = p;
+        yylval->int_val = static_cast<int>(static_cast<long>(value));
+        return INT_CONST;
+    }
+    // 其余单个字符直接返回
+    _cur = p + 1;
+    return c;
+}
+
+#ifdef HAND_LEXER
+// 与 flex 生成的可重入 lexer 相同的接口, 供 parser 和 driver 使用
+
+struct yy_buffer_state;
+
+int yylex_init(yyscan_t *scanner) {
+    *scanner = new Lexer();
+    return 0;
+}
+
+void yyset_in(FILE *in, yyscan_t scanner) {
+    static_cast<Lexer*>(scanner)->read(in);
+}
+
+yy_buffer_state *yy_scan_buffer(char *base, size_t size, yyscan_t scanner) {
+    // 与 flex 相同, 末尾的两个 NUL 不属于输入内容
+    static_cast<Lexer*>(scanner)->reset(base, base + size - 2);
+    // 调用者只检查返回值是否为空, 不会使用其内容
+    return reinterpret_cast<yy_buffer_state*>(scanner);
+}
+
+int yylex_destroy(yyscan_t scanner) {
+    delete static_cast<Lexer*>(scanner);
+    return 0;
+}
+
+int yylex(YYSTYPE *yylval, yyscan_t scanner) {
+    return static_cast<Lexer*>(scanner)->next(yylval);
+}
+#endif
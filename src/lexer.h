@@ -0,0 +1,33 @@
+#ifndef __LEXER_H__
+#define __LEXER_H__
+
+#include <cstdio>
+#include <string>
+
+// 由 Bison 生成的头文件
+#include "SysY.tab.hpp"
+
+// 手写的 SysY lexer, 识别的 token 与 SysY.l 完全相同
+// 空白, 注释内容和标识符的结尾使用 SIMD 批量查找 (AVX2 或 SSE2, 否则逐字节处理)
+// 关键字通过完美哈希识别, 整数字面量直接在扫描时计算
+// 以 make LEXER=hand 构建时代替 flex 生成的 lexer, 否则只用于 bench 中的比较
+class Lexer {
+private:
+    const char *_cur = nullptr;
+    const char *_end = nullptr;
+    // 从文件读取时保存输入内容
+    std::string _owned;
+
+public:
+    // 扫描 [begin, end) 中的内容, 不会越过 end 读取, 也不修改缓冲区
+    void reset(const char *begin, const char *end) {
+        _cur = begin;
+        _end = end;
+    }
+    // 读入整个文件后扫描
+    void read(FILE *in);
+    // 返回下一个 token, 输入结束时返回 0
+    int next(YYSTYPE *yylval);
+};
+
+#endif
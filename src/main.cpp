@@ -1,109 +1,91 @@
-#include <cassert>
 #include <iostream>
-#include <fstream>
-#include <sstream>
-#include <memory>
 #include <string>
-#include "koopa.h"
-#include "koopa_parser.h"
-#include "AST_SysY.h"
+#include <thread>
+#include "driver.h"
 
 using namespace std;
 
-// 声明 lexer 的输入, 以及 parser 函数
-// sysy.tab.hpp 不包含 yyin 的定义，且并不总是存在，所以不使用include方式
-// 看起来会很烦人, 于是干脆采用这种看起来 dirty 但实际很有效的手段
-extern FILE *yyin;
-extern int yyparse(unique_ptr<BaseAST> &ast);
-
 int main(int argc, const char *argv[]) {
     // 解析命令行参数. 测试脚本/评测平台要求你的编译器能接收如下参数:
-    // compiler 模式 输入文件 -o 输出文件
-    assert(argc == 5);
-    auto mode = argv[1];
-    auto input = argv[2];
-    auto output = argv[4];
-
-    assert(mode[1] == 'k' || mode[1] == 'r' || mode[1] == 'p' ||
-           mode[1] == 'v' || mode[1] == 'd');
-    auto k2r = (mode[1] != 'k' && mode[1] != 'd');
-
-    // 打开输入文件, 并且指定 lexer 在解析的时候读取这个文件
-    yyin = fopen(input, "r");
-    assert(yyin);
-
-    // 调用 parser 函数, parser 函数会进一步调用 lexer 解析输入文件的
-    unique_ptr<BaseAST> ast;
-    auto ret = yyparse(ast);
-    assert(!ret);
-    symbol_table.release();
-    share_table.release();
-
-    // 使用 ss 可能导致更大的内存代价, 但能减少时间代价并防止输出不一致
-    stringstream ss;
-    if (mode[1] == 'd') {
-        ast->dump(ss);
-    } else {
-        ast->compile(ss);
+    // compiler 模式 输入文件 -o 输出文件 [选项...]
+    // -run 模式不生成汇编, 在进程内执行程序, 输出文件中记录返回值和各基本块的动态指令数
+    // 另有两种常驻模式, 每个请求同样是 "模式 输入文件 -o 输出文件" 的形式:
+    //   compiler --serve socket路径 [选项...]   监听 Unix socket, 逐行处理请求
+    //   compiler --batch 清单文件 [选项...]      并发编译清单中的每一行请求
+    // 可选参数:
+    //   -j N   并行线程数, N 为 0 时使用全部核心
+    //          单次编译时用于后端并行编译函数, 常驻模式下用于并发处理请求
+    //   -O0/-O1  单次编译时关闭/开启 IR 优化, 默认开启
+    //   --unroll=N  单次编译时循环展开的倍数, 默认为 4, 小于 2 时不展开
+    //   --vectorize 单次编译时将逐元素的简单循环向量化, 生成的代码需要 V 扩展
+    //   --echo 单次编译时同时将结果打印到标准输出
+    //   --time-phases  单次编译时在标准错误输出各阶段耗时
+    //   --trace=文件   单次编译时将各阶段计时以 Chrome trace event 格式写入文件
+    if (argc < 3) {
+        cerr << "usage: compiler mode input -o output [-j N]" << endl;
+        return 1;
     }
-    ss << endl;
-    auto s = ss.str();
-
-    // 第一阶段: 将 SysY 代码转换为 Koopa IR
-    // 如果不转化koopa, 则输出解析得到的 AST 后结束
-    if (!k2r) {
-        if (output) {
-            ofstream ofs(output);
-            ofs << s;
+    string first = argv[1];
+    bool resident = first == "--serve" || first == "--batch";
+    int positional = resident ? 3 : 5;
+    if (argc < positional) {
+        cerr << "usage: compiler mode input -o output [-j N]" << endl;
+        return 1;
+    }
+    int jobs = resident ? 0 : 1;
+    int opt_level = 1;
+    int unroll = 4;
+    bool vectorize = false;
+    bool echo = false;
+    bool time_phases = false;
+    string trace;
+    for (int i = positional; i < argc; i++) {
+        string option = argv[i];
+        if (option == "-j" && i + 1 < argc) {
+            jobs = stoi(argv[++i]);
+        } else if ((option == "-O0" || option == "-O1") && !resident) {
+            opt_level = option[2] - '0';
+        } else if (option.compare(0, 9, "--unroll=") == 0 && !resident) {
+            unroll = stoi(option.substr(9));
+        } else if (option == "--vectorize" && !resident) {
+            vectorize = true;
+        } else if (option == "--echo" && !resident) {
+            echo = true;
+        } else if (option == "--time-phases" && !resident) {
+            time_phases = true;
+        } else if (option.compare(0, 8, "--trace=") == 0 && !resident) {
+            trace = option.substr(8);
+        } else {
+            cerr << "unknown option: " << option << endl;
+            return 1;
         }
-        cout << "Koopa:\n------\n";
     }
-
-    // 输出解析得到的 AST
-    cout << s;
-    if (!k2r) {
-        return 0;
+    if (jobs <= 0) {
+        jobs = thread::hardware_concurrency();
     }
 
-    // 第二阶段: 将 Koopa IR 转换为 RISC-V 汇编代码
-    // 第一步：将 Koopa IR 转换为内存形式 raw program
-    // 解析字符串 str, 得到 Koopa IR 程序
-    koopa_program_t program;
-    koopa_error_code_t err_code = koopa_parse_from_string(s.c_str(), &program);
-    assert(err_code == KOOPA_EC_SUCCESS);  // 确保解析时没有出错
-    // 创建一个 raw program builder, 用来构建 raw program
-    koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
-    // 将 Koopa IR 程序转换为 raw program
-    koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
-    // 释放 Koopa IR 程序占用的内存
-    koopa_delete_program(program);
-
-    // 处理 raw program
-    ss = stringstream();
-    auto parser = KoopaParser(ss);
-    // 访问 raw program, 生成 raw program 的文本表示
-    if (mode[1] == 'v') {
-        cout << "Raw:\n----\n";
-        KoopaParser(cout).Visit(raw);
+    if (first == "--serve") {
+        return run_server(argv[2], jobs);
     }
-
-    // 第二步：将 raw program 转换为 RISC-V 汇编代码
-    // 生成 RISCV 汇编代码
-    parser.Compile(raw);
-
-    // 处理完成, 释放 raw program builder 占用的内存
-    // 注意, raw program 中所有的指针指向的内存均为 raw program builder 的内存
-    // 所以不要在 raw program 处理完毕之前释放 builder
-    koopa_delete_raw_program_builder(builder);
-
-    // 输出
-    s = ss.str();
-    if (output) {
-        ofstream ofs(output);
-        ofs << s;
+    if (first == "--batch") {
+        return run_batch(argv[2], jobs);
     }
-    cout << "RISCV:\n----\n";
-    cout << s;
 
+    CompileOptions options;
+    options.mode = argv[1];
+    options.input = argv[2];
+    options.output = argv[4];
+    options.jobs = jobs;
+    options.opt_level = opt_level;
+    options.unroll = unroll;
+    options.vectorize = vectorize;
+    options.echo = echo;
+    options.time_phases = time_phases;
+    options.trace = trace;
+    string error;
+    if (!compile(options, error)) {
+        cerr << "error: " << error << endl;
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,114 @@
+#include "riscv_code.h"
+
+namespace {
+    // 指令的文本格式
+    enum class Format : uint8_t {
+        None,
+        Label,
+        // rd, rs1, rs2
+        Reg,
+        // rd, rs1, imm
+        Imm,
+        // rd, rs1
+        Unary,
+        // rd, imm
+        Li,
+        // rd, imm(rs1)
+        Load,
+        // rs2, imm(rs1)
+        Store,
+        // label
+        Jump,
+        // rs1, label
+        Branch,
+        // rs1, rs2, label
+        Compare,
+        // rd, rs1, e32, m1, ta, ma
+        Vsetvli,
+        // rd, (rs1)
+        VLoad,
+        // rs2, (rs1)
+        VStore,
+    };
+
+    struct OpInfo {
+        const char *name;
+        Format format;
+    };
+
+    // 按 RiscvOp 的顺序排列
+    const OpInfo op_info[] = {
+        {"", Format::None},
+        {"", Format::Label},
+        {"li", Format::Li}, {"mv", Format::Unary}, {"lw", Format::Load}, {"sw", Format::Store},
+        {"addi", Format::Imm}, {"slti", Format::Imm}, {"andi", Format::Imm}, {"ori", Format::Imm},
+        {"xori", Format::Imm}, {"slli", Format::Imm}, {"srli", Format::Imm}, {"srai", Format::Imm},
+        {"add", Format::Reg}, {"sub", Format::Reg}, {"mul", Format::Reg}, {"mulh", Format::Reg}, {"div", Format::Reg},
+        {"rem", Format::Reg}, {"slt", Format::Reg}, {"and", Format::Reg}, {"or", Format::Reg},
+        {"xor", Format::Reg},
+        {"seqz", Format::Unary}, {"snez", Format::Unary},
+        {"j", Format::Jump}, {"beqz", Format::Branch}, {"bnez", Format::Branch},
+        {"beq", Format::Compare}, {"bne", Format::Compare}, {"blt", Format::Compare}, {"bge", Format::Compare},
+        {"bltu", Format::Compare}, {"bgeu", Format::Compare},
+        {"ret", Format::None},
+        {"call", Format::Jump}, {"tail", Format::Jump},
+        {"vsetvli", Format::Vsetvli}, {"vle32.v", Format::VLoad}, {"vse32.v", Format::VStore},
+        {"vadd.vv", Format::Reg}, {"vsub.vv", Format::Reg}, {"vmul.vv", Format::Reg},
+        {"vadd.vx", Format::Reg}, {"vsub.vx", Format::Reg}, {"vmul.vx", Format::Reg}, {"vrsub.vx", Format::Reg},
+        {"vmv.v.x", Format::Unary},
+    };
+    static_assert(sizeof(op_info) / sizeof(op_info[0]) == static_cast<size_t>(RiscvOp::VmvVX) + 1,
+                  "op_info out of sync with RiscvOp");
+}
+
+void RiscvCode::print(Emitter &o) const {
+    for (auto &inst : _insts) {
+        auto &info = op_info[static_cast<size_t>(inst.op)];
+        switch (info.format) {
+            case Format::None:
+                if (inst.op != RiscvOp::Nop) {
+                    o << info.name << '\n';
+                }
+                break;
+            case Format::Label:
+                o << inst.label << ":\n";
+                break;
+            case Format::Reg:
+                o << info.name << ' ' << inst.rd << ", " << inst.rs1 << ", " << inst.rs2 << '\n';
+                break;
+            case Format::Imm:
+                o << info.name << ' ' << inst.rd << ", " << inst.rs1 << ", " << inst.imm << '\n';
+                break;
+            case Format::Unary:
+                o << info.name << ' ' << inst.rd << ", " << inst.rs1 << '\n';
+                break;
+            case Format::Li:
+                o << info.name << ' ' << inst.rd << ", " << inst.imm << '\n';
+                break;
+            case Format::Load:
+                o << info.name << ' ' << inst.rd << ", " << inst.imm << '(' << inst.rs1 << ")\n";
+                break;
+            case Format::Store:
+                o << info.name << ' ' << inst.rs2 << ", " << inst.imm << '(' << inst.rs1 << ")\n";
+                break;
+            case Format::Jump:
+                o << info.name << ' ' << inst.label << '\n';
+                break;
+            case Format::Branch:
+                o << info.name << ' ' << inst.rs1 << ", " << inst.label << '\n';
+                break;
+            case Format::Compare:
+                o << info.name << ' ' << inst.rs1 << ", " << inst.rs2 << ", " << inst.label << '\n';
+                break;
+            case Format::Vsetvli:
+                o << info.name << ' ' << inst.rd << ", " << inst.rs1 << ", e32, m1, ta, ma\n";
+                break;
+            case Format::VLoad:
+                o << info.name << ' ' << inst.rd << ", (" << inst.rs1 << ")\n";
+                break;
+            case Format::VStore:
+                o << info.name << ' ' << inst.rs2 << ", (" << inst.rs1 << ")\n";
+                break;
+        }
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef __RISCV_CODE_H__
+#define __RISCV_CODE_H__
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "emitter.h"
+
+// 内存中的 RISC-V 指令序列
+// 后端先生成一个函数的指令序列, 经过窥孔优化后再输出为文本
+
+enum class RiscvOp : uint8_t {
+    // 被删除的指令, 在优化的每一轮结束时移除
+    Nop,
+    Label,
+    Li, Mv, Lw, Sw,
+    Addi, Slti, Andi, Ori, Xori, Slli, Srli, Srai,
+    Add, Sub, Mul, Mulh, Div, Rem, Slt, And, Or, Xor,
+    Seqz, Snez,
+    J, Beqz, Bnez, Beq, Bne, Blt, Bge, Bltu, Bgeu, Ret,
+    // 调用和尾调用, 目标为函数名
+    Call, Tail,
+    // 向量扩展 (RVV 1.0), 元素均为 32 位, LMUL = 1
+    // vsetvli rd, rs1 设置本轮处理的元素个数, vle32.v/vse32.v 的地址在 rs1 中
+    Vsetvli, Vle32, Vse32,
+    // vd = rs1 op rs2, .vx 形式的 rs2 为标量寄存器, vrsub.vx 计算 rs2 - rs1
+    VaddVV, VsubVV, VmulVV, VaddVX, VsubVX, VmulVX, VrsubVX,
+    // 将标量 rs1 复制到 vd 的每个元素
+    VmvVX,
+};
+
+// 寄存器以名称表示, 与寄存器分配的结果相同
+// 访存指令的形式为 lw rd, imm(rs1) 和 sw rs2, imm(rs1), 向量访存 vse32.v 同样以 rs2 为存储的值
+struct RiscvInst {
+    RiscvOp op;
+    const char *rd = nullptr;
+    const char *rs1 = nullptr;
+    const char *rs2 = nullptr;
+    int32_t imm = 0;
+    // 标签和跳转目标, 指向 raw program 中的名称
+    const char *label = nullptr;
+};
+
+inline bool same_reg(const char *a, const char *b) {
+    return a && b && (a == b || std::strcmp(a, b) == 0);
+}
+
+// I 型指令的 12 位有符号立即数
+inline bool is_imm12(int64_t imm) {
+    return imm >= -2048 && imm < 2048;
+}
+
+class RiscvCode {
+private:
+    std::vector<RiscvInst> _insts;
+
+    // reg = base + offset 的高位, offset 改为低 12 位, 高位是 4096 的倍数, li 只需要一条 lui
+    const char *far_base(const char *reg, int32_t &offset, const char *base) {
+        int32_t low = static_cast<int32_t>(static_cast<uint32_t>(offset) << 20) >> 20;
+        li(reg, offset - low);
+        inst(RiscvOp::Add, reg, reg, base);
+        offset = low;
+        return reg;
+    }
+
+public:
+    void label(const char *name) { _insts.push_back({RiscvOp::Label, nullptr, nullptr, nullptr, 0, name}); }
+    // rd = op(rs1, rs2)
+    void inst(RiscvOp op, const char *rd, const char *rs1 = nullptr, const char *rs2 = nullptr) {
+        _insts.push_back({op, rd, rs1, rs2});
+    }
+    void li(const char *rd, int32_t imm) { _insts.push_back({RiscvOp::Li, rd, nullptr, nullptr, imm}); }
+    // rd = op(rs1, imm)
+    void inst_imm(RiscvOp op, const char *rd, const char *rs1, int32_t imm) {
+        _insts.push_back({op, rd, rs1, nullptr, imm});
+    }
+    void addi(const char *rd, const char *rs1, int32_t imm) { inst_imm(RiscvOp::Addi, rd, rs1, imm); }
+    // 偏移量超出 12 位立即数时, 先将高位与 base 相加得到新的基址
+    // lw 使用目标寄存器计算地址, sw 使用与 rs 不同的 t0 或 t1
+    void lw(const char *rd, int32_t offset, const char *base = "sp") {
+        if (!is_imm12(offset)) {
+            base = far_base(rd, offset, base);
+        }
+        _insts.push_back({RiscvOp::Lw, rd, base, nullptr, offset});
+    }
+    void sw(const char *rs, int32_t offset, const char *base = "sp") {
+        if (!is_imm12(offset)) {
+            base = far_base(same_reg(rs, "t0") ? "t1" : "t0", offset, base);
+        }
+        _insts.push_back({RiscvOp::Sw, nullptr, base, rs, offset});
+    }
+    // 跳转和条件分支, 比较 rs1 与零或者 rs1 与 rs2
+    void jump(RiscvOp op, const char *target, const char *rs1 = nullptr, const char *rs2 = nullptr) {
+        _insts.push_back({op, nullptr, rs1, rs2, 0, target});
+    }
+
+    const std::vector<RiscvInst> &insts() const { return _insts; }
+    void clear() { _insts.clear(); }
+
+    // 窥孔优化, 返回删除的指令数, 实现见 riscv_peephole.cpp
+    int64_t optimize();
+    void print(Emitter &o) const;
+};
+
+#endif
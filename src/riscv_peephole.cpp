@@ -0,0 +1,298 @@
+#include <cstring>
+#include <vector>
+#include "riscv_code.h"
+
+// 窥孔优化
+// 每条规则检查从某条指令开始的一小段序列, 匹配时就地改写, 删除的指令先替换为 Nop
+// 按规则表依次尝试, 重复直到没有规则匹配
+// 分析只在基本块内进行: t0, t1 只用于指令内的临时值, 在基本块出口总是死的, 其他寄存器视为活跃
+// 调用会改写调用者保存寄存器, 同样结束一段直线代码
+
+namespace {
+    using Code = std::vector<RiscvInst>;
+
+    // 向前或向后查找的最大指令数, 避免长基本块中的二次复杂度
+    constexpr size_t window = 32;
+
+    bool is_scratch(const char *reg) {
+        return same_reg(reg, "t0") || same_reg(reg, "t1");
+    }
+
+    bool same_label(const char *a, const char *b) {
+        return a == b || std::strcmp(a, b) == 0;
+    }
+
+    bool is_branch(RiscvOp op) {
+        return op >= RiscvOp::Beqz && op <= RiscvOp::Bgeu;
+    }
+
+    // 写入内存的指令, 不写入寄存器
+    bool is_store(RiscvOp op) {
+        return op == RiscvOp::Sw || op == RiscvOp::Vse32;
+    }
+
+    // 条件相反的分支
+    RiscvOp invert(RiscvOp op) {
+        switch (op) {
+            case RiscvOp::Beqz: return RiscvOp::Bnez;
+            case RiscvOp::Bnez: return RiscvOp::Beqz;
+            case RiscvOp::Beq: return RiscvOp::Bne;
+            case RiscvOp::Bne: return RiscvOp::Beq;
+            case RiscvOp::Blt: return RiscvOp::Bge;
+            case RiscvOp::Bge: return RiscvOp::Blt;
+            case RiscvOp::Bltu: return RiscvOp::Bgeu;
+            default: return RiscvOp::Bltu;
+        }
+    }
+
+    // 跳转, 返回和调用, 之后的指令不能依赖之前寄存器中的值
+    bool is_barrier(RiscvOp op) {
+        return op == RiscvOp::J || op == RiscvOp::Ret || op == RiscvOp::Call || op == RiscvOp::Tail;
+    }
+
+    // 控制流指令和标签, 结束一段直线代码
+    bool is_control(RiscvOp op) {
+        return op == RiscvOp::Label || is_branch(op) || is_barrier(op);
+    }
+
+    // 指令写入的寄存器
+    const char *written(const RiscvInst &inst) {
+        return is_control(inst.op) || is_store(inst.op) ? nullptr : inst.rd;
+    }
+
+    bool reads(const RiscvInst &inst, const char *reg) {
+        // 返回时 a0 保存返回值, 调用时 a0-a7 保存实参
+        return same_reg(inst.rs1, reg) || same_reg(inst.rs2, reg) ||
+               (inst.op == RiscvOp::Ret && same_reg(reg, "a0")) ||
+               ((inst.op == RiscvOp::Call || inst.op == RiscvOp::Tail) && reg && reg[0] == 'a');
+    }
+
+    // i 之后 reg 中的值不再被读取
+    bool dead_after(const Code &code, size_t i, const char *reg) {
+        size_t steps = 0;
+        for (size_t j = i + 1; j < code.size() && steps < window; j++) {
+            auto &inst = code[j];
+            if (inst.op == RiscvOp::Nop) {
+                continue;
+            }
+            steps++;
+            if (reads(inst, reg)) {
+                return false;
+            }
+            if (same_reg(written(inst), reg)) {
+                return true;
+            }
+            // 条件分支不结束分析, 分支目标处临时寄存器同样是死的
+            if (inst.op == RiscvOp::Label || is_barrier(inst.op)) {
+                return is_scratch(reg);
+            }
+        }
+        return steps < window && is_scratch(reg);
+    }
+
+    // 下一条未删除的指令
+    size_t next(const Code &code, size_t i) {
+        for (i++; i < code.size() && code[i].op == RiscvOp::Nop; i++) {}
+        return i;
+    }
+
+    // i 之后紧接的标签中是否有 label
+    bool falls_into(const Code &code, size_t i, const char *label) {
+        for (auto j = next(code, i); j < code.size() && code[j].op == RiscvOp::Label; j = next(code, j)) {
+            if (same_label(code[j].label, label)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // mv a, a
+    bool self_move(Code &code, size_t i) {
+        auto &inst = code[i];
+        if (inst.op != RiscvOp::Mv || !same_reg(inst.rd, inst.rs1)) {
+            return false;
+        }
+        inst.op = RiscvOp::Nop;
+        return true;
+    }
+
+    // 写入寄存器已有的值: 在同一段直线代码中, 之前的 li, mv 或 lw 已经写入相同的值
+    bool redundant_value(Code &code, size_t i) {
+        auto &inst = code[i];
+        if (inst.op != RiscvOp::Li && inst.op != RiscvOp::Mv && inst.op != RiscvOp::Lw) {
+            return false;
+        }
+        size_t steps = 0;
+        for (size_t j = i; j-- > 0 && steps < window;) {
+            auto &prev = code[j];
+            if (prev.op == RiscvOp::Nop) {
+                continue;
+            }
+            steps++;
+            if (prev.op == RiscvOp::Label || is_barrier(prev.op)) {
+                return false;
+            }
+            // 之间写入了可能相同的位置, 只有同样以 sp 为基址且偏移量不同时才不会重叠
+            if (inst.op == RiscvOp::Lw && is_store(prev.op) &&
+                (prev.op != RiscvOp::Sw || !same_reg(prev.rs1, "sp") || !same_reg(inst.rs1, "sp") ||
+                 prev.imm == inst.imm)) {
+                return false;
+            }
+            auto dest = written(prev);
+            if (!same_reg(dest, inst.rd) && !same_reg(dest, inst.rs1)) {
+                continue;
+            }
+            bool same = prev.op == inst.op && same_reg(prev.rd, inst.rd) && prev.imm == inst.imm &&
+                        (!inst.rs1 || same_reg(prev.rs1, inst.rs1));
+            if (inst.op == RiscvOp::Mv) {
+                // mv a, b 之后的 mv a, b 或 mv b, a
+                same = prev.op == RiscvOp::Mv && ((same_reg(prev.rd, inst.rd) && same_reg(prev.rs1, inst.rs1)) ||
+                                                  (same_reg(prev.rd, inst.rs1) && same_reg(prev.rs1, inst.rd)));
+            } else if (inst.op == RiscvOp::Lw) {
+                same = same && !same_reg(prev.rd, prev.rs1);
+            }
+            if (!same) {
+                return false;
+            }
+            inst.op = RiscvOp::Nop;
+            return true;
+        }
+        return false;
+    }
+
+    // 存储到加载的转发: sw a, off(sp) 或 lw a, off(sp) 之后的 lw b, off(sp) 改为 mv b, a
+    bool forward_load(Code &code, size_t i) {
+        auto &inst = code[i];
+        if ((inst.op != RiscvOp::Sw && inst.op != RiscvOp::Lw) || !same_reg(inst.rs1, "sp")) {
+            return false;
+        }
+        auto value = inst.op == RiscvOp::Sw ? inst.rs2 : inst.rd;
+        if (inst.op == RiscvOp::Lw && same_reg(value, "sp")) {
+            return false;
+        }
+        size_t steps = 0;
+        for (auto j = next(code, i); j < code.size() && steps < window; j = next(code, j), steps++) {
+            auto &load = code[j];
+            if (is_control(load.op)) {
+                return false;
+            }
+            if (load.op == RiscvOp::Lw && same_reg(load.rs1, "sp") && load.imm == inst.imm) {
+                load = {RiscvOp::Mv, load.rd, value};
+                return true;
+            }
+            if (is_store(load.op) && (load.op != RiscvOp::Sw || !same_reg(load.rs1, "sp") || load.imm == inst.imm)) {
+                return false;
+            }
+            auto dest = written(load);
+            if (same_reg(dest, value) || same_reg(dest, "sp")) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // 跳转到紧接的标签时删除跳转
+    // beqz r, L1; j L2; L1: 改为 bnez r, L2, 其他条件分支同样取相反的条件
+    bool jump_to_next(Code &code, size_t i) {
+        auto &inst = code[i];
+        if (inst.op == RiscvOp::J) {
+            if (!falls_into(code, i, inst.label)) {
+                return false;
+            }
+            inst.op = RiscvOp::Nop;
+            return true;
+        }
+        if (!is_branch(inst.op)) {
+            return false;
+        }
+        if (falls_into(code, i, inst.label)) {
+            inst.op = RiscvOp::Nop;
+            return true;
+        }
+        auto j = next(code, i);
+        if (j == code.size() || code[j].op != RiscvOp::J || !falls_into(code, j, inst.label)) {
+            return false;
+        }
+        inst.op = invert(inst.op);
+        inst.label = code[j].label;
+        code[j].op = RiscvOp::Nop;
+        return true;
+    }
+
+    // li r, a 之后的 addi d, r, b 改为 li d, a + b, mv d, r 改为 li d, a
+    // r 在之后不再使用时删除 li
+    bool fold_li(Code &code, size_t i) {
+        auto &inst = code[i];
+        if (inst.op != RiscvOp::Li) {
+            return false;
+        }
+        auto j = next(code, i);
+        if (j == code.size() || !same_reg(code[j].rs1, inst.rd)) {
+            return false;
+        }
+        auto &use = code[j];
+        int32_t value;
+        if (use.op == RiscvOp::Addi) {
+            value = static_cast<int32_t>(static_cast<uint32_t>(inst.imm) + static_cast<uint32_t>(use.imm));
+        } else if (use.op == RiscvOp::Mv) {
+            value = inst.imm;
+        } else {
+            return false;
+        }
+        if (!same_reg(use.rd, inst.rd) && !(is_scratch(inst.rd) && dead_after(code, j, inst.rd))) {
+            return false;
+        }
+        use = {RiscvOp::Li, use.rd, nullptr, nullptr, value};
+        inst.op = RiscvOp::Nop;
+        return true;
+    }
+
+    // 写入之后不再被读取的临时寄存器
+    bool dead_write(Code &code, size_t i) {
+        auto &inst = code[i];
+        auto dest = written(inst);
+        if (!is_scratch(dest) || !dead_after(code, i, dest)) {
+            return false;
+        }
+        inst.op = RiscvOp::Nop;
+        return true;
+    }
+
+    struct Rule {
+        const char *name;
+        bool (*apply)(Code&, size_t);
+    };
+
+    const Rule rules[] = {
+        {"self move", self_move},
+        {"redundant value", redundant_value},
+        {"forward load", forward_load},
+        {"jump to next", jump_to_next},
+        {"fold li", fold_li},
+        {"dead write", dead_write},
+    };
+}
+
+int64_t RiscvCode::optimize() {
+    auto size = _insts.size();
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 0; i < _insts.size(); i++) {
+            for (auto &rule : rules) {
+                if (_insts[i].op == RiscvOp::Nop) {
+                    break;
+                }
+                changed |= rule.apply(_insts, i);
+            }
+        }
+        // 移除被删除的指令
+        size_t kept = 0;
+        for (auto &inst : _insts) {
+            if (inst.op != RiscvOp::Nop) {
+                _insts[kept++] = inst;
+            }
+        }
+        _insts.resize(kept);
+    }
+    return size - _insts.size();
+}
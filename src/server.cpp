@@ -0,0 +1,209 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include "driver.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+// 编译一行请求, 返回回复内容
+static string handle_request(const string &line) {
+    CompileOptions options;
+    string error;
+    if (!parse_request(line, options, error) || !compile(options, error)) {
+        return "error " + error;
+    }
+    return "ok";
+}
+
+// 批处理
+
+int run_batch(const string &manifest, int jobs) {
+    ifstream ifs(manifest);
+    if (!ifs) {
+        cerr << "cannot open " << manifest << endl;
+        return 1;
+    }
+    atomic<int> failed{0};
+    mutex log_mutex;
+    {
+        ThreadPool pool(jobs);
+        string line;
+        while (getline(ifs, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            pool.submit([line, &failed, &log_mutex] {
+                auto reply = handle_request(line);
+                if (reply != "ok") {
+                    failed++;
+                    lock_guard<mutex> lock(log_mutex);
+                    cerr << line << ": " << reply << endl;
+                }
+            });
+        }
+        pool.wait();
+    }
+    return failed ? 1 : 0;
+}
+
+// 服务
+
+namespace {
+    // 一个客户端连接, 由读取线程和该连接的请求任务共享, 最后一个持有者释放时关闭连接
+    // 请求在线程池中并发编译, 回复按请求的顺序写回
+    class Connection {
+    private:
+        int _fd;
+        mutex _mutex;
+        // 下一个要写回的请求编号, 以及已经完成但尚未轮到的回复
+        uint64_t _next = 0;
+        map<uint64_t, string> _replies;
+        // 写入失败 (如客户端已经关闭) 后不再写回
+        bool _broken = false;
+
+        // 写出全部内容, 不因对端关闭而收到 SIGPIPE
+        bool send_all(const string &text) {
+            size_t sent = 0;
+            while (sent < text.size()) {
+                auto n = send(_fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return false;
+                }
+                sent += n;
+            }
+            return true;
+        }
+
+    public:
+        explicit Connection(int fd) : _fd(fd) {}
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+        ~Connection() { close(_fd); }
+        int fd() const { return _fd; }
+
+        // 记录第 id 个请求的回复, 写回所有已经轮到的回复
+        // 写入失败 (如 EPIPE) 时只关闭这个连接, 读取线程随之结束
+        void reply(uint64_t id, string text) {
+            lock_guard<mutex> lock(_mutex);
+            _replies[id] = std::move(text);
+            for (auto it = _replies.begin(); it != _replies.end() && it->first == _next; it = _replies.erase(it)) {
+                _next++;
+                if (!_broken && !send_all(it->second)) {
+                    _broken = true;
+                    shutdown(_fd, SHUT_RDWR);
+                }
+            }
+        }
+    };
+
+    // 逐行读取连接中的请求, 每个请求作为一个任务交给线程池, 收到 shutdown 时返回 false
+    bool read_requests(const shared_ptr<Connection> &conn, ThreadPool &pool) {
+        string buffer;
+        char chunk[4096];
+        uint64_t next_id = 0;
+        ssize_t n;
+        while ((n = read(conn->fd(), chunk, sizeof(chunk))) > 0 || (n < 0 && errno == EINTR)) {
+            if (n < 0) {
+                continue;
+            }
+            buffer.append(chunk, n);
+            size_t pos;
+            while ((pos = buffer.find('\n')) != string::npos) {
+                auto line = buffer.substr(0, pos);
+                buffer.erase(0, pos + 1);
+                if (line == "shutdown") {
+                    return false;
+                }
+                pool.submit([conn, line, id = next_id++] {
+                    conn->reply(id, handle_request(line) + "\n");
+                });
+            }
+        }
+        return true;
+    }
+}
+
+int run_server(const string &socket_path, int jobs) {
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        cerr << "socket path too long" << endl;
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+    unlink(socket_path.c_str());
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        listen(listen_fd, SOMAXCONN) < 0) {
+        perror("bind");
+        close(listen_fd);
+        return 1;
+    }
+
+    // 每个连接由单独的线程读取, 不占用线程池, 请求逐个交给线程池并发编译
+    // 停止时关闭所有连接的读取端, 等待读取线程结束, 线程池析构时完成已提交的请求
+    atomic<bool> running{true};
+    mutex readers_mutex;
+    condition_variable readers_done;
+    unordered_set<int> open_fds;
+    size_t readers = 0;
+    {
+        ThreadPool pool(jobs);
+        while (running) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            auto conn = make_shared<Connection>(fd);
+            {
+                lock_guard<mutex> lock(readers_mutex);
+                open_fds.insert(fd);
+                readers++;
+            }
+            thread([conn, listen_fd, &pool, &running, &readers_mutex, &readers_done, &open_fds, &readers] {
+                if (!read_requests(conn, pool)) {
+                    // 关闭监听 socket, 使主线程的 accept 返回
+                    running = false;
+                    shutdown(listen_fd, SHUT_RDWR);
+                }
+                lock_guard<mutex> lock(readers_mutex);
+                open_fds.erase(conn->fd());
+                if (!--readers) {
+                    readers_done.notify_all();
+                }
+            }).detach();
+        }
+        unique_lock<mutex> lock(readers_mutex);
+        for (auto fd : open_fds) {
+            shutdown(fd, SHUT_RD);
+        }
+        readers_done.wait(lock, [&readers] { return !readers; });
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <cassert>
+#include "symbol.h"
+
+// 驻留表
+
+uint32_t StringInterner::intern(const char *str, size_t len) {
+    std::string_view key(str, len);
+    auto it = _index.find(key);
+    if (it != _index.end()) {
+        return it->second;
+    }
+    auto symbol = static_cast<uint32_t>(_names.size());
+    _names.emplace_back(str, len);
+    _index.emplace(_names.back(), symbol);
+    return symbol;
+}
+
+// 符号表
+
+SymbolTable::SymbolTable() : _slots(64, {0, none}) {
+    // 全局作用域
+    push_scope();
+}
+
+SymbolTable::Slot* SymbolTable::find_slot(uint32_t symbol, bool insert) {
+    // 符号编号是连续分配的, 乘以奇数常数打散后作为起点
+    size_t mask = _slots.size() - 1;
+    size_t i = (symbol * 0x9E3779B9u) & mask;
+    while (true) {
+        auto &slot = _slots[i];
+        if (slot.symbol == 0) {
+            // 空槽位, 从未被占用
+            if (!insert) {
+                return nullptr;
+            }
+            slot.symbol = symbol + 1;
+            _used++;
+            return &slot;
+        }
+        if (slot.symbol == symbol + 1) {
+            return &slot;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+void SymbolTable::rehash() {
+    std::vector<Slot> old(_slots.size() * 2, {0, none});
+    old.swap(_slots);
+    _used = 0;
+    for (auto &slot : old) {
+        if (slot.symbol) {
+            find_slot(slot.symbol - 1, true)->top = slot.top;
+        }
+    }
+}
+
+void SymbolTable::pop_scope() {
+    assert(_marks.size() > 1 && "cannot pop global scope");
+    auto mark = _marks.back();
+    _marks.pop_back();
+    while (_bindings.size() > mark) {
+        auto &binding = _bindings.back();
+        find_slot(binding.symbol, false)->top = binding.shadowed;
+        _bindings.pop_back();
+    }
+}
+
+ValueAST* SymbolTable::get_var(uint32_t symbol, bool recursive) {
+    auto slot = find_slot(symbol, false);
+    if (!slot || slot->top == none) {
+        return nullptr;
+    }
+    // 不递归查询时, 只接受当前作用域中的绑定
+    if (!recursive && slot->top < _marks.back()) {
+        return nullptr;
+    }
+    return _bindings[slot->top].value;
+}
+
+void SymbolTable::set_var(uint32_t symbol, ValueAST* value) {
+    // 装载因子不超过 1/2
+    if ((_used + 1) * 2 > _slots.size()) {
+        rehash();
+    }
+    auto slot = find_slot(symbol, true);
+    _bindings.push_back({symbol, slot->top, value});
+    slot->top = static_cast<uint32_t>(_bindings.size() - 1);
+}
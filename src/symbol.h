@@ -0,0 +1,69 @@
+#ifndef __SYMBOL_H__
+#define __SYMBOL_H__
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class ValueAST;
+
+// 标识符驻留表, 每个标识符只在第一次出现时复制一次, 之后以符号编号表示
+class StringInterner {
+private:
+    // deque 保证元素地址不变, 索引表的键可以直接引用其中的字符串
+    std::deque<std::string> _names;
+    std::unordered_map<std::string_view, uint32_t> _index;
+public:
+    StringInterner() = default;
+    StringInterner(const StringInterner&) = delete;
+    StringInterner& operator=(const StringInterner&) = delete;
+    // 获取标识符的符号编号, 不存在则创建
+    uint32_t intern(const char *str, size_t len);
+    // 获取符号编号对应的标识符
+    const std::string& name(uint32_t symbol) const { return _names[symbol]; }
+};
+
+// 扁平的作用域符号表
+// 所有作用域的绑定保存在同一个栈中, 同名的绑定通过 shadowed 串成链表
+// 开放寻址表记录每个符号最内层的绑定, 查询不需要逐层遍历作用域
+// 进入作用域只记录栈高度, 退出时弹出该作用域的所有绑定并恢复被遮蔽的绑定
+class SymbolTable {
+private:
+    // 无效的绑定下标
+    static constexpr uint32_t none = UINT32_MAX;
+    struct Binding {
+        uint32_t symbol;
+        // 同一符号的外层绑定
+        uint32_t shadowed;
+        ValueAST* value;
+    };
+    struct Slot {
+        uint32_t symbol;
+        // 该符号最内层的绑定, 为 none 表示当前没有绑定
+        uint32_t top;
+    };
+    std::vector<Binding> _bindings;
+    // 各作用域开始时的栈高度
+    std::vector<uint32_t> _marks;
+    // 开放寻址表, 大小为 2 的幂, 槽位一旦占用不再删除
+    std::vector<Slot> _slots;
+    size_t _used = 0;
+
+    // 查找符号所在的槽位, insert 为真时不存在则占用空槽位
+    Slot* find_slot(uint32_t symbol, bool insert);
+    void rehash();
+public:
+    SymbolTable();
+    // 进入和退出作用域
+    void push_scope() { _marks.push_back(static_cast<uint32_t>(_bindings.size())); }
+    void pop_scope();
+    // 获取符号表中的变量, 若不存在则返回空指针, 默认查询所有外层作用域
+    ValueAST* get_var(uint32_t symbol, bool recursive = true);
+    // 在当前作用域设置变量
+    void set_var(uint32_t symbol, ValueAST* value);
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// 固定大小的线程池, 任务按提交顺序开始执行
+class ThreadPool {
+private:
+    std::vector<std::thread> _workers;
+    std::queue<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::condition_variable _idle;
+    // 正在执行的任务数
+    size_t _running = 0;
+    bool _stop = false;
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _ready.wait(lock, [this] { return _stop || !_tasks.empty(); });
+                if (_tasks.empty()) {
+                    return;
+                }
+                task = std::move(_tasks.front());
+                _tasks.pop();
+                _running++;
+            }
+            task();
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _running--;
+                if (_tasks.empty() && !_running) {
+                    _idle.notify_all();
+                }
+            }
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t threads) {
+        if (!threads) {
+            threads = 1;
+        }
+        for (size_t i = 0; i < threads; i++) {
+            _workers.emplace_back(&ThreadPool::work, this);
+        }
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    // 执行完所有已提交的任务后退出
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _ready.notify_all();
+        for (auto &worker : _workers) {
+            worker.join();
+        }
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.push(std::move(task));
+        }
+        _ready.notify_one();
+    }
+
+    // 等待所有已提交的任务完成
+    void wait() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle.wait(lock, [this] { return _tasks.empty() && !_running; });
+    }
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include <cstdio>
+#include <ostream>
+#include "emitter.h"
+#include "trace.h"
+
+namespace {
+    // 以微秒为单位写出纳秒数, 保留三位小数
+    void write_micros(Emitter &o, int64_t nanos) {
+        o << nanos / 1000 << '.';
+        auto fraction = nanos % 1000;
+        if (fraction < 100) {
+            o << '0';
+        }
+        if (fraction < 10) {
+            o << '0';
+        }
+        o << fraction;
+    }
+}
+
+void Tracer::report(std::ostream &o) const {
+    char line[64];
+    int64_t total = 0;
+    o << "phase           time(ms)\n";
+    for (auto &event : _events) {
+        snprintf(line, sizeof(line), "%-12s %11.3f", event.name, event.duration / 1e6);
+        o << line;
+        for (auto &counter : event.counters) {
+            o << "  " << counter.first << '=' << counter.second;
+        }
+        o << '\n';
+        total += event.duration;
+    }
+    snprintf(line, sizeof(line), "%-12s %11.3f", "total", total / 1e6);
+    o << line << '\n';
+}
+
+bool Tracer::write_trace(const std::string &path) const {
+    Emitter o;
+    o << "{\"traceEvents\":[";
+    bool first = true;
+    for (auto &event : _events) {
+        // 阶段区间
+        o << (first ? "\n" : ",\n");
+        first = false;
+        o << "{\"name\":\"" << event.name << "\",\"cat\":\"compile\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":";
+        write_micros(o, event.start);
+        o << ",\"dur\":";
+        write_micros(o, event.duration);
+        o << ",\"args\":{";
+        for (size_t i = 0; i < event.counters.size(); i++) {
+            o << (i ? "," : "") << '"' << event.counters[i].first << "\":" << event.counters[i].second;
+        }
+        o << "}}";
+        // 计数同时记录为计数器事件, 在时间线上单独显示
+        for (auto &counter : event.counters) {
+            o << ",\n{\"name\":\"" << counter.first << "\",\"ph\":\"C\",\"pid\":1,\"tid\":1,\"ts\":";
+            write_micros(o, event.start + event.duration);
+            o << ",\"args\":{\"" << counter.first << "\":" << counter.second << "}}";
+        }
+    }
+    o << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return o.write_file(path);
+}
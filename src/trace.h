@@ -0,0 +1,71 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 编译阶段计时
+// 每个阶段记录为一个区间, 可附带计数 (节点数, 指令数, 输出字节数等)
+// 可以打印为阶段耗时表, 也可以写出为 Chrome trace event 格式, 用 chrome://tracing 或 Perfetto 查看
+// 未启用时不读取时钟, 也不记录任何内容
+class Tracer {
+private:
+    using clock = std::chrono::steady_clock;
+    struct Event {
+        const char *name;
+        // 相对于 tracer 创建时刻的纳秒数
+        int64_t start;
+        int64_t duration;
+        std::vector<std::pair<const char*, int64_t>> counters;
+    };
+    bool _enabled;
+    clock::time_point _origin;
+    std::vector<Event> _events;
+
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - _origin).count();
+    }
+
+public:
+    explicit Tracer(bool enabled) : _enabled(enabled), _origin(clock::now()) {}
+    bool enabled() const { return _enabled; }
+
+    // 作用域计时器, 析构时结束所在的阶段
+    class Scope {
+    private:
+        Tracer *_tracer;
+        size_t _index;
+    public:
+        Scope(Tracer &tracer, const char *name) : _tracer(tracer._enabled ? &tracer : nullptr) {
+            if (_tracer) {
+                _index = _tracer->_events.size();
+                _tracer->_events.push_back({name, _tracer->now(), 0, {}});
+            }
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        ~Scope() {
+            if (_tracer) {
+                auto &event = _tracer->_events[_index];
+                event.duration = _tracer->now() - event.start;
+            }
+        }
+        // 为当前阶段附加计数
+        void count(const char *name, int64_t value) {
+            if (_tracer) {
+                _tracer->_events[_index].counters.emplace_back(name, value);
+            }
+        }
+    };
+
+    // 打印各阶段耗时和计数
+    void report(std::ostream &o) const;
+    // 以 Chrome trace event 格式写出到文件, 成功返回 true
+    bool write_trace(const std::string &path) const;
+};
+
+#endif